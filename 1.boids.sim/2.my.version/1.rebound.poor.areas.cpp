@@ -1,14 +1,153 @@
 // Include necessary headers for Rcpp and math functions
-#include <Rcpp.h>  // For R/C++ interface
-#include <cmath>   // For math functions like sqrt, pow
-#include <cstdlib> // for rand() and RAND_MAX
+#include <Rcpp.h>    // For R/C++ interface
+#include <algorithm> // For std::count, std::min, std::max, std::copy
+#include <cmath>     // For math functions like sqrt, pow
+#include <cstdint>   // For std::uint64_t
+#include <cstdlib>   // For std::atexit
+#include <memory>    // For std::unique_ptr
+#include <string>    // For the neighbour mode argument
+#include <utility>   // For std::pair
+#include <vector>    // For native state buffers
+#include "boids.bench.h"   // Kernel benchmark harness
+#include "boids.checkpoint.h" // Checkpoints of a world
+#include "boids.ensemble.h" // Ensemble runs on a work-stealing thread pool
+#include "boids.grid.h"    // Uniform-grid spatial hash for the neighbour search
+#include "boids.raster.h"  // Native animation frames
+#include "boids.kernels.h" // Boid and predator step kernels
+#include "boids.mpi.h"     // Domain-decomposed runs over MPI ranks
+#include "boids.rng.h"     // Counter-based random numbers for the perturbation
+#include "boids.simd.h"    // SIMD separation / alignment / cohesion sums
+#include "boids.ssm.h"     // State-space model likelihood (particle filter)
+#include "boids.survey.h"  // Survey sampler
+#include "boids.trajectory.h" // Streaming trajectory file
+#include "boids.world.h"   // Persistent native simulation state
+
+// Compile with OpenMP when available (multithreaded boid and predator loops)
+// [[Rcpp::plugins(openmp)]]
 
 // Use the Rcpp namespace to avoid prefixing everything with Rcpp::
 using namespace Rcpp;
 
+// Translate the neighbor_mode argument into the grid switch of BoidParams
+static bool parse_neighbor_mode(const std::string& neighbor_mode) {
+  if (neighbor_mode == "grid") return true;
+  if (neighbor_mode != "all") stop("neighbor_mode must be \"all\" or \"grid\"");
+  return false;
+}
+
+// Translate the simd argument into an instruction set ("off": plain per-pair loop)
+static SimdLevel parse_simd(const std::string& simd) {
+  SimdLevel level;
+  if (!simd_level_from_name(simd, level)) {
+    stop("simd \"" + simd + "\" is unknown or not supported by this CPU; "
+         "use \"off\", \"auto\", \"avx512\", \"avx2\", \"sse2\", \"neon\" or \"scalar\"");
+  }
+  return level;
+}
+
+// Translate the precision argument into the float switch of BoidWorld
+static bool parse_precision(const std::string& precision) {
+  if (precision == "float") return true;
+  if (precision != "double") stop("precision must be \"double\" or \"float\"");
+  return false;
+}
+
+// Check the thread count; only the synchronous update can run in parallel
+static int check_threads(int n_threads, bool synchronous) {
+  if (n_threads < 1) stop("n_threads must be >= 1");
+  if (n_threads > 1 && !synchronous) stop("n_threads > 1 requires synchronous = TRUE");
+  return n_threads;
+}
+
+// Check the node spacing of the baked area field (0: exact area loops)
+static double check_area_field(double area_field_cell) {
+  if (!(area_field_cell >= 0)) stop("area_field_cell must be >= 0");
+  return area_field_cell;
+}
+
+// Check the neighbour cap (0: every neighbour within neighbor_radius)
+static int check_max_neighbors(int max_neighbors) {
+  if (max_neighbors < 0) stop("max_neighbors must be >= 0");
+  return max_neighbors;
+}
+
+// Check the skin of the Verlet lists (0: none); the lists are built on the grid
+static double check_verlet_skin(double verlet_skin, bool use_grid) {
+  if (!(verlet_skin >= 0)) stop("verlet_skin must be >= 0");
+  if (verlet_skin > 0 && !use_grid) stop("verlet_skin > 0 requires neighbor_mode = \"grid\"");
+  return verlet_skin;
+}
+
+// Translate the neighbor_limit argument into the first_neighbors switch of BoidParams
+static bool parse_neighbor_limit(const std::string& neighbor_limit) {
+  if (neighbor_limit == "first") return true;
+  if (neighbor_limit != "nearest") stop("neighbor_limit must be \"nearest\" or \"first\"");
+  return false;
+}
+
+// Translate the boundary argument into the periodic switch of BoidParams
+static bool parse_boundary(const std::string& boundary) {
+  if (boundary == "periodic") return true;
+  if (boundary != "rebound") stop("boundary must be \"rebound\" or \"periodic\"");
+  return false;
+}
+
+// Translate the backend argument into the on_device switch of BoidWorld
+static bool parse_backend(const std::string& backend) {
+  if (backend == "cpu") return false;
+  if (backend != "gpu") stop("backend must be \"cpu\" or \"gpu\"");
+  if (!BOIDS_USE_GPU) stop("backend = \"gpu\" needs a build with -DBOIDS_USE_GPU=1 and offloading (see boids.gpu.h)");
+  return true;
+}
+
+// Check that the device step covers the parameters: the synchronous step
+// between rebounding walls, without neighbour caps, Verlet lists or a baked
+// area field
+static void check_backend(const BoidParams& par, bool on_device) {
+  if (!on_device) return;
+  if (!par.synchronous) stop("backend = \"gpu\" requires synchronous = TRUE");
+  if (par.periodic) stop("backend = \"gpu\" requires boundary = \"rebound\"");
+  if (par.max_neighbors > 0 || par.verlet_skin > 0 || par.area_field_cell > 0) {
+    stop("backend = \"gpu\" supports neither max_neighbors, verlet_skin nor area_field_cell");
+  }
+}
+
+// Noise seed of a run: the given seed, or 64 bits drawn from R's RNG if NULL,
+// so that set.seed() in R also fixes the C++ noise
+static std::uint64_t noise_seed(Nullable<int> seed) {
+  if (seed.isNotNull()) return (std::uint64_t)(std::uint32_t)as<int>(seed);
+  std::uint64_t hi = (std::uint64_t)(R::unif_rand() * 4294967296.0);
+  std::uint64_t lo = (std::uint64_t)(R::unif_rand() * 4294967296.0);
+  return (hi << 32) | lo;
+}
+
 // This function updates the positions and velocities of all boids.
 // It applies the three Boids rules (separation, alignment, cohesion)
 // and predator avoidance, then updates positions and handles wall rebound.
+// neighbor_mode = "all" compares every pair of boids (O(N^2)), "grid" only
+// scans the 3x3 cells of a uniform grid rebuilt at the start of each step.
+// synchronous = TRUE makes every boid react to the start-of-step state of the
+// others (as in 2c.mistral.rebound.cpp) instead of to the already updated
+// boids, so the result no longer depends on the order of the boids, and the
+// boid loop can run on n_threads threads. With a fixed seed the result is
+// the same for any n_threads (each boid has its own random stream). By default
+// the noise is seeded from R's RNG, so it follows set.seed(); with an explicit
+// seed, give each call its own step number (e.g. the frame number).
+// simd = "auto" computes the separation/alignment/cohesion sums with the
+// widest SIMD kernel of the CPU (or a named one); all kernels give the same
+// result, which differs from simd = "off" only by rounding.
+// area_field_cell > 0 bakes the p_area / r_area forces on a raster with that
+// node spacing and samples it (bilinear) instead of looping over the areas.
+// The raster is cached between calls and rebaked only when the areas, their
+// radii, the domain or the spacing change.
+// max_neighbors = k > 0 makes each boid follow only k of its neighbours
+// within neighbor_radius (topological interaction; the step cost then stays
+// about O(N k) however tight the flocks get): neighbor_limit = "nearest"
+// takes the k nearest, "first" the first k found from the boid's own cell
+// outward (cheaper, but biased by the cell layout). SIMD sums are not used.
+// boundary = "periodic" makes the domain a torus: boids leaving it come back
+// in on the other side, and every distance is taken to the nearest image of
+// the other agent or area (radii should stay below half the domain).
 // [[Rcpp::export]]
 DataFrame update_boids_cpp(
     DataFrame boids,          // DataFrame of boid positions and velocities
@@ -28,234 +167,69 @@ DataFrame update_boids_cpp(
     double cohesion_weight,   // Weight for cohesion rule
     double predator_avoid_weight, // Weight for predator avoidance
     double p_area_avoid_weight, // Weight for p_area avoidance,
-    double r_area_attract_weight // Weight for r_area avoidance, negative because they are rich areas
+    double r_area_attract_weight, // Weight for r_area avoidance, negative because they are rich areas
+    std::string neighbor_mode = "all", // Neighbour search: "all" (every pair) or "grid" (cell list)
+    bool synchronous = false, // Read neighbours from the start-of-step state
+    int n_threads = 1,        // Threads for the boid loop (needs synchronous = TRUE)
+    Nullable<int> seed = R_NilValue, // Seed of the perturbation noise (NULL: drawn from R's RNG)
+    int step = 0,             // Step number, the counter of the noise streams
+    std::string simd = "off", // SIMD neighbour sums: "off", "auto" or an instruction set
+    double area_field_cell = 0, // Node spacing of the baked area field (0: exact area loops)
+    int max_neighbors = 0,    // Neighbours followed per boid (0: all within neighbor_radius)
+    std::string neighbor_limit = "nearest", // With max_neighbors: "nearest" or "first" found
+    std::string boundary = "rebound" // Domain edges: "rebound" (walls) or "periodic" (torus)
 ) {
-  
-  srand(time(NULL)); // seed with current time
-  
+
   // --- 1. Extract Data from R DataFrames ---
-  // Get the number of boids, predators, p_areas and r_areas
-  int n_boids = boids.nrows();
-  int n_predators = predators.nrows();
-  int n_p_areas = p_areas.nrows();
-  int n_r_areas = r_areas.nrows();
-  
-  // Extract boid positions and velocities as Rcpp NumericVectors
+  // Extract boid positions and velocities
   NumericVector x = boids["x"];  // x-coordinates of boids
   NumericVector y = boids["y"];  // y-coordinates of boids
   NumericVector vx = boids["vx"]; // x-velocities of boids
   NumericVector vy = boids["vy"]; // y-velocities of boids
-  
-  // Extract predator positions
-  NumericVector px = predators["x"]; // x-coordinates of predators
-  NumericVector py = predators["y"]; // y-coordinates of predators
-  
-  // Extract p_areas positions
-  NumericVector p_ax = p_areas["x"]; // x-coordinates of p_areas
-  NumericVector p_ay = p_areas["y"]; // y-coordinates of p_areas
-  
-  // Extract p_areas positions
-  NumericVector r_ax = r_areas["x"]; // x-coordinates of r_areas
-  NumericVector r_ay = r_areas["y"]; // y-coordinates of r_areas
-  
-  // --- 2. Helper Function: Limit Vector Magnitude ---
-  // This lambda function limits the magnitude of a 2D vector to max_speed
-  auto limit = [max_speed](NumericVector vec) {
-    double mag = sqrt(pow(vec[0], 2) + pow(vec[1], 2)); // Calculate magnitude
-    if (mag > max_speed) { // If magnitude exceeds max_speed, scale it down
-      vec[0] = vec[0] / mag * max_speed;
-      vec[1] = vec[1] / mag * max_speed;
-    }
-    return vec;
-  };
-  
-  // --- 3. Loop Over Each Boid ---
-  for (int i = 0; i < n_boids; i++) {
-    // Initialize steering vectors for each rule
-    NumericVector sep(2), ali(2), coh(2), pred(2), p_area(2), r_area(2); // sep=separation, ali=alignment, coh=cohesion, pred=predator avoidance, p_area = p_area_avoidance
-    sep[0] = sep[1] = ali[0] = ali[1] = coh[0] = coh[1] = pred[0] = pred[1]= p_area[0] = p_area[1] = r_area[0] = r_area[1] = 0.0; // Initialize to zero
-    int sep_total = 0, ali_total = 0, coh_total = 0; // Counters for averaging
-    
-    // --- 4. Calculate Separation, Alignment, Cohesion ---
-    // For each other boid, calculate the three Boids rules
-    for (int j = 0; j < n_boids; j++) {
-      if (i == j) continue; // Skip self (a boid doesn't interact with itself)
-      
-      // Calculate distance between boid i and boid j
-      double dx = x[i] - x[j];
-      double dy = y[i] - y[j];
-      double d = sqrt(dx*dx + dy*dy);
-      
-      // If within neighbor_radius, apply rules
-      if (d < neighbor_radius) {
-        // --- Separation: Steer to avoid crowding ---
-        // The closer the boid, the stronger the repulsion
-        sep[0] += dx / d; // Add x-component of separation vector
-        sep[1] += dy / d; // Add y-component of separation vector
-        sep_total++;       // Increment counter for averaging
-        
-        // --- Alignment: Steer toward average heading of neighbors ---
-        ali[0] += vx[j];  // Add x-velocity of neighbor
-        ali[1] += vy[j];  // Add y-velocity of neighbor
-        ali_total++;       // Increment counter for averaging
-        
-        // --- Cohesion: Steer toward average position of neighbors ---
-        coh[0] += x[j];   // Add x-position of neighbor
-        coh[1] += y[j];   // Add y-position of neighbor
-        coh_total++;      // Increment counter for averaging
-      }
-    }
-    
-    // --- 5. Calculate Predator Avoidance ---
-    // For each predator, steer away if too close
-    for (int k = 0; k < n_predators; k++) {
-      // Calculate distance between boid i and predator k
-      double dx = x[i] - px[k];
-      double dy = y[i] - py[k];
-      double d = sqrt(dx*dx + dy*dy);
-      
-      // If within predator_radius, add repulsion vector
-      if (d < predator_radius) {
-        pred[0] += dx / d; // Add x-component of avoidance vector
-        pred[1] += dy / d; // Add y-component of avoidance vector
-      }
-    }
-    
-    // --- 5. Calculate p_area Avoidance ---
-    // For each p_area, steer away if too close
-    for (int k = 0; k < n_p_areas; k++) {
-      // Calculate distance between boid i and area k
-      double dx = x[i] - p_ax[k];
-      double dy = y[i] - p_ay[k];
-      double d = sqrt(dx*dx + dy*dy);
-      
-      // If within area_radius, add repulsion vector
-      if (d < p_area_radius[k]) {
-        p_area[0] += dx / d; // Add x-component of avoidance vector
-        p_area[1] += dy / d; // Add y-component of avoidance vector
-      }
-    }
-    
-    // --- 5. Calculate r_area attract ---
-    // For each r_area, steer away if too close
-    for (int k = 0; k < n_r_areas; k++) {
-      // Calculate distance between boid i and area k
-      double dx = r_ax[k] - x[i]; // direction to r_area
-      double dy = r_ay[k] - y[i];
-      double d = sqrt(dx*dx + dy*dy);
-      
-      // If within area , substract attraction vector
-      if (d < r_area_radius[k]) {
-        r_area[0] += dx / d; // Add x-component of avoidance vector
-        r_area[1] += dy / d; // Add y-component of avoidance vector
-      }
-    }
-    
-    
-    // --- 6. Apply Weights and Update Velocity ---
-    // Normalize and apply weights to each steering vector
-    
-    // --- Separation ---
-    if (sep_total > 0) {
-      sep[0] /= sep_total ; // Average x-component
-      sep[1] /= sep_total; // Average y-component
-      sep = limit(sep);    // Limit magnitude
-      sep[0] -= vx[i] * (1 + 1 * sep_total);    // Subtract current velocity (steering = desired - current)
-      sep[1] -= vy[i] * (1 + 1 * sep_total);
-      sep = limit(sep);    // Limit steering force
-    }
-    
-    // --- Alignment ---
-    if (ali_total > 0) {
-      ali[0] /= ali_total; // Average x-component
-      ali[1] /= ali_total; // Average y-component
-      ali = limit(ali);    // Limit magnitude
-      ali[0] -= vx[i];    // Subtract current velocity
-      ali[1] -= vy[i];
-      ali = limit(ali);    // Limit steering force
-    }
-    
-    // --- Cohesion ---
-    if (coh_total > 0) {
-      coh[0] /= coh_total; // Average x-position
-      coh[1] /= coh_total; // Average y-position
-      coh[0] -= x[i];     // Subtract current position (steering toward average)
-      coh[1] -= y[i];
-      coh = limit(coh);    // Limit magnitude
-      coh[0] -= vx[i];    // Subtract current velocity
-      coh[1] -= vy[i];
-      coh = limit(coh);    // Limit steering force
-    }
-    
-    // --- Predator Avoidance ---
-    if (sqrt(pow(pred[0], 2) + pow(pred[1], 2)) > 0) {
-      pred = limit(pred);  // Limit magnitude
-      pred[0] -= vx[i];   // Subtract current velocity
-      pred[1] -= vy[i];
-      pred = limit(pred);  // Limit steering force
-    }
-    
-    // --- p_areas Avoidance ---
-    if (sqrt(pow(p_area[0], 2) + pow(p_area[1], 2)) > 0) {
-      p_area = limit(p_area);  // Limit magnitude
-      p_area[0] -= vx[i];   // Subtract current velocity
-      p_area[1] -= vy[i];
-      p_area = limit(p_area);  // Limit steering force
-    }
-    
-    // --- r_areas attractive ---
-    if (sqrt(pow(r_area[0], 2) + pow(r_area[1], 2)) > 0) {
-      r_area = limit(r_area);  // Limit magnitude
-      r_area[0] -= vx[i];   // add current velocity
-      r_area[1] -= vy[i];
-      r_area = limit(r_area * 2);  // Limit steering force
-    }
-    
-    // --- Update Velocity with Weighted Steering ---
-    // Apply weights and update velocity
-    vx[i] += sep[0] * separation_weight +
-      ali[0] * alignment_weight +
-      coh[0] * cohesion_weight +
-      pred[0] * predator_avoid_weight +
-      p_area[0] * p_area_avoid_weight +
-      r_area[0] * r_area_attract_weight * 3;
-    vy[i] += sep[1] * separation_weight +
-      ali[1] * alignment_weight +
-      coh[1] * cohesion_weight +
-      pred[1] * predator_avoid_weight +
-      p_area[1] * p_area_avoid_weight +
-      r_area[1] * r_area_attract_weight * 3;
-    
-    // --- 7. Limit Speed ---
-    // Ensure boid does not exceed max_speed
-    double speed = sqrt(vx[i]*vx[i] + vy[i]*vy[i]);
-    if (speed > max_speed) {
-      vx[i] = vx[i] / speed * max_speed;
-      vy[i] = vy[i] / speed * max_speed;
-    }
-    
-    // add small perturbation
-    vx[i] += (rand() / (double)RAND_MAX - 0.5) * 0.1;
-    vy[i] += (rand() / (double)RAND_MAX - 0.5) * 0.1;
-    
-    // --- 8. Update Position ---
-    // Move boid according to its velocity
-    x[i] += vx[i];
-    y[i] += vy[i];
-    
-    // --- 9. Rebound Off Walls ---
-    // If boid hits a wall, reverse its velocity and clamp position
-    if (x[i] < 0 || x[i] > width) {
-      vx[i] = -vx[i]; // Reverse x-velocity
-      x[i] = std::max(0.0, std::min(width, x[i])); // Clamp x-position
-    }
-    if (y[i] < 0 || y[i] > height) {
-      vy[i] = -vy[i]; // Reverse y-velocity
-      y[i] = std::max(0.0, std::min(height, y[i])); // Clamp y-position
-    }
+
+  // Extract predator, p_areas and r_areas positions
+  NumericVector px = predators["x"], py = predators["y"];
+  SwarmView<double> pr{px.begin(), py.begin(), nullptr, nullptr, (int)predators.nrows()};
+  NumericVector p_ax = p_areas["x"], p_ay = p_areas["y"];
+  NumericVector r_ax = r_areas["x"], r_ay = r_areas["y"];
+  SquaredRadii p_r2(p_area_radius.begin(), p_area_radius.end());
+  SquaredRadii r_r2(r_area_radius.begin(), r_area_radius.end());
+  AreaView<double> pa{p_ax.begin(), p_ay.begin(), p_area_radius.begin(), p_r2.r2.data(), (int)p_areas.nrows()};
+  AreaView<double> ra{r_ax.begin(), r_ay.begin(), r_area_radius.begin(), r_r2.r2.data(), (int)r_areas.nrows()};
+
+  // With many areas, look them up by cell rather than testing each one
+  // (the index is rebuilt on every call, so it only pays off past a few dozen)
+  AreaGrid p_index, r_index;
+  bool periodic = parse_boundary(boundary);
+  if (pa.n >= 32) {
+    p_index.build(pa.x, pa.y, pa.radius, pa.n, width, height, periodic);
+    pa.index = &p_index;
+  }
+  if (ra.n >= 32) {
+    r_index.build(ra.x, ra.y, ra.radius, ra.n, width, height, periodic);
+    ra.index = &r_index;
   }
-  
-  // --- 10. Return Updated Boids DataFrame ---
+
+  // --- 2. Run One Step ---
+  // The kernel writes straight into the R vectors, as the original in-place code did
+  BoidParams par{width, height, max_speed, neighbor_radius, predator_radius,
+                 separation_weight, alignment_weight, cohesion_weight,
+                 predator_avoid_weight, p_area_avoid_weight, r_area_attract_weight,
+                 1.0, parse_neighbor_mode(neighbor_mode), synchronous,
+                 check_threads(n_threads, synchronous), parse_simd(simd),
+                 check_area_field(area_field_cell), check_max_neighbors(max_neighbors),
+                 parse_neighbor_limit(neighbor_limit), 0.0, periodic};
+  static AreaField<double> field_cache; // Areas are static in the R driver: bake once, reuse
+  const AreaField<double>* field = nullptr;
+  if (par.area_field_cell > 0) {
+    field_cache.update(pa, ra, width, height, par.area_field_cell, periodic);
+    field = &field_cache;
+  }
+  StepWorkspace<double> ws;
+  step_boids(SwarmView<double>{x.begin(), y.begin(), vx.begin(), vy.begin(), (int)boids.nrows()},
+             pr, pa, ra, par, ws, noise_seed(seed), (std::uint64_t)step, field);
+
+  // --- 3. Return Updated Boids DataFrame ---
   return DataFrame::create(
     Named("x") = x,  // Updated x-coordinates
     Named("y") = y,  // Updated y-coordinates
@@ -265,7 +239,12 @@ DataFrame update_boids_cpp(
 }
 
 // This function updates the positions and velocities of all predators.
-// Predators chase the nearest boid and rebound off walls.
+// Predators chase the nearest boid and rebound off walls (boundary =
+// "rebound"), or chase its nearest image and wrap around ("periodic").
+// neighbor_mode = "all" scans every boid for each predator, on n_threads
+// threads (same result for any n_threads); "grid" bins the boids into a
+// cell list (O(N)) and searches it outward from each predator's cell, which
+// finds the same boid at a fraction of the cost when there are many predators.
 // [[Rcpp::export]]
 DataFrame update_predators_cpp(
     DataFrame predators,  // DataFrame of predator positions and velocities
@@ -273,76 +252,1440 @@ DataFrame update_predators_cpp(
     double width,         // Width of the simulation p_area
     double height,        // Height of the simulation p_area
     double max_speed,      // Maximum speed for predators
-    double pred_rel_speed // pred relative speed compared to boids
+    double pred_rel_speed, // pred relative speed compared to boids
+    int n_threads = 1,     // Threads for the nearest-boid search
+    std::string neighbor_mode = "all", // Nearest-boid search: "all" (every boid) or "grid" (cell list)
+    std::string boundary = "rebound" // Domain edges: "rebound" (walls) or "periodic" (torus)
 ) {
-  
+
   // --- 1. Extract Data from R DataFrames ---
-  int n_predators = predators.nrows();
-  int n_boids = boids.nrows();
-  
-  // Extract predator and boid data
   NumericVector px = predators["x"];
   NumericVector py = predators["y"];
   NumericVector pvx = predators["vx"];
   NumericVector pvy = predators["vy"];
   NumericVector bx = boids["x"];
   NumericVector by = boids["y"];
-  
-  // --- 2. Loop Over Each Predator ---
-  for (int i = 0; i < n_predators; i++) {
-    double closest_dist = INFINITY; // Initialize to a large value
-    int closest_boid = -1;           // Index of closest boid
-    
-    // --- 3. Find Closest Boid ---
-    for (int j = 0; j < n_boids; j++) {
-      double dx = bx[j] - px[i];
-      double dy = by[j] - py[i];
-      double d = sqrt(dx*dx + dy*dy);
-      if (d < closest_dist) {
-        closest_dist = d;
-        closest_boid = j;
+
+  // --- 2. Run One Step ---
+  BoidParams par{};
+  par.width = width;
+  par.height = height;
+  par.max_speed = max_speed;
+  par.pred_rel_speed = pred_rel_speed;
+  par.n_threads = check_threads(n_threads, true);
+  par.periodic = parse_boundary(boundary);
+  CellGrid grid;
+  int n_boids = (int)boids.nrows();
+  bool use_grid = parse_neighbor_mode(neighbor_mode);
+  if (use_grid) {
+    // Cells holding about two boids each on average
+    grid.build(bx.begin(), by.begin(), n_boids, width, height,
+               sqrt(2.0 * width * height / std::max(1, n_boids)), par.periodic);
+  }
+  step_predators(SwarmView<double>{px.begin(), py.begin(), pvx.begin(), pvy.begin(), (int)predators.nrows()},
+                 SwarmView<double>{bx.begin(), by.begin(), nullptr, nullptr, n_boids}, par,
+                 use_grid ? &grid : nullptr);
+
+  // --- 3. Return Updated Predators DataFrame ---
+  return DataFrame::create(
+    Named("x") = px,
+    Named("y") = py,
+    Named("vx") = pvx,
+    Named("vy") = pvy
+  );
+}
+
+// Copy the x, y, vx, vy columns of a DataFrame into a native swarm
+template <class T>
+static void swarm_from_df(SwarmState<T>& swarm, DataFrame df) {
+  NumericVector x = df["x"], y = df["y"], vx = df["vx"], vy = df["vy"];
+  swarm.assign(x.begin(), y.begin(), vx.begin(), vy.begin(), (int)df.nrows());
+}
+
+// Copy the x, y columns of a DataFrame and the radii into native areas
+template <class T>
+static void areas_from_df(AreaState<T>& areas, DataFrame df, NumericVector radius) {
+  if (radius.size() != df.nrows()) stop("there must be one radius per area");
+  NumericVector x = df["x"], y = df["y"];
+  areas.assign(x.begin(), y.begin(), radius.begin(), (int)df.nrows());
+}
+
+// DataFrame (x, y, vx, vy) of a native swarm
+template <class T>
+static DataFrame swarm_to_df(const SwarmState<T>& swarm) {
+  return DataFrame::create(
+    Named("x") = NumericVector(swarm.x.begin(), swarm.x.end()),
+    Named("y") = NumericVector(swarm.y.begin(), swarm.y.end()),
+    Named("vx") = NumericVector(swarm.vx.begin(), swarm.vx.end()),
+    Named("vy") = NumericVector(swarm.vy.begin(), swarm.vy.end())
+  );
+}
+
+// Long-format snapshot table (one row per agent per recorded step)
+struct SnapshotTable {
+  std::vector<int> step, id;
+  std::vector<double> x, y, vx, vy;
+
+  template <class T>
+  void record(int s, const SwarmState<T>& b) {
+    for (int i = 0; i < b.size(); i++) {
+      step.push_back(s);
+      id.push_back(i + 1);
+      x.push_back(b.x[i]);
+      y.push_back(b.y[i]);
+      vx.push_back(b.vx[i]);
+      vy.push_back(b.vy[i]);
+    }
+  }
+
+  DataFrame to_df() const {
+    return DataFrame::create(
+      Named("step") = IntegerVector(step.begin(), step.end()),
+      Named("id") = IntegerVector(id.begin(), id.end()),
+      Named("x") = NumericVector(x.begin(), x.end()),
+      Named("y") = NumericVector(y.begin(), y.end()),
+      Named("vx") = NumericVector(vx.begin(), vx.end()),
+      Named("vy") = NumericVector(vy.begin(), vy.end())
+    );
+  }
+};
+
+// Survey sites from a DataFrame with one row per site and columns type
+// ("quadrat", "point" or "transect"), x, y and, as the types need them,
+// x2, y2 (quadrat upper-right corner, transect end), radius (point radius,
+// transect half-width) and sigma (half-normal detection scale; missing, NA
+// or 0: every boid in the site is counted), indexed over the domain
+// (periodic: the sites wrap around its edges)
+static void survey_from_df(SurveySites& sites, DataFrame df, double width, double height,
+                           bool periodic = false) {
+  int n = df.nrows();
+  CharacterVector type = df["type"];
+  NumericVector x = df["x"], y = df["y"];
+  auto column = [&](const char* name) {
+    return df.containsElementNamed(name) ? NumericVector(df[name]) : NumericVector(n, NA_REAL);
+  };
+  NumericVector x2 = column("x2"), y2 = column("y2");
+  NumericVector radius = column("radius"), sigma = column("sigma");
+  sites = SurveySites();
+  for (int s = 0; s < n; s++) {
+    std::string t = as<std::string>(type[s]);
+    double sg = std::isnan(sigma[s]) ? 0.0 : sigma[s];
+    if (sg < 0) stop("survey sigma must be >= 0");
+    if (t == "quadrat") {
+      if (!(x2[s] > x[s] && y2[s] > y[s])) stop("quadrat sites need x2 > x and y2 > y");
+      sites.add(SurveySites::quadrat, x[s], y[s], x2[s], y2[s], 0.0, sg);
+    } else if (t == "point") {
+      if (!(radius[s] > 0)) stop("point sites need radius > 0");
+      sites.add(SurveySites::point, x[s], y[s], x[s], y[s], radius[s], sg);
+    } else if (t == "transect") {
+      if (std::isnan(x2[s]) || std::isnan(y2[s]) || !(radius[s] > 0)) {
+        stop("transect sites need x2, y2 and radius > 0");
+      }
+      sites.add(SurveySites::transect, x[s], y[s], x2[s], y2[s], radius[s], sg);
+    } else {
+      stop("survey site type must be \"quadrat\", \"point\" or \"transect\"");
+    }
+  }
+  sites.build_index(width, height, periodic);
+}
+
+// Survey counts as list(step, counts): counts is a steps x sites integer matrix
+static List survey_to_list(const SurveyCounts& sc) {
+  int n_rows = (int)sc.step.size();
+  IntegerMatrix counts(n_rows, sc.n_sites);
+  for (int r = 0; r < n_rows; r++) {
+    for (int s = 0; s < sc.n_sites; s++) counts(r, s) = sc.counts[(size_t)r * sc.n_sites + s];
+  }
+  return List::create(
+    Named("step") = IntegerVector(sc.step.begin(), sc.step.end()),
+    Named("counts") = counts
+  );
+}
+
+// This function runs the whole simulation (boid step then predator step,
+// as in the R animation loop) for n_steps steps without returning to R.
+// The input DataFrames are not modified. Boids and predators are recorded
+// every `stride` steps; the result is a list with the long-format snapshot
+// tables `boids` and `predators` (columns step, id, x, y, vx, vy) and the
+// final states `final_boids` and `final_predators`, ready to resume a run.
+// Areas are static, as in the R driver. The noise is seeded once per run,
+// from `seed` or from R's RNG (so set.seed() makes the run reproducible);
+// the result is identical for any n_threads. precision = "float" holds the
+// state in single precision (half the memory traffic, twice the SIMD width);
+// the snapshots are then the float values widened back to double.
+// area_field_cell > 0 bakes the area forces once, and max_neighbors /
+// neighbor_limit cap the neighbours of each boid (see update_boids_cpp).
+// verlet_skin > 0 (grid mode) keeps for each boid a list of the boids within
+// neighbor_radius + verlet_skin, reused until some boid has moved by half
+// the skin (less the per-step move in asynchronous mode), instead of
+// searching the grid every step. The result is the same as without lists,
+// up to the order in which the neighbours are summed. It pays off when
+// boids move slowly relative to neighbor_radius: a skin of a few max_speed
+// with synchronous = TRUE is a good start.
+// backend = "gpu" steps the world in device memory (builds with
+// BOIDS_USE_GPU only, see boids.gpu.h); the state is copied back for the
+// snapshots, the survey and the trajectory frames only.
+// boundary = "periodic" runs on a torus (see update_boids_cpp); the births
+// of the population model and the survey sites then wrap too.
+// With a `survey` (see survey_from_df) the boids detected at each site are
+// counted every `survey_stride` steps and returned as `survey`
+// (list(step, counts), counts a steps x sites matrix); stride = 0 then
+// skips the trajectory snapshots altogether. With a `trajectory_file`, a
+// frame is streamed to that file every `trajectory_stride` steps instead
+// (see trajectory_read); with stride = 0 nothing is kept in memory.
+// [[Rcpp::export]]
+List run_simulation_cpp(
+    int n_steps,              // Number of steps to run
+    DataFrame boids,          // DataFrame of boid positions and velocities
+    DataFrame predators,      // DataFrame of predator positions and velocities
+    DataFrame p_areas,        // DataFrame of p_area positions
+    DataFrame r_areas,        // DataFrame of r_area positions
+    double width,             // Width of the simulation area
+    double height,            // Height of the simulation area
+    double max_speed,         // Maximum speed for boids
+    double max_force,         // Maximum steering force (unused, as in update_boids_cpp)
+    double neighbor_radius,   // Radius within which boids interact
+    double predator_radius,   // Radius within which boids avoid predators
+    NumericVector p_area_radius,   // Radius within which boids avoid poor p_areas
+    NumericVector r_area_radius,   // Radius within which boids are attracted by r_areas
+    double separation_weight, // Weight for separation rule
+    double alignment_weight,  // Weight for alignment rule
+    double cohesion_weight,   // Weight for cohesion rule
+    double predator_avoid_weight, // Weight for predator avoidance
+    double p_area_avoid_weight,   // Weight for p_area avoidance
+    double r_area_attract_weight, // Weight for r_area attraction
+    double pred_rel_speed,    // Predator speed relative to boids
+    int stride = 1,           // Record a snapshot every `stride` steps (0: none)
+    std::string neighbor_mode = "all", // Neighbour search: "all" (every pair) or "grid" (cell list)
+    bool synchronous = false, // Read neighbours from the start-of-step state
+    int n_threads = 1,        // Threads for the boid and predator loops (needs synchronous = TRUE)
+    Nullable<int> seed = R_NilValue, // Seed of the perturbation noise (NULL: drawn from R's RNG)
+    std::string simd = "off", // SIMD neighbour sums: "off", "auto" or an instruction set
+    std::string precision = "double", // State precision: "double" or "float"
+    double area_field_cell = 0, // Node spacing of the baked area field (0: exact area loops)
+    Nullable<DataFrame> survey = R_NilValue, // Survey sites (NULL: no survey)
+    int survey_stride = 1,    // Count the survey every `survey_stride` steps
+    std::string trajectory_file = "", // File to stream frames to ("": none)
+    int trajectory_stride = 1, // Write a frame every `trajectory_stride` steps
+    int max_neighbors = 0,    // Neighbours followed per boid (0: all within neighbor_radius)
+    std::string neighbor_limit = "nearest", // With max_neighbors: "nearest" or "first" found
+    double verlet_skin = 0,   // Skin of the Verlet neighbour lists (0: grid search every step)
+    std::string backend = "cpu", // Step on the "cpu" or on the "gpu"
+    std::string boundary = "rebound" // Domain edges: "rebound" (walls) or "periodic" (torus)
+) {
+
+  if (n_steps < 0) stop("n_steps must be >= 0");
+  if (stride < 0) stop("stride must be >= 0");
+  if (survey_stride < 1) stop("survey_stride must be >= 1");
+  if (trajectory_stride < 1) stop("trajectory_stride must be >= 1");
+
+  // --- 1. Copy State into a Native World ---
+  BoidWorld world(parse_precision(precision));
+  world.visit([&](auto& w) {
+    swarm_from_df(w.boids, boids);
+    swarm_from_df(w.predators, predators);
+    areas_from_df(w.p_areas, p_areas, p_area_radius);
+    areas_from_df(w.r_areas, r_areas, r_area_radius);
+  });
+  world.par = BoidParams{width, height, max_speed, neighbor_radius, predator_radius,
+                         separation_weight, alignment_weight, cohesion_weight,
+                         predator_avoid_weight, p_area_avoid_weight, r_area_attract_weight,
+                         pred_rel_speed, parse_neighbor_mode(neighbor_mode), synchronous,
+                         check_threads(n_threads, synchronous), parse_simd(simd),
+                         check_area_field(area_field_cell), check_max_neighbors(max_neighbors),
+                         parse_neighbor_limit(neighbor_limit),
+                         check_verlet_skin(verlet_skin, parse_neighbor_mode(neighbor_mode)),
+                         parse_boundary(boundary)};
+  world.on_device = parse_backend(backend);
+  check_backend(world.par, world.on_device);
+  world.seed = noise_seed(seed); // One seed per run, the step number is the counter
+  if (survey.isNotNull()) {
+    survey_from_df(world.survey, DataFrame(survey.get()), width, height, world.par.periodic);
+    world.survey_counts.clear(world.survey.size());
+    world.survey_stride = survey_stride;
+  }
+  if (!trajectory_file.empty()) {
+    world.trajectory.reset(new TrajectoryWriter(trajectory_file));
+    world.trajectory_stride = trajectory_stride;
+  }
+
+  // --- 2. Step Loop ---
+  SnapshotTable boid_snaps, pred_snaps;
+  for (int s = 1; s <= n_steps; s++) {
+    world.step(1);
+
+    if (stride > 0 && s % stride == 0) {
+      world.visit([&](auto& w) {
+        boid_snaps.record(s, w.boids);
+        pred_snaps.record(s, w.predators);
+      });
+    }
+    if (s % 100 == 0) checkUserInterrupt(); // Let long runs be interrupted from R
+  }
+
+  // --- 3. Return Snapshots and Final State ---
+  List out;
+  world.visit([&](auto& w) {
+    out = List::create(
+      Named("boids") = boid_snaps.to_df(),
+      Named("predators") = pred_snaps.to_df(),
+      Named("final_boids") = swarm_to_df(w.boids),
+      Named("final_predators") = swarm_to_df(w.predators)
+    );
+  });
+  if (survey.isNotNull()) out["survey"] = survey_to_list(world.survey_counts);
+  if (world.trajectory && !world.trajectory->close()) stop("writing " + trajectory_file + " failed");
+  return out;
+}
+
+// Frame style from a named list (px_width, px_height, boid_px, predator_px,
+// area_zones, density_cell_px; unnamed entries keep their defaults)
+static RasterStyle style_from_list(List style) {
+  RasterStyle st;
+  if (style.size() == 0) return st;
+  CharacterVector names = style.names();
+  if (names.size() != style.size()) stop("style must be a named list");
+  for (int k = 0; k < style.size(); k++) {
+    std::string name = as<std::string>(names[k]);
+    SEXP value = style[k];
+    if (name == "px_width") st.px_width = as<int>(value);
+    else if (name == "px_height") st.px_height = as<int>(value);
+    else if (name == "boid_px") st.boid_px = as<int>(value);
+    else if (name == "predator_px") st.predator_px = as<int>(value);
+    else if (name == "area_zones") st.area_zones = as<bool>(value);
+    else if (name == "density_cell_px") st.density_cell_px = as<int>(value);
+    else stop("unknown style entry \"" + name + "\"");
+  }
+  if (st.px_width < 1 || st.px_height < 1 || st.px_width > 65535 || st.px_height > 65535) {
+    stop("px_width and px_height must be in 1 .. 65535");
+  }
+  if (st.boid_px < 0 || st.predator_px < 0 || st.density_cell_px < 0) {
+    stop("boid_px, predator_px and density_cell_px must be >= 0");
+  }
+  return st;
+}
+
+// --- Native Animation ---
+// Frames are drawn in C++ and encoded by a background thread, in place of
+// building a ggplot per frame: an animated GIF, or numbered PNG files if
+// `path` ends in ".png" (boids_0001.png, ...).
+
+// Start an animation of the domain [0, width] x [0, height]; `delay` is the
+// time between frames in seconds, `style` a named list (see style_from_list)
+// [[Rcpp::export]]
+SEXP animation_open(std::string path, double width, double height, double delay = 0.1,
+                    List style = List::create()) {
+  if (!(width > 0 && height > 0)) stop("width and height must be > 0");
+  return XPtr<AnimationWriter>(new AnimationWriter(path, style_from_list(style), width, height, delay), true);
+}
+
+// Draw a frame (same DataFrames as update_boids_cpp) and queue it for encoding
+// [[Rcpp::export]]
+void animation_add_frame(XPtr<AnimationWriter> animation, DataFrame boids, DataFrame predators,
+                         DataFrame p_areas, DataFrame r_areas,
+                         NumericVector p_area_radius, NumericVector r_area_radius) {
+  if (!animation.get()) stop("the animation is no longer valid");
+  SwarmState<double> b, p;
+  AreaState<double> pa, ra;
+  swarm_from_df(b, boids);
+  swarm_from_df(p, predators);
+  areas_from_df(pa, p_areas, p_area_radius);
+  areas_from_df(ra, r_areas, r_area_radius);
+  animation->add(b.view(), p.view(), pa.view(), ra.view());
+}
+
+// Encode the remaining frames and finish the file
+// [[Rcpp::export]]
+void animation_close(XPtr<AnimationWriter> animation) {
+  if (!animation.get()) return;
+  if (!animation->close()) stop("writing the animation failed");
+}
+
+// --- Persistent Native World ---
+// A BoidWorld lives in C++ between calls and is handled from R through an
+// external pointer (see boids.world.r for the R-side object). Parameters are
+// passed as a named list using the names of the R driver variables.
+
+// Numeric parameters, by name
+static const std::pair<const char*, double BoidParams::*> numeric_params[] = {
+  {"width", &BoidParams::width},
+  {"height", &BoidParams::height},
+  {"max_speed", &BoidParams::max_speed},
+  {"neighbor_radius", &BoidParams::neighbor_radius},
+  {"predator_radius", &BoidParams::predator_radius},
+  {"separation_weight", &BoidParams::separation_weight},
+  {"alignment_weight", &BoidParams::alignment_weight},
+  {"cohesion_weight", &BoidParams::cohesion_weight},
+  {"predator_avoid_weight", &BoidParams::predator_avoid_weight},
+  {"p_area_avoid_weight", &BoidParams::p_area_avoid_weight},
+  {"r_area_attract_weight", &BoidParams::r_area_attract_weight},
+  {"pred_rel_speed", &BoidParams::pred_rel_speed}
+};
+
+// Population parameters, by name (see boids.population.h)
+static const std::pair<const char*, double PopulationParams::*> population_params[] = {
+  {"base_growth", &PopulationParams::base_growth},
+  {"base_death", &PopulationParams::base_death},
+  {"linear_impact_growth", &PopulationParams::linear_impact_growth},
+  {"linear_impact_death", &PopulationParams::linear_impact_death},
+  {"sd_overdisp", &PopulationParams::sd_overdisp},
+  {"birth_spread", &PopulationParams::birth_spread},
+  {"kill_radius", &PopulationParams::kill_radius}
+};
+
+// World behind an external pointer (fails if it was not restored, e.g. after readRDS)
+static BoidWorld& world_of(XPtr<BoidWorld> world) {
+  if (!world.get()) stop("the boid world is no longer valid (external pointers do not survive save/load)");
+  return *world;
+}
+
+// Set the parameters named in `params`; returns how many distinct numeric parameters were set.
+// precision is only accepted when the world is created (`creating`), where it is read beforehand.
+static int apply_params(BoidWorld& w, List params, bool creating) {
+  const int n_table = (int)(sizeof(numeric_params) / sizeof(numeric_params[0]));
+  std::vector<bool> seen(n_table, false);
+  CharacterVector names = params.names();
+  if (names.size() != params.size()) stop("params must be a named list");
+  for (int k = 0; k < params.size(); k++) {
+    std::string name = as<std::string>(names[k]);
+    SEXP value = params[k];
+    bool found = false;
+    for (int t = 0; t < n_table; t++) {
+      if (name == numeric_params[t].first) {
+        w.par.*(numeric_params[t].second) = as<double>(value);
+        seen[t] = found = true;
+      }
+    }
+    for (const auto& p : population_params) {
+      if (name == p.first) {
+        w.population.par.*(p.second) = as<double>(value);
+        found = true;
+      }
+    }
+    if (found) continue;
+    if (name == "neighbor_mode") {
+      w.par.use_grid = parse_neighbor_mode(as<std::string>(value));
+    } else if (name == "synchronous") {
+      w.par.synchronous = as<bool>(value);
+    } else if (name == "n_threads") {
+      w.par.n_threads = as<int>(value);
+    } else if (name == "simd") {
+      w.par.simd = parse_simd(as<std::string>(value));
+    } else if (name == "p_area_radius" || name == "r_area_radius") {
+      NumericVector radius(value);
+      w.visit([&](auto& state) {
+        auto& areas = (name == "p_area_radius") ? state.p_areas : state.r_areas;
+        if (radius.size() != areas.size()) stop("there must be one " + name + " per area");
+        areas.set_radius(radius.begin());
+      });
+    } else if (name == "reorder") {
+      std::string curve = as<std::string>(value);
+      if (curve != "off" && curve != "morton" && curve != "hilbert") {
+        stop("reorder must be \"off\", \"morton\" or \"hilbert\"");
+      }
+      if (curve == "off") w.reorder_every = 0;
+      else if (w.reorder_every == 0) w.reorder_every = 10;
+      w.reorder_hilbert = curve != "morton";
+    } else if (name == "reorder_every") {
+      w.reorder_every = as<int>(value);
+      if (w.reorder_every < 0) stop("reorder_every must be >= 0");
+    } else if (name == "year_steps") {
+      w.population.par.year_steps = as<int>(value);
+      if (w.population.par.year_steps < 0) stop("year_steps must be >= 0");
+    } else if (name == "area_field_cell") {
+      w.par.area_field_cell = check_area_field(as<double>(value));
+    } else if (name == "verlet_skin") {
+      w.par.verlet_skin = as<double>(value); // Checked below, once neighbor_mode is known
+    } else if (name == "max_neighbors") {
+      w.par.max_neighbors = check_max_neighbors(as<int>(value));
+    } else if (name == "neighbor_limit") {
+      w.par.first_neighbors = parse_neighbor_limit(as<std::string>(value));
+    } else if (name == "backend") {
+      w.on_device = parse_backend(as<std::string>(value));
+    } else if (name == "boundary") {
+      w.par.periodic = parse_boundary(as<std::string>(value));
+    } else if (name == "precision") {
+      if (!creating) stop("precision can only be chosen when the world is created");
+    } else {
+      stop("unknown parameter \"" + name + "\"");
+    }
+  }
+  check_threads(w.par.n_threads, w.par.synchronous);
+  check_verlet_skin(w.par.verlet_skin, w.par.use_grid);
+  check_backend(w.par, w.on_device);
+  return (int)std::count(seen.begin(), seen.end(), true);
+}
+
+// Row k of a data frame as a named list of length-one values (factors as
+// their labels), to set as parameters
+static List row_of(DataFrame frame, int k) {
+  CharacterVector names = frame.names();
+  List row(frame.size());
+  for (int c = 0; c < frame.size(); c++) {
+    SEXP column = frame[c];
+    if (Rf_isFactor(column)) {
+      row[c] = as<std::string>(CharacterVector(Rf_asCharacterFactor(column))[k]);
+      continue;
+    }
+    switch (TYPEOF(column)) {
+      case REALSXP: row[c] = NumericVector(column)[k]; break;
+      case INTSXP: row[c] = IntegerVector(column)[k]; break;
+      case LGLSXP: row[c] = (bool)LogicalVector(column)[k]; break;
+      case STRSXP: row[c] = as<std::string>(CharacterVector(column)[k]); break;
+      default: stop("column \"" + as<std::string>(names[c]) + "\" must be numeric, logical or character");
+    }
+  }
+  row.names() = names;
+  return row;
+}
+
+// Set the parameters of a new world from the list, over the defaults (see boid_world_create)
+static void init_params(BoidWorld& w, List params) {
+  w.par = BoidParams{};
+  w.par.n_threads = 1;
+  w.par.simd = SimdLevel::off;
+  int n_required = (int)(sizeof(numeric_params) / sizeof(numeric_params[0]));
+  if (apply_params(w, params, true) < n_required) {
+    stop("the numeric parameters width, height, max_speed, neighbor_radius, predator_radius, "
+         "separation_weight, alignment_weight, cohesion_weight, predator_avoid_weight, "
+         "p_area_avoid_weight, r_area_attract_weight and pred_rel_speed are all required");
+  }
+}
+
+// Fill a new world from the initial DataFrames and the parameter list (see boid_world_create)
+static void init_world(BoidWorld& w, DataFrame boids, DataFrame predators,
+                       DataFrame p_areas, DataFrame r_areas,
+                       NumericVector p_area_radius, NumericVector r_area_radius, List params) {
+  w.visit([&](auto& state) {
+    swarm_from_df(state.boids, boids);
+    swarm_from_df(state.predators, predators);
+    areas_from_df(state.p_areas, p_areas, p_area_radius);
+    areas_from_df(state.r_areas, r_areas, r_area_radius);
+  });
+  init_params(w, params);
+}
+
+// This function creates a native world from the initial DataFrames and a
+// named list of parameters: all numeric parameters of the R driver are
+// required (width, height, max_speed, neighbor_radius, predator_radius, the
+// weights and pred_rel_speed); neighbor_mode, synchronous, n_threads, simd,
+// precision and area_field_cell are optional (defaults "all", FALSE, 1,
+// "off", "double", 0), as are the population parameters year_steps (0: no
+// births or deaths), base_growth, base_death, linear_impact_growth,
+// linear_impact_death, sd_overdisp, birth_spread and kill_radius (0: no
+// kills), with the defaults of the sigmoid sandbox model, and reorder
+// ("off", "morton" or "hilbert": sort the boids in memory along that curve)
+// with reorder_every (steps between reorders, default 10),
+// max_neighbors (0) with neighbor_limit ("nearest"), see update_boids_cpp,
+// and verlet_skin (0), backend ("cpu") and boundary ("rebound"), see
+// run_simulation_cpp.
+// The noise is seeded from `seed`, or from R's RNG if NULL.
+// [[Rcpp::export]]
+SEXP boid_world_create(
+    DataFrame boids,              // DataFrame of boid positions and velocities
+    DataFrame predators,          // DataFrame of predator positions and velocities
+    DataFrame p_areas,            // DataFrame of p_area positions
+    DataFrame r_areas,            // DataFrame of r_area positions
+    NumericVector p_area_radius,  // Radius of each p_area
+    NumericVector r_area_radius,  // Radius of each r_area
+    List params,                  // Named list of parameters
+    Nullable<int> seed = R_NilValue // Seed of the perturbation noise (NULL: drawn from R's RNG)
+) {
+  bool single_precision = params.containsElementNamed("precision") &&
+    parse_precision(as<std::string>(params["precision"]));
+  XPtr<BoidWorld> world(new BoidWorld(single_precision), true); // Deleted by R's garbage collector
+  init_world(*world, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius, params);
+  world->seed = noise_seed(seed);
+  return world;
+}
+
+// Advance the world by n_steps steps (in place); returns the step count
+// [[Rcpp::export]]
+double boid_world_step(XPtr<BoidWorld> world, int n_steps = 1) {
+  if (n_steps < 0) stop("n_steps must be >= 0");
+  BoidWorld& w = world_of(world);
+  for (int done = 0; done < n_steps; done += 100) {
+    w.step(std::min(100, n_steps - done));
+    checkUserInterrupt(); // Let long runs be interrupted from R
+  }
+  return (double)w.step_count;
+}
+
+// Current boids (id, x, y, vx, vy; ids are kept for life, see
+// boids.population.h) and predators (x, y, vx, vy), as DataFrames
+// [[Rcpp::export]]
+List boid_world_get_positions(XPtr<BoidWorld> world) {
+  BoidWorld& w = world_of(world);
+  ProfileSpan span(w.profile);
+  PhaseTimer timer(w.profile.lane(0));
+  List out;
+  w.visit([&](auto& state) {
+    auto& b = state.boids;
+    NumericVector id(b.size());
+    for (int i = 0; i < b.size(); i++) {
+      id[i] = (int)w.population.id.size() == b.size() ? (double)w.population.id[i] : i + 1.0;
+    }
+    out = List::create(
+      Named("boids") = DataFrame::create(
+        Named("id") = id,
+        Named("x") = NumericVector(b.x.begin(), b.x.end()),
+        Named("y") = NumericVector(b.y.begin(), b.y.end()),
+        Named("vx") = NumericVector(b.vx.begin(), b.vx.end()),
+        Named("vy") = NumericVector(b.vy.begin(), b.vy.end())
+      ),
+      Named("predators") = swarm_to_df(state.predators),
+      Named("step") = (double)w.step_count
+    );
+  });
+  timer.lap(phase_marshal);
+  return out;
+}
+
+// Change some parameters of the world (named list, same names as in
+// boid_world_create except precision, plus p_area_radius / r_area_radius)
+// [[Rcpp::export]]
+void boid_world_set_params(XPtr<BoidWorld> world, List params) {
+  BoidWorld& w = world_of(world);
+  BoidParams old = w.par;
+  bool old_on_device = w.on_device;
+  try {
+    apply_params(w, params, false);
+  } catch (...) {
+    w.par = old; // Leave the world unchanged if a parameter is invalid
+    w.on_device = old_on_device;
+    throw;
+  }
+  if (w.on_device != old_on_device) w.visit([](auto&) {}); // Host copy up to date, device copy uploaded afresh
+}
+
+// Current parameters of the world, as a named list
+// [[Rcpp::export]]
+List boid_world_get_params(XPtr<BoidWorld> world) {
+  BoidWorld& w = world_of(world);
+  List out;
+  for (const auto& p : numeric_params) out[p.first] = w.par.*(p.second);
+  w.visit([&](auto& state) {
+    out["p_area_radius"] = NumericVector(state.p_areas.radius.begin(), state.p_areas.radius.end());
+    out["r_area_radius"] = NumericVector(state.r_areas.radius.begin(), state.r_areas.radius.end());
+  });
+  out["neighbor_mode"] = w.par.use_grid ? "grid" : "all";
+  out["synchronous"] = w.par.synchronous;
+  out["n_threads"] = w.par.n_threads;
+  out["simd"] = simd_level_name(w.par.simd); // "auto" is reported as the instruction set it picked
+  out["area_field_cell"] = w.par.area_field_cell;
+  out["verlet_skin"] = w.par.verlet_skin;
+  out["max_neighbors"] = w.par.max_neighbors;
+  out["neighbor_limit"] = w.par.first_neighbors ? "first" : "nearest";
+  out["precision"] = w.single_precision() ? "float" : "double";
+  out["backend"] = w.on_device ? "gpu" : "cpu";
+  out["boundary"] = w.par.periodic ? "periodic" : "rebound";
+  for (const auto& p : population_params) out[p.first] = w.population.par.*(p.second);
+  out["year_steps"] = w.population.par.year_steps;
+  out["reorder"] = w.reorder_every == 0 ? "off" : (w.reorder_hilbert ? "hilbert" : "morton");
+  out["reorder_every"] = w.reorder_every;
+  return out;
+}
+
+// Define (or with NULL remove) the survey of the world: the boids detected
+// at each site are counted every `stride` steps from the next step on.
+// Counts collected so far are discarded.
+// [[Rcpp::export]]
+void boid_world_set_survey(XPtr<BoidWorld> world, Nullable<DataFrame> sites, int stride = 1) {
+  BoidWorld& w = world_of(world);
+  if (stride < 1) stop("stride must be >= 1");
+  SurveySites parsed;
+  if (sites.isNotNull()) {
+    survey_from_df(parsed, DataFrame(sites.get()), w.par.width, w.par.height, w.par.periodic);
+  }
+  w.survey = parsed;
+  w.survey_counts.clear(w.survey.size());
+  w.survey_stride = stride;
+}
+
+// Survey counts collected so far, as list(step, counts); clear = TRUE
+// empties them, so that long runs can be collected in pieces
+// [[Rcpp::export]]
+List boid_world_get_survey(XPtr<BoidWorld> world, bool clear = false) {
+  BoidWorld& w = world_of(world);
+  List out = survey_to_list(w.survey_counts);
+  if (clear) w.survey_counts.clear(w.survey.size());
+  return out;
+}
+
+// Find the groups of the world (boids linked within `radius`, 0:
+// neighbor_radius) every `stride` steps from the next step on (stride 0:
+// stop); groups of at least `min_size` boids are listed with their
+// centroids. Statistics collected so far are discarded.
+// [[Rcpp::export]]
+void boid_world_set_flocks(XPtr<BoidWorld> world, double radius = 0, int stride = 1, int min_size = 2) {
+  BoidWorld& w = world_of(world);
+  if (radius < 0) stop("radius must be >= 0");
+  if (stride < 0) stop("stride must be >= 0");
+  if (min_size < 1) stop("min_size must be >= 1");
+  w.flock_radius = radius;
+  w.flock_stride = stride;
+  w.flocks.clear();
+  w.flocks.min_size = min_size;
+}
+
+// Group statistics collected so far: list(summary = (step, n_groups,
+// largest, mean_crowding), histogram = steps x size-bins matrix of group
+// counts (bins 1, 2-3, 4-7, ...), groups = (step, size, x, y) of the groups
+// of at least min_size boids); clear = TRUE empties them
+// [[Rcpp::export]]
+List boid_world_get_flocks(XPtr<BoidWorld> world, bool clear = false) {
+  BoidWorld& w = world_of(world);
+  const FlockRecord& f = w.flocks;
+  int n_rows = (int)f.step.size();
+  IntegerMatrix histogram(n_rows, f.n_bins);
+  for (int r = 0; r < n_rows; r++) {
+    for (int k = 0; k < f.n_bins; k++) histogram(r, k) = f.histogram[(size_t)r * f.n_bins + k];
+  }
+  CharacterVector bins(f.n_bins);
+  for (int k = 0; k < f.n_bins; k++) {
+    int lo = 1 << k, hi = (2 << k) - 1;
+    bins[k] = lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi);
+  }
+  colnames(histogram) = bins;
+  List out = List::create(
+    Named("summary") = DataFrame::create(
+      Named("step") = IntegerVector(f.step.begin(), f.step.end()),
+      Named("n_groups") = IntegerVector(f.n_groups.begin(), f.n_groups.end()),
+      Named("largest") = IntegerVector(f.largest.begin(), f.largest.end()),
+      Named("mean_crowding") = NumericVector(f.mean_crowding.begin(), f.mean_crowding.end())
+    ),
+    Named("histogram") = histogram,
+    Named("groups") = DataFrame::create(
+      Named("step") = IntegerVector(f.group_step.begin(), f.group_step.end()),
+      Named("size") = IntegerVector(f.group_size.begin(), f.group_size.end()),
+      Named("x") = NumericVector(f.group_x.begin(), f.group_x.end()),
+      Named("y") = NumericVector(f.group_y.begin(), f.group_y.end())
+    )
+  );
+  if (clear) w.flocks.clear();
+  return out;
+}
+
+// Profile of the world since it was created or last cleared (only in
+// builds with BOIDS_PROFILE, see boids.profile.h): list(phases = DataFrame
+// (phase, calls, seconds, share of the profiled seconds, ns_per_call),
+// counters = named vector: steps, boid_updates, pairs_tested,
+// pairs_within, tested_per_boid, neighbours_per_boid, grid_builds,
+// cells_per_grid, occupied_share, boids_per_occupied_cell, crowding (cell
+// occupancy seen by the average boid), max_cell, wall_seconds)
+// [[Rcpp::export]]
+List boid_world_get_profile(XPtr<BoidWorld> world, bool clear = false) {
+  BoidWorld& w = world_of(world);
+  if (!BOIDS_PROFILE) {
+    stop("profiling is compiled out: re-source with PKG_CPPFLAGS = \"-DBOIDS_PROFILE=1\" (see boids.profile.h)");
+  }
+  const StepProfile& p = w.profile;
+  ProfileLane t = p.total();
+  double spt = p.seconds_per_tick(), profiled = 0;
+  for (int k = 0; k < n_profile_phases; k++) profiled += t.ticks[k] * spt;
+  CharacterVector phase(n_profile_phases);
+  NumericVector calls(n_profile_phases), seconds(n_profile_phases);
+  NumericVector share(n_profile_phases), ns_per_call(n_profile_phases);
+  for (int k = 0; k < n_profile_phases; k++) {
+    phase[k] = profile_phase_name(k);
+    calls[k] = (double)t.calls[k];
+    seconds[k] = t.ticks[k] * spt;
+    share[k] = profiled > 0 ? seconds[k] / profiled : 0.0;
+    ns_per_call[k] = t.calls[k] ? seconds[k] / t.calls[k] * 1e9 : NA_REAL;
+  }
+  double updates = (double)t.calls[phase_neighbours];
+  double builds = (double)p.grid_builds;
+  NumericVector counters = NumericVector::create(
+    _["steps"] = (double)p.steps,
+    _["boid_updates"] = updates,
+    _["pairs_tested"] = (double)t.pairs_tested,
+    _["pairs_within"] = (double)t.pairs_within,
+    _["tested_per_boid"] = updates > 0 ? t.pairs_tested / updates : NA_REAL,
+    _["neighbours_per_boid"] = updates > 0 ? t.pairs_within / updates : NA_REAL,
+    _["grid_builds"] = builds,
+    _["cells_per_grid"] = builds > 0 ? p.cells / builds : NA_REAL,
+    _["occupied_share"] = p.cells > 0 ? (double)p.occupied_cells / p.cells : NA_REAL,
+    _["boids_per_occupied_cell"] = p.occupied_cells > 0 ? (double)p.binned / p.occupied_cells : NA_REAL,
+    _["crowding"] = p.binned > 0 ? p.binned_sq / p.binned : NA_REAL,
+    _["max_cell"] = (double)p.max_cell,
+    _["wall_seconds"] = p.span_seconds
+  );
+  List out = List::create(
+    Named("phases") = DataFrame::create(
+      Named("phase") = phase,
+      Named("calls") = calls,
+      Named("seconds") = seconds,
+      Named("share") = share,
+      Named("ns_per_call") = ns_per_call,
+      _["stringsAsFactors"] = false
+    ),
+    Named("counters") = counters
+  );
+  if (clear) w.profile.clear();
+  return out;
+}
+
+// Yearly population record of the world (step, n_boids, births, deaths,
+// kills); clear = TRUE empties it
+// [[Rcpp::export]]
+DataFrame boid_world_get_population(XPtr<BoidWorld> world, bool clear = false) {
+  BoidWorld& w = world_of(world);
+  const PopulationLog& log = w.population.log;
+  DataFrame out = DataFrame::create(
+    Named("step") = IntegerVector(log.step.begin(), log.step.end()),
+    Named("n_boids") = IntegerVector(log.n_boids.begin(), log.n_boids.end()),
+    Named("births") = IntegerVector(log.births.begin(), log.births.end()),
+    Named("deaths") = IntegerVector(log.deaths.begin(), log.deaths.end()),
+    Named("kills") = IntegerVector(log.kills.begin(), log.kills.end())
+  );
+  if (clear) w.population.log.clear();
+  return out;
+}
+
+// Stream a frame of the world to `path` every `stride` steps from the next
+// step on (replacing any trajectory file being written)
+// [[Rcpp::export]]
+void boid_world_open_trajectory(XPtr<BoidWorld> world, std::string path, int stride = 1) {
+  BoidWorld& w = world_of(world);
+  if (stride < 1) stop("stride must be >= 1");
+  w.trajectory.reset(); // Closes the previous file
+  w.trajectory.reset(new TrajectoryWriter(path));
+  w.trajectory_stride = stride;
+}
+
+// Finish the trajectory file of the world (all frames written)
+// [[Rcpp::export]]
+void boid_world_close_trajectory(XPtr<BoidWorld> world) {
+  BoidWorld& w = world_of(world);
+  if (!w.trajectory) return;
+  bool ok = w.trajectory->close();
+  w.trajectory.reset();
+  if (!ok) stop("writing the trajectory file failed");
+}
+
+// Draw a frame of the world every `stride` steps from the next step on,
+// into an animation (see animation_open) replacing any being rendered
+// [[Rcpp::export]]
+void boid_world_open_animation(XPtr<BoidWorld> world, std::string path, int stride = 1,
+                               double delay = 0.1, List style = List::create()) {
+  BoidWorld& w = world_of(world);
+  if (stride < 1) stop("stride must be >= 1");
+  RasterStyle st = style_from_list(style);
+  w.animation.reset(); // Finishes the previous animation
+  w.animation.reset(new AnimationWriter(path, st, w.par.width, w.par.height, delay));
+  w.animation_stride = stride;
+}
+
+// Finish the animation of the world (all frames encoded)
+// [[Rcpp::export]]
+void boid_world_close_animation(XPtr<BoidWorld> world) {
+  BoidWorld& w = world_of(world);
+  if (!w.animation) return;
+  bool ok = w.animation->close();
+  w.animation.reset();
+  if (!ok) stop("writing the animation failed");
+}
+
+// --- Checkpoints ---
+
+// Save the whole state of the world to a checkpoint file: agents, areas,
+// parameters, seed, step count and population (not the survey, groups,
+// trajectory, animation or backend; see boids.checkpoint.h). The file is
+// replaced only once complete. Returns its size in bytes.
+// [[Rcpp::export]]
+double boid_world_save(XPtr<BoidWorld> world, std::string path) {
+  return (double)save_checkpoint(world_of(world), path);
+}
+
+// Open a checkpoint file to restore worlds from (see boid_world_restore):
+// the file is mapped once, however many worlds are restored from it
+// [[Rcpp::export]]
+SEXP checkpoint_open(std::string path) {
+  return XPtr<CheckpointReader>(new CheckpointReader(path), true);
+}
+
+// Checkpoint behind `checkpoint`: a path (opened into `opened`) or a checkpoint_open result
+static const CheckpointReader& checkpoint_of(SEXP checkpoint, std::unique_ptr<CheckpointReader>& opened) {
+  if (TYPEOF(checkpoint) == STRSXP) {
+    opened.reset(new CheckpointReader(as<std::string>(checkpoint)));
+    return *opened;
+  }
+  if (TYPEOF(checkpoint) != EXTPTRSXP) stop("checkpoint must be a file name or a checkpoint_open result");
+  XPtr<CheckpointReader> reader(checkpoint);
+  if (!reader.get()) stop("the checkpoint is no longer open (external pointers do not survive save/load)");
+  return *reader;
+}
+
+// Step count, number of boids and precision of a checkpoint
+// [[Rcpp::export]]
+List checkpoint_info(SEXP checkpoint) {
+  std::unique_ptr<CheckpointReader> opened;
+  const CheckpointReader& reader = checkpoint_of(checkpoint, opened);
+  return List::create(
+    Named("step") = (double)reader.step_count(),
+    Named("n_boids") = reader.n_boids(),
+    Named("precision") = reader.single_precision() ? "float" : "double"
+  );
+}
+
+// This function restores a native world from a checkpoint (a file name, or
+// a checkpoint opened by checkpoint_open to fork many worlds from it).
+// The world continues where the saved one stopped, step for step as it
+// would have. Parameters in `params` (as in boid_world_set_params, plus
+// precision) override the saved ones, and a `seed` starts new noise streams
+// from the saved step, e.g. for replicates of one burnt-in state. The world
+// steps on the CPU unless params sets backend.
+// [[Rcpp::export]]
+SEXP boid_world_restore(SEXP checkpoint, List params = List::create(),
+                        Nullable<int> seed = R_NilValue) {
+  std::unique_ptr<CheckpointReader> opened;
+  const CheckpointReader& reader = checkpoint_of(checkpoint, opened);
+  bool single_precision = params.containsElementNamed("precision") ?
+    parse_precision(as<std::string>(params["precision"])) : reader.single_precision();
+  XPtr<BoidWorld> world(new BoidWorld(single_precision), true); // Deleted by R's garbage collector
+  reader.restore(*world);
+  if (params.size() > 0) apply_params(*world, params, true);
+  if (seed.isNotNull()) world->seed = noise_seed(seed);
+  return world;
+}
+
+// --- Ensemble Runs ---
+
+// This function runs an ensemble of independent worlds for n_steps steps:
+// every configuration (row of `sweep`) once per replicate seed, spread over
+// n_workers threads with work stealing. All worlds start from the same
+// DataFrames and base `params` (as in boid_world_create); each row of
+// `sweep` then sets the parameters named by its columns, as
+// boid_world_set_params would (e.g. neighbor_radius, separation_weight,
+// base_growth, year_steps, max_neighbors, verlet_skin, reorder_every, or
+// character columns such as neighbor_mode; not the area radii). Replicate r of every
+// configuration uses seeds[r], so configurations are compared on common
+// random numbers.
+// Each world steps on one thread (n_threads in params is ignored), so the
+// throughput scales with the number of workers. Only summaries come back: a
+// DataFrame `summary` (config, replicate, seed, then the final polarisation,
+// mean_speed and dispersion of the boids, and their groups linked within
+// neighbor_radius: n_groups, largest_group, mean_crowding) and, with a `survey`, `survey`, a
+// list with one list(step, counts) per row of `summary`.
+// [[Rcpp::export]]
+List run_ensemble_cpp(
+    int n_steps,                 // Number of steps of every run
+    DataFrame boids,             // DataFrame of boid positions and velocities
+    DataFrame predators,         // DataFrame of predator positions and velocities
+    DataFrame p_areas,           // DataFrame of p_area positions
+    DataFrame r_areas,           // DataFrame of r_area positions
+    NumericVector p_area_radius, // Radius of each p_area
+    NumericVector r_area_radius, // Radius of each r_area
+    List params,                 // Base parameters (named list, as for boid_world_create)
+    DataFrame sweep,             // One configuration per row: parameter columns
+    IntegerVector seeds,         // Replicate seeds
+    Nullable<DataFrame> survey = R_NilValue, // Survey sites (NULL: no survey)
+    int survey_stride = 1,       // Count the survey every `survey_stride` steps
+    int n_workers = 1            // Worker threads
+) {
+  if (n_steps < 0) stop("n_steps must be >= 0");
+  if (survey_stride < 1) stop("survey_stride must be >= 1");
+  if (n_workers < 1) stop("n_workers must be >= 1");
+  if (seeds.size() == 0) stop("seeds must not be empty");
+
+  // --- 1. Base World and Configurations (all R access happens here) ---
+  bool single_precision = params.containsElementNamed("precision") &&
+    parse_precision(as<std::string>(params["precision"]));
+  BoidWorld base(single_precision);
+  init_world(base, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius, params);
+  base.par.n_threads = 1;
+  int n_configs = sweep.nrows();
+  CharacterVector columns = sweep.names();
+  for (int c = 0; c < columns.size(); c++) {
+    std::string name = as<std::string>(columns[c]);
+    if (name == "p_area_radius" || name == "r_area_radius") {
+      stop("sweep column \"" + name + "\" cannot be swept (one radius per area)");
+    }
+  }
+  std::vector<BoidWorld> configs; // Parameters of each configuration (no agents)
+  configs.reserve(n_configs);
+  for (int k = 0; k < n_configs; k++) {
+    configs.emplace_back(single_precision);
+    BoidWorld& cfg = configs.back();
+    cfg.par = base.par;
+    cfg.population.par = base.population.par;
+    cfg.reorder_every = base.reorder_every;
+    cfg.reorder_hilbert = base.reorder_hilbert;
+    cfg.on_device = base.on_device;
+    try {
+      apply_params(cfg, row_of(sweep, k), false);
+    } catch (std::exception& e) {
+      stop("sweep row " + std::to_string(k + 1) + ": " + e.what());
+    }
+    cfg.par.n_threads = 1;
+  }
+  SurveySites sites;
+  if (survey.isNotNull()) {
+    survey_from_df(sites, DataFrame(survey.get()), base.par.width, base.par.height, base.par.periodic);
+  }
+
+  // --- 2. Run the Worlds on the Pool ---
+  int n_reps = seeds.size();
+  int n_tasks = n_configs * n_reps;
+  std::vector<SwarmSummary> summaries(n_tasks);
+  std::vector<SurveyCounts> counts(n_tasks);
+  std::vector<std::uint64_t> task_seed(n_tasks);
+  for (int t = 0; t < n_tasks; t++) task_seed[t] = (std::uint64_t)(std::uint32_t)seeds[t % n_reps];
+  run_tasks(n_tasks, n_workers, [&](int t) {
+    const BoidWorld& cfg = configs[t / n_reps];
+    BoidWorld w;
+    w.copy_state(base);
+    w.par = cfg.par;
+    w.population.par = cfg.population.par;
+    w.reorder_every = cfg.reorder_every;
+    w.reorder_hilbert = cfg.reorder_hilbert;
+    w.on_device = cfg.on_device;
+    w.seed = task_seed[t];
+    if (sites.size()) {
+      w.survey = sites;
+      w.survey_counts.clear(sites.size());
+      w.survey_stride = survey_stride;
+    }
+    w.step(n_steps);
+    w.visit([&](auto& state) {
+      summaries[t] = summarise_swarm(state.boids.view());
+      summarise_groups(state.boids.view(), w.par.neighbor_radius, w.par.width, w.par.height, summaries[t],
+                       w.par.periodic);
+    });
+    counts[t] = std::move(w.survey_counts);
+  });
+
+  // --- 3. Collect the Summaries ---
+  IntegerVector config(n_tasks), replicate(n_tasks), seed(n_tasks);
+  NumericVector polarisation(n_tasks), mean_speed(n_tasks), dispersion(n_tasks), mean_crowding(n_tasks);
+  IntegerVector n_groups(n_tasks), largest_group(n_tasks);
+  for (int t = 0; t < n_tasks; t++) {
+    config[t] = t / n_reps + 1;
+    replicate[t] = t % n_reps + 1;
+    seed[t] = seeds[t % n_reps];
+    polarisation[t] = summaries[t].polarisation;
+    mean_speed[t] = summaries[t].mean_speed;
+    dispersion[t] = summaries[t].dispersion;
+    n_groups[t] = summaries[t].n_groups;
+    largest_group[t] = summaries[t].largest_group;
+    mean_crowding[t] = summaries[t].mean_crowding;
+  }
+  List out = List::create(
+    Named("summary") = DataFrame::create(
+      Named("config") = config,
+      Named("replicate") = replicate,
+      Named("seed") = seed,
+      Named("polarisation") = polarisation,
+      Named("mean_speed") = mean_speed,
+      Named("dispersion") = dispersion,
+      Named("n_groups") = n_groups,
+      Named("largest_group") = largest_group,
+      Named("mean_crowding") = mean_crowding
+    )
+  );
+  if (survey.isNotNull()) {
+    List surveys(n_tasks);
+    for (int t = 0; t < n_tasks; t++) surveys[t] = survey_to_list(counts[t]);
+    out["survey"] = surveys;
+  }
+  return out;
+}
+
+// --- State-Space Model ---
+
+// Observation and first-year parameters of the state-space model, by name (see boids.ssm.h)
+static const std::pair<const char*, double SsmParams::*> ssm_params[] = {
+  {"catchability", &SsmParams::catchability},
+  {"obs_size", &SsmParams::obs_size},
+  {"n0_min", &SsmParams::n0_min},
+  {"n0_max", &SsmParams::n0_max}
+};
+
+// This function estimates, with a bootstrap particle filter (see
+// boids.ssm.h), the log-likelihood of yearly abundance indices under the
+// sigmoid birth-death model: every column of `index` (a dataset: one index
+// per year, e.g. the summed counts of a survey taken once a year; NA if
+// missing) under every row of `params`. Its numeric columns are the process
+// parameters base_growth, base_death, linear_impact_growth,
+// linear_impact_death and sd_overdisp, and catchability (expected index per
+// boid), obs_size (negative binomial size of the index; 0: Poisson) and
+// n0_min, n0_max (range of the first year's abundance); missing columns
+// take the defaults of the sandbox model, catchability 1, a Poisson index
+// and a first year between K / 10 and K. Dataset d is filtered with the
+// streams of seed + d - 1 under every parameter set, so parameter sets are
+// compared on common random numbers. The fits run on n_threads threads,
+// shared out over the fits and, when there are fewer fits than threads,
+// over the particles of each. Returns `loglik`, a parameter sets x datasets
+// matrix, and with `filtered` also `filtered`, the filtered mean abundance
+// as a years x parameter sets x datasets array.
+// [[Rcpp::export]]
+List ssm_loglik_cpp(
+    NumericMatrix index,         // Years x datasets
+    DataFrame params,            // One parameter set per row
+    int n_particles = 1000,      // Particles per filter
+    Nullable<int> seed = R_NilValue, // Seed of the particle streams (NULL: drawn from R's RNG)
+    int n_threads = 1,           // Threads
+    double resample_ess = 0.5,   // Resample when the effective number of particles falls below this fraction
+    bool filtered = false        // Also return the filtered mean abundances
+) {
+  if (n_particles < 1) stop("n_particles must be >= 1");
+  if (n_threads < 1) stop("n_threads must be >= 1");
+  if (!(resample_ess >= 0 && resample_ess <= 1)) stop("resample_ess must be in [0, 1]");
+
+  // --- 1. Parameter Sets and Datasets (all R access happens here) ---
+  int n_sets = params.size() == 0 ? 1 : params.nrows();
+  std::vector<SsmParams> sets(n_sets);
+  CharacterVector columns = params.names();
+  for (int c = 0; c < params.size(); c++) {
+    std::string name = as<std::string>(columns[c]);
+    NumericVector values = params[c];
+    bool found = false;
+    for (const auto& p : population_params) {
+      if (name == p.first) {
+        for (int k = 0; k < n_sets; k++) sets[k].process.*(p.second) = values[k];
+        found = true;
       }
     }
-    
-    // --- 4. Steer Toward Closest Boid ---
-    if (closest_boid != -1) {
-      double dx = bx[closest_boid] - px[i];
-      double dy = by[closest_boid] - py[i];
-      double d = sqrt(dx*dx + dy*dy);
-      if (d > 0) { // Avoid division by zero
-        // Steer toward the closest boid
-        pvx[i] += dx / d * 0.05; // Small steering force
-        pvy[i] += dy / d * 0.05;
+    for (const auto& p : ssm_params) {
+      if (name == p.first) {
+        for (int k = 0; k < n_sets; k++) sets[k].*(p.second) = values[k];
+        found = true;
       }
     }
-    
-    // --- 5. Limit Speed ---
-    double speed = sqrt(pvx[i]*pvx[i] + pvy[i]*pvy[i]);
-    if (speed > (max_speed * pred_rel_speed)) { // Predators can move slightly faster
-      pvx[i] = pvx[i] / speed * max_speed * pred_rel_speed;
-      pvy[i] = pvy[i] / speed * max_speed * pred_rel_speed;
+    if (!found) stop("params column \"" + name + "\" is not a state-space model parameter");
+  }
+  for (const SsmParams& p : sets) {
+    if (!(p.process.sd_overdisp >= 0)) stop("sd_overdisp must be >= 0");
+    if (!(p.catchability > 0)) stop("catchability must be > 0");
+    if (!(p.obs_size >= 0)) stop("obs_size must be >= 0");
+    if (p.n0_min == 0 && p.n0_max == 0) {
+      double K = p.carrying_capacity();
+      if (!(K > 0 && std::isfinite(K))) stop("the carrying capacity is not positive: give n0_min and n0_max");
+    } else if (!(p.n0_min >= 0 && p.n0_min <= p.n0_max)) {
+      stop("n0_min and n0_max must satisfy 0 <= n0_min <= n0_max");
     }
-    
-    // --- 6. Update Position ---
-    px[i] += pvx[i];
-    py[i] += pvy[i];
-    
-    // --- 7. Rebound Off Walls ---
-    if (px[i] < 0 || px[i] > width) {
-      pvx[i] = -pvx[i];
-      px[i] = std::max(0.0, std::min(width, px[i]));
+  }
+  int n_years = index.nrow(), n_datasets = index.ncol();
+  std::vector<double> y(index.begin(), index.end()); // Column-major: dataset d from y[d * n_years]
+  for (double v : y) if (v < 0) stop("index values must be >= 0 (or NA)");
+  std::uint64_t base_seed = noise_seed(seed);
+
+  // --- 2. Run the Filters on the Pool ---
+  int n_fits = n_sets * n_datasets;
+  int particle_threads = std::max(1, n_threads / std::max(1, n_fits));
+  std::vector<double> loglik(n_fits), means(filtered ? (std::size_t)n_fits * n_years : 0);
+  run_tasks(n_fits, n_threads, [&](int f) {
+    int set = f % n_sets, d = f / n_sets;
+    ParticleFilter filter;
+    loglik[f] = filter.log_likelihood(sets[set], y.data() + (std::size_t)d * n_years, n_years, n_particles,
+                                      base_seed + d, resample_ess, particle_threads,
+                                      filtered ? means.data() + (std::size_t)f * n_years : nullptr);
+  });
+
+  // --- 3. Collect the Results ---
+  NumericMatrix ll(n_sets, n_datasets);
+  std::copy(loglik.begin(), loglik.end(), ll.begin()); // Fit f is (set, dataset) in column-major order
+  List out = List::create(Named("loglik") = ll);
+  if (filtered) {
+    NumericVector fm(means.begin(), means.end());
+    fm.attr("dim") = IntegerVector::create(n_years, n_sets, n_datasets);
+    out["filtered"] = fm;
+  }
+  return out;
+}
+
+// --- Distributed Runs (MPI) ---
+
+#if BOIDS_USE_MPI
+// Start MPI on the first distributed run of a session (unless the host did),
+// and shut it down when R exits
+static void ensure_mpi() {
+  int started = 0;
+  MPI_Initialized(&started);
+  if (started) return;
+  MPI_Init(nullptr, nullptr);
+  std::atexit([] {
+    int done = 0;
+    MPI_Finalized(&done);
+    if (!done) MPI_Finalize();
+  });
+}
+
+// One distributed run in precision T on MPI_COMM_WORLD (see run_simulation_mpi_cpp)
+template <class T>
+static SEXP run_distributed(int n_steps, DataFrame boids, DataFrame predators,
+                            DataFrame p_areas, DataFrame r_areas,
+                            NumericVector p_area_radius, NumericVector r_area_radius,
+                            const BoidParams& par, std::uint64_t seed,
+                            const SurveySites& sites, int survey_stride, bool gather) {
+  if (p_area_radius.size() != p_areas.nrows() || r_area_radius.size() != r_areas.nrows()) {
+    stop("there must be one radius per area");
+  }
+  DistributedWorld<T> world(MPI_COMM_WORLD, par, seed);
+  NumericVector x = boids["x"], y = boids["y"], vx = boids["vx"], vy = boids["vy"];
+  world.assign_boids(x.begin(), y.begin(), vx.begin(), vy.begin(), boids.nrows());
+  NumericVector px = predators["x"], py = predators["y"], pvx = predators["vx"], pvy = predators["vy"];
+  world.assign_predators(px.begin(), py.begin(), pvx.begin(), pvy.begin(), predators.nrows());
+  NumericVector ax = p_areas["x"], ay = p_areas["y"], rx = r_areas["x"], ry = r_areas["y"];
+  world.assign_p_areas(ax.begin(), ay.begin(), p_area_radius.begin(), p_areas.nrows());
+  world.assign_r_areas(rx.begin(), ry.begin(), r_area_radius.begin(), r_areas.nrows());
+  if (sites.size()) {
+    world.survey = sites;
+    world.survey_counts.clear(sites.size());
+    world.survey_stride = survey_stride;
+  }
+
+  world.step(n_steps);
+
+  // --- Collect on rank 0 (every rank takes part in the reductions) ---
+  double n_boids = (double)world.total_boids();
+  double seconds_step, seconds_exchange;
+  world.max_seconds(seconds_step, seconds_exchange);
+  std::vector<BoidRecord<T>> all;
+  if (gather) all = world.gather_boids();
+  SurveyCounts counts = world.reduce_survey();
+  if (world.rank() != 0) return R_NilValue;
+  List out = List::create(
+    Named("n_boids") = n_boids,
+    Named("tiles") = IntegerVector::create(world.tiles().nx, world.tiles().ny),
+    Named("final_predators") = swarm_to_df(world.predator_state()),
+    Named("seconds_step") = seconds_step,
+    Named("seconds_exchange") = seconds_exchange
+  );
+  if (gather) {
+    int n = (int)all.size();
+    IntegerVector id(n);
+    NumericVector fx(n), fy(n), fvx(n), fvy(n);
+    for (int i = 0; i < n; i++) {
+      id[i] = (int)all[i].id;
+      fx[i] = all[i].x; fy[i] = all[i].y;
+      fvx[i] = all[i].vx; fvy[i] = all[i].vy;
     }
-    if (py[i] < 0 || py[i] > height) {
-      pvy[i] = -pvy[i];
-      py[i] = std::max(0.0, std::min(height, py[i]));
+    out["final_boids"] = DataFrame::create(Named("id") = id, Named("x") = fx, Named("y") = fy,
+                                           Named("vx") = fvx, Named("vy") = fvy);
+  }
+  if (sites.size()) out["survey"] = survey_to_list(counts);
+  return out;
+}
+#endif
+
+// This function runs n_steps steps of a world split into spatial tiles over
+// the ranks of an MPI job (see boids.mpi.h): every rank of the job calls it
+// with the same arguments (e.g. an R script run by mpirun -n 64 Rscript),
+// owns the boids of its tile and exchanges the boids near its edges with
+// the neighbouring tiles. `params` is as for boid_world_create, restricted
+// to what a distributed run supports: synchronous = TRUE, boundary =
+// "rebound", no verlet_skin, backend "cpu" and no population dynamics;
+// neighbor_radius and max_speed must be below the side of a tile. n_threads
+// threads step each tile. The result, on rank 0 (NULL on the others), has
+// the total n_boids, the tile layout `tiles` (nx, ny), the final predators,
+// and the final boids `final_boids` (id = row of `boids`, then x, y, vx,
+// vy; skipped with gather = FALSE, when gathering them on one node is too
+// much), the survey counts summed over the tiles as `survey` (with a
+// `survey`, see run_simulation_cpp), and the longest time any rank spent in
+// the steps (seconds_step) and in the exchanges (seconds_exchange). Boids
+// keep their noise stream across tiles, so the run does not depend on the
+// number of ranks (up to rounding with simd), and matches
+// run_simulation_cpp from the same state and seed. Needs a build with
+// -DBOIDS_USE_MPI=1 and the MPI compiler flags (see boids.mpi.h). The seed
+// of rank 0 is used by all (NULL: drawn from its R RNG).
+// [[Rcpp::export]]
+SEXP run_simulation_mpi_cpp(
+    int n_steps,                 // Number of steps to run
+    DataFrame boids,             // DataFrame of boid positions and velocities (the whole domain)
+    DataFrame predators,         // DataFrame of predator positions and velocities
+    DataFrame p_areas,           // DataFrame of p_area positions
+    DataFrame r_areas,           // DataFrame of r_area positions
+    NumericVector p_area_radius, // Radius of each p_area
+    NumericVector r_area_radius, // Radius of each r_area
+    List params,                 // Named list of parameters (as for boid_world_create)
+    Nullable<int> seed = R_NilValue, // Seed of the perturbation noise (NULL: drawn from R's RNG)
+    Nullable<DataFrame> survey = R_NilValue, // Survey sites (NULL: no survey)
+    int survey_stride = 1,       // Count the survey every `survey_stride` steps
+    bool gather = true           // Gather the final boids on rank 0
+) {
+#if BOIDS_USE_MPI
+  if (n_steps < 0) stop("n_steps must be >= 0");
+  if (survey_stride < 1) stop("survey_stride must be >= 1");
+  bool single_precision = params.containsElementNamed("precision") &&
+    parse_precision(as<std::string>(params["precision"]));
+  BoidWorld base(single_precision); // Only parses the parameters
+  init_params(base, params);
+  if (base.population.active()) stop("distributed runs have no population dynamics (year_steps, kill_radius)");
+  if (base.on_device) stop("distributed runs need backend = \"cpu\"");
+  SurveySites sites;
+  if (survey.isNotNull()) survey_from_df(sites, DataFrame(survey.get()), base.par.width, base.par.height);
+
+  ensure_mpi();
+  std::uint64_t s = noise_seed(seed);
+  MPI_Bcast(&s, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD); // Same streams on every rank
+  if (single_precision) {
+    return run_distributed<float>(n_steps, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius,
+                                  base.par, s, sites, survey_stride, gather);
+  }
+  return run_distributed<double>(n_steps, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius,
+                                 base.par, s, sites, survey_stride, gather);
+#else
+  (void)n_steps; (void)boids; (void)predators; (void)p_areas; (void)r_areas; (void)p_area_radius;
+  (void)r_area_radius; (void)params; (void)seed; (void)survey; (void)survey_stride; (void)gather;
+  stop("run_simulation_mpi_cpp needs a build with -DBOIDS_USE_MPI=1 and the MPI compiler flags (see boids.mpi.h)");
+  return R_NilValue; // Not reached
+#endif
+}
+
+// --- Benchmarks ---
+
+// This function times the boid and predator step kernels on each case (row)
+// of `cases`, with columns n_boids, density (neighbor_radius / width, the
+// domain being 1000 x 1000) and optionally n_predators, n_areas (of each
+// kind), neighbor_mode, simd, n_threads, precision and verlet_skin
+// (defaults 10, 10, "grid", "off", 1, "double", 0). Each kernel runs for at least min_time
+// seconds on a fixed random layout. The result has two rows per case
+// (kernel "boids" and "predators") with the case columns, steps, seconds,
+// steps_per_sec and ns_per_boid_step (seconds per step per boid, in ns).
+// [[Rcpp::export]]
+DataFrame benchmark_cpp(DataFrame cases, double min_time = 0.5) {
+  int n = cases.nrows();
+  auto num = [&](const char* name, double fallback) {
+    return cases.containsElementNamed(name) ? NumericVector(cases[name]) : NumericVector(n, fallback);
+  };
+  auto str = [&](const char* name, const char* fallback) {
+    return cases.containsElementNamed(name) ? CharacterVector(cases[name]) : CharacterVector(n, fallback);
+  };
+  NumericVector n_boids = num("n_boids", 5000), density = num("density", 0.1);
+  NumericVector n_predators = num("n_predators", 10), n_areas = num("n_areas", 10);
+  NumericVector n_threads = num("n_threads", 1), verlet_skin = num("verlet_skin", 0);
+  CharacterVector neighbor_mode = str("neighbor_mode", "grid"), simd = str("simd", "off");
+  CharacterVector precision = str("precision", "double");
+
+  int n_rows = 2 * n;
+  IntegerVector case_id(n_rows), o_boids(n_rows), o_predators(n_rows), o_areas(n_rows), o_threads(n_rows);
+  NumericVector o_density(n_rows), o_skin(n_rows), steps(n_rows), seconds(n_rows), steps_per_sec(n_rows), ns(n_rows);
+  CharacterVector kernel(n_rows), o_mode(n_rows), o_simd(n_rows), o_precision(n_rows);
+  for (int k = 0; k < n; k++) {
+    BenchCase c;
+    c.n_boids = (int)n_boids[k];
+    c.n_predators = (int)n_predators[k];
+    c.n_areas = (int)n_areas[k];
+    c.density = density[k];
+    c.use_grid = parse_neighbor_mode(as<std::string>(neighbor_mode[k]));
+    c.simd = parse_simd(as<std::string>(simd[k]));
+    c.n_threads = check_threads((int)n_threads[k], true);
+    c.single = parse_precision(as<std::string>(precision[k]));
+    c.verlet_skin = check_verlet_skin(verlet_skin[k], c.use_grid);
+    if (c.n_boids < 1 || c.n_predators < 0 || c.n_areas < 0 || !(c.density > 0)) {
+      stop("case " + std::to_string(k + 1) + ": need n_boids >= 1, n_predators, n_areas >= 0, density > 0");
+    }
+    BenchResult r = c.single ? bench_case<float>(c, min_time) : bench_case<double>(c, min_time);
+    for (int which = 0; which < 2; which++) {
+      int row = 2 * k + which;
+      case_id[row] = k + 1;
+      o_boids[row] = c.n_boids;
+      o_density[row] = c.density;
+      o_predators[row] = c.n_predators;
+      o_areas[row] = c.n_areas;
+      o_mode[row] = c.use_grid ? "grid" : "all";
+      o_simd[row] = simd_level_name(c.simd);
+      o_threads[row] = c.n_threads;
+      o_precision[row] = c.single ? "float" : "double";
+      o_skin[row] = c.verlet_skin;
+      kernel[row] = which == 0 ? "boids" : "predators";
+      steps[row] = which == 0 ? r.boid_steps : r.predator_steps;
+      seconds[row] = which == 0 ? r.boid_seconds : r.predator_seconds;
+      steps_per_sec[row] = steps[row] / seconds[row];
+      ns[row] = seconds[row] / steps[row] / c.n_boids * 1e9;
     }
+    checkUserInterrupt();
+  }
+  DataFrame out = DataFrame::create(
+    Named("case") = case_id,
+    Named("n_boids") = o_boids,
+    Named("density") = o_density,
+    Named("n_predators") = o_predators,
+    Named("n_areas") = o_areas,
+    Named("neighbor_mode") = o_mode,
+    Named("simd") = o_simd,
+    Named("n_threads") = o_threads,
+    Named("precision") = o_precision,
+    Named("verlet_skin") = o_skin,
+    Named("kernel") = kernel,
+    Named("steps") = steps,
+    Named("seconds") = seconds,
+    Named("steps_per_sec") = steps_per_sec,
+    Named("ns_per_boid_step") = ns,
+    _["stringsAsFactors"] = false
+  );
+  return out;
+}
+
+// --- Trajectory Files ---
+
+// Frames of a trajectory file: their step and agent counts
+// [[Rcpp::export]]
+DataFrame trajectory_info(std::string path) {
+  TrajectoryReader reader(path);
+  int n = reader.n_frames();
+  NumericVector step(n);
+  IntegerVector n_boids(n), n_predators(n);
+  for (int f = 0; f < n; f++) {
+    TrajectoryReader::Frame fr = reader.frame(f);
+    step[f] = (double)fr.step;
+    n_boids[f] = fr.n_boids;
+    n_predators[f] = fr.n_predators;
   }
-  
-  // --- 8. Return Updated Predators DataFrame ---
   return DataFrame::create(
-    Named("x") = px,
-    Named("y") = py,
-    Named("vx") = pvx,
-    Named("vy") = pvy
+    Named("step") = step,
+    Named("n_boids") = n_boids,
+    Named("n_predators") = n_predators
+  );
+}
+
+// Read frames (1-based indices, as in trajectory_info; NULL: all) of the
+// boids or the predators from a trajectory file, as a long-format table
+// (step, id, x, y, vx, vy; boid ids follow each boid for life, as in
+// boid_world_get_positions). The file is memory-mapped, so only the pages
+// of the requested frames are read.
+// [[Rcpp::export]]
+DataFrame trajectory_read(std::string path, Nullable<IntegerVector> frames = R_NilValue,
+                          std::string agents = "boids") {
+  if (agents != "boids" && agents != "predators") stop("agents must be \"boids\" or \"predators\"");
+  TrajectoryReader reader(path);
+  std::vector<int> which;
+  if (frames.isNotNull()) {
+    IntegerVector f = frames.get();
+    for (int k = 0; k < f.size(); k++) {
+      if (f[k] < 1 || f[k] > reader.n_frames()) stop("frame index out of range");
+      which.push_back(f[k] - 1);
+    }
+  } else {
+    for (int f = 0; f < reader.n_frames(); f++) which.push_back(f);
+  }
+  std::size_t n_rows = 0;
+  for (int f : which) {
+    TrajectoryReader::Frame fr = reader.frame(f);
+    n_rows += agents == "boids" ? fr.n_boids : fr.n_predators;
+  }
+  NumericVector step(n_rows), id(n_rows), x(n_rows), y(n_rows), vx(n_rows), vy(n_rows);
+  std::size_t r = 0;
+  for (int f : which) {
+    TrajectoryReader::Frame fr = reader.frame(f);
+    bool b = agents == "boids";
+    int n = b ? fr.n_boids : fr.n_predators;
+    const float* col[4];
+    for (int c = 0; c < 4; c++) col[c] = b ? fr.boid_column(c) : fr.predator_column(c);
+    for (int i = 0; i < n; i++, r++) {
+      step[r] = (double)fr.step;
+      id[r] = b ? (double)fr.id[i] : i + 1.0;
+      x[r] = col[0][i]; y[r] = col[1][i];
+      vx[r] = col[2][i]; vy[r] = col[3][i];
+    }
+  }
+  return DataFrame::create(
+    Named("step") = step,
+    Named("id") = id,
+    Named("x") = x,
+    Named("y") = y,
+    Named("vx") = vx,
+    Named("vy") = vy
   );
 }
@@ -1,8 +1,6 @@
 rm(list = ls())
 
 require(magrittr)
-require(animation)
-require(ggplot2)
 
 wd <- "C:/Users/gbal/Desktop/2025.gregarious.species.indices/1.boids.sim/2.my.version" %T>% 
   setwd()
@@ -30,6 +28,17 @@ predator_avoid_weight <- 1.5
 p_area_avoid_weight <- 1
 r_area_attract_weight <- 5 # in fact coded as attractive now
 pred_rel_speed <- 1.5
+neighbor_mode <- "grid" # "all" compares every pair of boids, "grid" uses a cell list (much faster for many boids)
+synchronous <- TRUE # TRUE: boids react to the previous positions of the others, independent of boid order
+n_threads <- max(1, parallel::detectCores() - 1) # needs synchronous <- TRUE
+simd <- "auto" # SIMD neighbour sums: "off", "auto", or one of "avx512", "avx2", "sse2", "neon", "scalar"
+precision <- "double" # native runs only: "float" halves memory traffic and doubles the SIMD width
+area_field_cell <- 0 # > 0: bake the area forces on a raster with this spacing (areas are static)
+max_neighbors <- 0 # > 0: each boid follows only this many neighbours (topological, step cost ~ n_boids * max_neighbors)
+neighbor_limit <- "nearest" # with max_neighbors: "nearest" neighbours, or "first" found (cheaper)
+verlet_skin <- 0 # > 0 (grid mode): reuse neighbour lists within neighbor_radius + verlet_skin; pays off when max_speed << neighbor_radius
+backend <- "cpu" # "gpu": step in device memory (needs a build with -DBOIDS_USE_GPU=1, see boids.gpu.h, and synchronous <- TRUE)
+boundary <- "rebound" # "periodic": a torus, boids leaving on one side come back on the other (no edge effects)
 
 # Initialize boids
 set.seed(42)
@@ -65,23 +74,156 @@ r_areas <- data.frame(
 )
 
 
-# Animation
-saveGIF({
-  for (i in 1:300) {
-    boids <- update_boids_cpp(boids, predators, p_areas, r_areas, width, height, max_speed, max_force,
-                              neighbor_radius, predator_radius, p_area_radius, r_area_radius,
-                              separation_weight, alignment_weight,
-                              cohesion_weight, predator_avoid_weight, p_area_avoid_weight, r_area_attract_weight)
-    
-    predators <- update_predators_cpp(predators, boids, width, height, max_speed, pred_rel_speed)
-    
-    p <- ggplot() +
-      geom_point(data = boids, aes(x = x, y = y), color = "blue", size = .5) +
-      geom_point(data = predators, aes(x = x, y = y), color = "red", size = 3) +
-      geom_point(data = p_areas, aes(x = x, y = y), color = "black", size = 3) +
-      geom_point(data = r_areas, aes(x = x, y = y), color = "green", size = 3) +
-      coord_fixed(xlim = c(0, width), ylim = c(0, height)) +
-      theme_void()
-    print(p)
-  }
-}, interval = 0.1, outdir = getwd())
+# Animation: frames drawn in C++ and encoded in the background (a ggplot per frame is far slower)
+anim <- animation_open("animation.gif", width, height, delay = 0.1,
+                       style = list(px_width = 600, px_height = 600)) # density_cell_px = 4: shade density instead
+for (i in 1:300) {
+  boids <- update_boids_cpp(boids, predators, p_areas, r_areas, width, height, max_speed, max_force,
+                            neighbor_radius, predator_radius, p_area_radius, r_area_radius,
+                            separation_weight, alignment_weight,
+                            cohesion_weight, predator_avoid_weight, p_area_avoid_weight, r_area_attract_weight,
+                            neighbor_mode, synchronous, n_threads, # noise seeded from R's RNG (set.seed above)
+                            simd = simd, area_field_cell = area_field_cell,
+                            max_neighbors = max_neighbors, neighbor_limit = neighbor_limit, boundary = boundary)
+  
+  predators <- update_predators_cpp(predators, boids, width, height, max_speed, pred_rel_speed, n_threads,
+                                    neighbor_mode = neighbor_mode, boundary = boundary)
+  
+  animation_add_frame(anim, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius)
+}
+animation_close(anim)
+
+
+# Batch run: all steps in C++, snapshots only every `stride` steps
+sim <- run_simulation_cpp(n_steps = 3000, boids, predators, p_areas, r_areas, width, height, max_speed, max_force,
+                          neighbor_radius, predator_radius, p_area_radius, r_area_radius,
+                          separation_weight, alignment_weight,
+                          cohesion_weight, predator_avoid_weight, p_area_avoid_weight, r_area_attract_weight,
+                          pred_rel_speed, stride = 100, neighbor_mode = neighbor_mode, synchronous = synchronous,
+                          n_threads = n_threads, seed = 42, simd = simd,
+                          precision = precision, area_field_cell = area_field_cell, # explicit seed: same run every time
+                          max_neighbors = max_neighbors, neighbor_limit = neighbor_limit, verlet_skin = verlet_skin,
+                          backend = backend, boundary = boundary)
+str(sim$boids) # long format: step, id, x, y, vx, vy
+boids <- sim$final_boids # to resume from the last state
+predators <- sim$final_predators
+
+
+# Persistent native world: state stays in C++, step it and fetch positions when needed
+source("boids.world.r")
+world <- new_boid_world(boids, predators, p_areas, r_areas, p_area_radius, r_area_radius,
+                        params = list(width = width, height = height, max_speed = max_speed,
+                                      neighbor_radius = neighbor_radius, predator_radius = predator_radius,
+                                      separation_weight = separation_weight, alignment_weight = alignment_weight,
+                                      cohesion_weight = cohesion_weight, predator_avoid_weight = predator_avoid_weight,
+                                      p_area_avoid_weight = p_area_avoid_weight,
+                                      r_area_attract_weight = r_area_attract_weight, pred_rel_speed = pred_rel_speed,
+                                      neighbor_mode = neighbor_mode, synchronous = synchronous,
+                                      n_threads = n_threads, simd = simd, precision = precision,
+                                      area_field_cell = area_field_cell,
+                                      max_neighbors = max_neighbors, neighbor_limit = neighbor_limit,
+                                      verlet_skin = verlet_skin, backend = backend, boundary = boundary,
+                                      reorder = "hilbert", reorder_every = 10)) # boids sorted in memory along a Hilbert curve
+world$step(500)
+world$set_params(cohesion_weight = 0.3) # change parameters on the fly
+world$step(500)
+pos <- world$get_positions()
+
+
+# Survey: counts per site accumulated in C++ (steps x sites matrix) rather than full trajectories
+sites <- data.frame(type = c("quadrat", "point", "transect"),
+                    x = c(100, 500, 0), y = c(100, 500, 800),
+                    x2 = c(300, NA, width), y2 = c(300, NA, 800), # quadrat corner / transect end
+                    radius = c(NA, 100, 25),                      # point radius / transect half-width
+                    sigma = c(0, 50, 10))                         # half-normal detection scale (0: perfect)
+world$set_survey(sites, stride = 10)
+world$step(1000)
+survey <- world$get_survey()
+head(survey$counts)
+
+
+# Population dynamics: yearly Poisson births / deaths as in the sigmoid sandbox model, plus predator kills
+world$set_params(year_steps = 100, base_growth = 0.1, base_death = 0.05,
+                 linear_impact_growth = -0.001, linear_impact_death = 0.0005, sd_overdisp = 0.5,
+                 birth_spread = 5, kill_radius = 2) # K = 400 boids
+world$step(100 * 50) # 50 years
+pop <- world$get_population()
+plot(pop$step / 100, pop$n_boids, type = "l", xlab = "year", ylab = "boids")
+
+
+# State-space model: likelihood of a yearly survey index under the sigmoid birth-death model (particle filter)
+world$set_survey(sites, stride = 100) # one survey a year, just after the births and deaths
+world$step(100 * 30)
+index <- rowSums(world$get_survey(clear = TRUE)$counts) # yearly abundance index
+fits <- expand.grid(base_growth = seq(0.06, 0.16, by = 0.01), catchability = c(0.05, 0.1, 0.2, 0.4))
+ssm <- ssm_loglik_cpp(matrix(index), fits, n_particles = 2000, seed = 1, n_threads = parallel::detectCores())
+fits[which.max(ssm$loglik), ] # columns of index: more datasets, fitted in the same call
+
+# Flock statistics: groups of boids linked within neighbor_radius, found natively every 10 steps
+world$set_flocks(stride = 10)
+world$step(1000)
+flocks <- world$get_flocks()
+plot(flocks$summary$step, flocks$summary$largest, type = "l", xlab = "step", ylab = "largest group")
+colSums(flocks$histogram) # group size distribution (bins 1, 2-3, 4-7, ...)
+world$set_flocks(stride = 0)
+
+
+# Step profile (per-phase timers, neighbour and cell counters): only in a build with BOIDS_PROFILE,
+# e.g. Sys.setenv(PKG_CPPFLAGS = "-DBOIDS_PROFILE=1"); Rcpp::sourceCpp("1.rebound.poor.areas.cpp", rebuild = TRUE)
+if (inherits(try(world$get_profile(clear = TRUE), silent = TRUE), "list")) {
+  world$step(200)
+  prof <- world$get_profile()
+  prof$phases[order(-prof$phases$seconds), ] # where a step goes
+  prof$counters[c("tested_per_boid", "neighbours_per_boid", "boids_per_occupied_cell", "crowding")]
+}
+
+
+# Trajectory file: frames streamed to disk (float32, columnar) instead of kept in memory
+world$open_trajectory("boids.trj", stride = 10)
+world$step(1000)
+world$close_trajectory()
+frames <- trajectory_info("boids.trj") # step, n_boids, n_predators per frame
+last <- trajectory_read("boids.trj", frames = nrow(frames)) # long format: step, id, x, y, vx, vy
+
+# Native world animation: a frame every 5 steps, without leaving C++
+world$open_animation("world.gif", stride = 5, style = list(density_cell_px = 4))
+world$step(500)
+world$close_animation()
+
+
+# Checkpoints: burn in once, then fork replicates from the equilibrated state (or resume a stopped job)
+world$save("burnt_in.ckp") # agents, areas, parameters, seed, step count, population
+ckp <- checkpoint_open("burnt_in.ckp") # mapped once for all the forks
+forks <- lapply(1:4, function(r) restore_boid_world(ckp, seed = r)) # same state, new noise from here
+for (f in forks) f$step(1000)
+resumed <- restore_boid_world("burnt_in.ckp") # continues exactly as world would have
+
+# Ensemble: parameter sweep x replicates, independent worlds on a thread pool, summaries only
+sweep <- expand.grid(neighbor_radius = c(50, 100, 150), separation_weight = c(0.5, 1),
+                     predator_avoid_weight = c(1, 1.5))
+ens <- run_ensemble_cpp(n_steps = 2000, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius,
+                        params = world$get_params()[c("width", "height", "max_speed", "neighbor_radius",
+                                                      "predator_radius", "separation_weight", "alignment_weight",
+                                                      "cohesion_weight", "predator_avoid_weight",
+                                                      "p_area_avoid_weight", "r_area_attract_weight",
+                                                      "pred_rel_speed", "neighbor_mode", "synchronous", "simd",
+                                                      "max_neighbors", "neighbor_limit")],
+                        sweep = sweep, seeds = 1:20, survey = sites, survey_stride = 10,
+                        n_workers = parallel::detectCores())
+res <- cbind(sweep[ens$summary$config, ], ens$summary) # one row per run: parameters, seed, summaries
+
+
+# Landscape-scale runs: the domain split into tiles over MPI ranks (a build with -DBOIDS_USE_MPI=1, see
+# boids.mpi.h), this script started on every rank with e.g. mpirun -n 64 Rscript 1.rebound.poor.areas.cpp.r
+if (nzchar(Sys.getenv("OMPI_COMM_WORLD_SIZE")) || nzchar(Sys.getenv("PMI_SIZE"))) { # started by mpirun
+  big <- run_simulation_mpi_cpp(n_steps = 3000, boids, predators, p_areas, r_areas, p_area_radius, r_area_radius,
+                                params = world$get_params()[c("width", "height", "max_speed", "neighbor_radius",
+                                                              "predator_radius", "separation_weight",
+                                                              "alignment_weight", "cohesion_weight",
+                                                              "predator_avoid_weight", "p_area_avoid_weight",
+                                                              "r_area_attract_weight", "pred_rel_speed",
+                                                              "neighbor_mode", "synchronous", "simd", "max_neighbors",
+                                                              "neighbor_limit")],
+                                seed = 42, survey = sites, survey_stride = 10, gather = FALSE)
+  if (!is.null(big)) head(big$survey$counts) # rank 0 only: counts summed over the tiles
+}
@@ -0,0 +1,38 @@
+// Cache-line aligned std::vector storage for the SoA simulation buffers.
+// Aligned columns start on a 64-byte boundary, so vector loads of a column
+// never straddle two cache lines at its start and columns do not share lines.
+#ifndef BOIDS_ALIGNED_H
+#define BOIDS_ALIGNED_H
+
+#include <cstddef> // For std::size_t
+#include <new>     // For aligned operator new / delete
+#include <vector>  // For std::vector
+
+template <class T, std::size_t Align = 64>
+struct AlignedAllocator {
+  typedef T value_type;
+  template <class U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+  AlignedAllocator() noexcept {}
+  template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+  }
+  void deallocate(T* p, std::size_t) noexcept {
+    ::operator delete(p, std::align_val_t(Align));
+  }
+};
+
+template <class T, class U, std::size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+template <class T, class U, std::size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
+// Column of a SoA buffer, in precision T
+template <class T>
+using AlignedBuffer = std::vector<T, AlignedAllocator<T>>;
+
+typedef AlignedBuffer<double> AlignedVector;
+
+#endif
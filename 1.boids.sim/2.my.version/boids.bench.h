@@ -0,0 +1,114 @@
+// Benchmark harness for the boid and predator step kernels.
+// A case is one workload (boid count, neighbourhood density, predators,
+// areas) run in one mode (neighbour search, SIMD, threads, precision). The
+// boids and areas are laid out at random from a fixed seed, so every run of
+// a case times the same work; each kernel is stepped until `min_seconds`
+// have passed (after one untimed warm-up step) and timed as a whole.
+// The boid kernel evolves the swarm as a real run would; the predator
+// kernel is stepped against the swarm left by the boid kernel.
+#ifndef BOIDS_BENCH_H
+#define BOIDS_BENCH_H
+
+#include <chrono>  // For std::chrono::steady_clock
+#include <cstdint> // For std::uint64_t
+#include <vector>  // For std::vector
+#include "boids.kernels.h" // Boid and predator step kernels
+#include "boids.rng.h"     // Counter-based random numbers for the layout
+#include "boids.world.h"   // WorldState
+
+// One benchmark workload and mode
+struct BenchCase {
+  int n_boids = 5000;
+  int n_predators = 10;
+  int n_areas = 10;          // Number of p_areas, and of r_areas
+  double density = 0.1;      // neighbor_radius / width (width = height = 1000)
+  bool use_grid = true;      // Neighbour search on the cell list
+  SimdLevel simd = SimdLevel::off;
+  int n_threads = 1;         // Threads (synchronous mode)
+  bool single = false;       // Float state
+  double verlet_skin = 0;    // Skin of the Verlet lists (0: grid search every step)
+};
+
+// Timings of one case: steps run and seconds taken by each kernel
+struct BenchResult {
+  int boid_steps = 0, predator_steps = 0;
+  double boid_seconds = 0, predator_seconds = 0;
+};
+
+// Time f() repeatedly until min_seconds have passed; returns the steps run
+template <class F>
+int bench_loop(double min_seconds, double& seconds, F f) {
+  f(); // Warm-up: grid and workspace allocated, caches filled
+  auto start = std::chrono::steady_clock::now();
+  int steps = 0;
+  do {
+    f();
+    steps++;
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  } while (seconds < min_seconds);
+  return steps;
+}
+
+template <class T>
+BenchResult bench_case(const BenchCase& c, double min_seconds) {
+  const double width = 1000, height = 1000;
+  BoidParams par{};
+  par.width = width;
+  par.height = height;
+  par.max_speed = 20;
+  par.neighbor_radius = c.density * width;
+  par.predator_radius = width / 20;
+  par.separation_weight = 1;
+  par.alignment_weight = 0.1;
+  par.cohesion_weight = 0.1;
+  par.predator_avoid_weight = 1.5;
+  par.p_area_avoid_weight = 1;
+  par.r_area_attract_weight = 5;
+  par.pred_rel_speed = 1.5;
+  par.use_grid = c.use_grid;
+  par.synchronous = true;
+  par.n_threads = c.n_threads;
+  par.simd = c.simd;
+  par.verlet_skin = c.verlet_skin;
+
+  // --- 1. Random Layout (fixed seed) ---
+  WorldState<T> state;
+  std::uint64_t layout_seed = 0xBE7C4ULL, draw = 0;
+  auto column = [&](int n, double lo, double hi) {
+    std::vector<double> v(n);
+    for (int i = 0; i < n; i++) {
+      double u0, u1;
+      uniform_pair(layout_seed, draw, i, u0, u1);
+      v[i] = lo + (hi - lo) * u0;
+    }
+    draw++;
+    return v;
+  };
+  std::vector<double> bx = column(c.n_boids, 0, width), by = column(c.n_boids, 0, height);
+  std::vector<double> bvx = column(c.n_boids, -1, 1), bvy = column(c.n_boids, -1, 1);
+  std::vector<double> px = column(c.n_predators, 0, width), py = column(c.n_predators, 0, height);
+  std::vector<double> pvx = column(c.n_predators, -0.5, 0.5), pvy = column(c.n_predators, -0.5, 0.5);
+  state.boids.assign(bx.data(), by.data(), bvx.data(), bvy.data(), c.n_boids);
+  state.predators.assign(px.data(), py.data(), pvx.data(), pvy.data(), c.n_predators);
+  for (AreaState<T>* areas : {&state.p_areas, &state.r_areas}) {
+    std::vector<double> ax = column(c.n_areas, 0, width), ay = column(c.n_areas, 0, height);
+    std::vector<double> ar = column(c.n_areas, width / 100, width / 10);
+    areas->assign(ax.data(), ay.data(), ar.data(), c.n_areas);
+    areas->set_domain(width, height);
+  }
+
+  // --- 2. Boid Kernel, then Predator Kernel ---
+  BenchResult r;
+  std::uint64_t step = 0;
+  r.boid_steps = bench_loop(min_seconds, r.boid_seconds, [&] {
+    step_boids(state.boids.view(), state.predators.view(), state.p_areas.view(), state.r_areas.view(),
+               par, state.ws, 42, ++step);
+  });
+  r.predator_steps = bench_loop(min_seconds, r.predator_seconds, [&] {
+    step_predators(state.predators.view(), state.boids.view(), par,
+                   par.use_grid ? &state.ws.grid : nullptr, state.ws.grid_slack);
+  });
+  return r;
+}
+
+#endif
@@ -0,0 +1,65 @@
+# Benchmark suite for the boid and predator kernels (benchmark_cpp in 1.rebound.poor.areas.cpp).
+# Times every mode over a grid of workloads and reports steps/sec and ns per boid-step;
+# with a saved baseline, cases that got slower are listed (to catch regressions).
+# Requires Rcpp::sourceCpp("1.rebound.poor.areas.cpp") first.
+
+run_boid_benchmarks <- function(n_boids = c(500, 5000, 50000, 500000),
+                                density = c(0.01, 0.05, 0.1), # neighbor_radius / width
+                                n_predators = c(10, 100), n_areas = c(10, 1000),
+                                simd = c("off", "auto"), n_threads = unique(c(1, parallel::detectCores())),
+                                precision = c("double", "float"),
+                                verlet_skin = 0, # > 0: also time Verlet lists (grid cases only)
+                                max_all_pairs = 5000, # "all" (O(N^2)) only up to this many boids
+                                min_time = 0.5, baseline = NULL, tolerance = 0.2) {
+  cases <- expand.grid(n_boids = n_boids, density = density, n_predators = n_predators, n_areas = n_areas,
+                       neighbor_mode = c("all", "grid"), simd = simd, n_threads = n_threads,
+                       precision = precision, verlet_skin = verlet_skin, stringsAsFactors = FALSE)
+  cases <- cases[cases$neighbor_mode == "grid" | cases$n_boids <= max_all_pairs, ]
+  cases <- cases[cases$neighbor_mode == "grid" | cases$verlet_skin == 0, ]
+  res <- benchmark_cpp(cases, min_time = min_time)
+  if (!is.null(baseline)) { # previous results (data.frame or csv file): flag slowdowns beyond tolerance
+    if (is.character(baseline)) baseline <- read.csv(baseline, stringsAsFactors = FALSE)
+    if (is.null(baseline$verlet_skin)) baseline$verlet_skin <- 0 # baselines from before the lists
+    keys <- c("n_boids", "density", "n_predators", "n_areas", "neighbor_mode", "simd",
+              "n_threads", "precision", "verlet_skin", "kernel")
+    both <- merge(res, baseline[, c(keys, "ns_per_boid_step")], by = keys, suffixes = c("", ".baseline"))
+    both$ratio <- both$ns_per_boid_step / both$ns_per_boid_step.baseline
+    slower <- both[both$ratio > 1 + tolerance, ]
+    if (nrow(slower) > 0) {
+      message(nrow(slower), " case(s) slower than the baseline by more than ", 100 * tolerance, "%:")
+      print(slower[order(-slower$ratio), c(keys, "ns_per_boid_step", "ns_per_boid_step.baseline", "ratio")])
+    }
+    attr(res, "comparison") <- both
+  }
+  res
+}
+
+# Best mode per workload (fastest boid kernel), to pick the settings of a run
+best_boid_modes <- function(res) {
+  b <- res[res$kernel == "boids", ]
+  b <- b[order(b$ns_per_boid_step), ]
+  b[!duplicated(b[, c("n_boids", "density", "n_predators", "n_areas")]),
+    c("n_boids", "density", "n_predators", "n_areas", "neighbor_mode", "simd", "n_threads", "precision",
+      "verlet_skin", "steps_per_sec", "ns_per_boid_step")]
+}
+
+# R-side cost of one update_boids_cpp call (DataFrame conversions included), for comparison
+time_update_boids_call <- function(n_boids = 5000, density = 0.1, n_calls = 20, neighbor_mode = "grid") {
+  width <- 1000
+  boids <- data.frame(x = runif(n_boids, 0, width), y = runif(n_boids, 0, width),
+                      vx = runif(n_boids, -1, 1), vy = runif(n_boids, -1, 1))
+  predators <- boids[1:10, ]
+  areas <- data.frame(x = runif(10, 0, width), y = runif(10, 0, width))
+  t <- system.time(for (i in 1:n_calls) {
+    boids <- update_boids_cpp(boids, predators, areas, areas, width, width, 20, 0.05,
+                              density * width, width / 20, rep(50, 10), rep(20, 10),
+                              1, 0.1, 0.1, 1.5, 1, 5, neighbor_mode, TRUE, 1)
+  })[["elapsed"]]
+  c(steps_per_sec = n_calls / t, ns_per_boid_step = t / n_calls / n_boids * 1e9)
+}
+
+# Example: quick suite, saved as the baseline of the next run
+# res <- run_boid_benchmarks(n_boids = c(500, 5000, 50000), min_time = 0.2)
+# best_boid_modes(res)
+# write.csv(res, "boids.bench.baseline.csv", row.names = FALSE)
+# res2 <- run_boid_benchmarks(n_boids = c(500, 5000, 50000), min_time = 0.2, baseline = "boids.bench.baseline.csv")
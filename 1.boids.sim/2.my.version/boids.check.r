@@ -0,0 +1,164 @@
+# Equivalence checks of the step modes (1.rebound.poor.areas.cpp): each check steps the same fixed
+# layout and seed in two modes and compares the final boids, matched by id. Modes that must agree bit
+# for bit (instruction sets, thread counts, checkpoints, MPI ranks) are compared exactly; modes that
+# sum the neighbours in another order (grid vs all pairs, Verlet lists, "off" vs the SIMD kernels)
+# within `tolerance`. Every run also gets a hash of its final boids: with a saved baseline, the runs
+# whose hash changed are listed (to catch results that moved between two builds).
+# Requires Rcpp::sourceCpp("1.rebound.poor.areas.cpp") and source("boids.world.r") first.
+
+# Fixed layout in a width x width domain (R's RNG is seeded with layout_seed)
+check_layout <- function(n_boids = 2000, width = 1000, n_predators = 5, n_areas = 4, layout_seed = 1) {
+  set.seed(layout_seed)
+  agents <- function(n, speed) data.frame(x = runif(n, 0, width), y = runif(n, 0, width),
+                                          vx = runif(n, -speed, speed), vy = runif(n, -speed, speed))
+  list(boids = agents(n_boids, 1), predators = agents(n_predators, 0.5),
+       p_areas = agents(n_areas, 0), r_areas = agents(n_areas, 0),
+       p_area_radius = round(width / runif(n_areas, 10, 30)), r_area_radius = round(width / runif(n_areas, 30, 100)),
+       params = list(width = width, height = width, max_speed = 20, neighbor_radius = width / 20,
+                     predator_radius = width / 20, separation_weight = 1, alignment_weight = 0.1,
+                     cohesion_weight = 0.1, predator_avoid_weight = 1.5, p_area_avoid_weight = 1,
+                     r_area_attract_weight = 5, pred_rel_speed = 1.5,
+                     neighbor_mode = "grid", synchronous = TRUE, simd = "scalar"))
+}
+
+# Final boids (ordered by id) of a world stepped n_steps from the layout, under the layout
+# parameters with those of `params` on top; the world is saved to `save_at` after save_steps steps
+check_run <- function(layout, params = list(), n_steps = 20, seed = 42, save_at = NULL, save_steps = 0) {
+  p <- modifyList(layout$params, params)
+  world <- new_boid_world(layout$boids, layout$predators, layout$p_areas, layout$r_areas,
+                          layout$p_area_radius, layout$r_area_radius, p, seed)
+  if (!is.null(save_at)) {
+    world$step(save_steps)
+    world$save(save_at)
+    n_steps <- n_steps - save_steps
+  }
+  world$step(n_steps)
+  b <- world$get_positions()$boids
+  b[order(b$id), ]
+}
+
+# Hash of the final boids (md5 of their ids and doubles)
+check_hash <- function(b) {
+  f <- tempfile()
+  on.exit(unlink(f))
+  writeBin(c(as.double(b$id), b$x, b$y, b$vx, b$vy), f)
+  unname(tools::md5sum(f))
+}
+
+# Largest difference between two final states (Inf if the boids differ)
+check_diff <- function(a, b) {
+  if (nrow(a) != nrow(b) || any(a$id != b$id)) return(Inf)
+  max(abs(c(a$x - b$x, a$y - b$y, a$vx - b$vx, a$vy - b$vy)), 0)
+}
+
+# Run every check; returns one row per check (check, precision, mode_a, mode_b, max_diff,
+# tolerance, pass), with the hash of every run as attribute "hashes" (run, hash). Instruction
+# sets the CPU lacks are skipped. mpi = TRUE also compares run_simulation_mpi_cpp with the
+# serial world (start the script under mpirun, e.g. with 1, 4 and 6 ranks: each rank count must
+# give the serial result, so the results do not depend on the rank count; NULL on ranks > 0,
+# which only take part in the distributed run).
+run_boid_checks <- function(n_boids = 2000, n_steps = 20, seed = 42, tolerance = 1e-6,
+                            n_threads = max(2, parallel::detectCores()), mpi = FALSE, baseline = NULL) {
+  layout <- check_layout(n_boids)
+  runs <- list()
+  run <- function(name, params = list(), ...) {
+    if (is.null(runs[[name]])) runs[[name]] <<- check_run(layout, params, n_steps, seed, ...)
+    runs[[name]]
+  }
+  rows <- list()
+  # Compare runs a and b (stepped with params_a, params_b unless already run under that name)
+  check <- function(what, precision, a, b, params_a, params_b, tol) {
+    pa <- c(params_a, list(precision = precision))
+    pb <- c(params_b, list(precision = precision))
+    ra <- try(run(paste(precision, a), pa), silent = TRUE)
+    rb <- try(run(paste(precision, b), pb), silent = TRUE)
+    if (inherits(ra, "try-error") || inherits(rb, "try-error")) return(invisible()) # e.g. no avx512 here
+    d <- check_diff(ra, rb)
+    rows[[length(rows) + 1]] <<- data.frame(check = what, precision = precision, mode_a = a, mode_b = b,
+                                            max_diff = d, tolerance = tol, pass = d <= tol,
+                                            stringsAsFactors = FALSE)
+  }
+
+  # MPI: the tiled run gives the serial world bit for bit (simd "off"); the other ranks stop here
+  if (mpi) {
+    res <- run_simulation_mpi_cpp(n_steps, layout$boids, layout$predators, layout$p_areas, layout$r_areas,
+                                  layout$p_area_radius, layout$r_area_radius,
+                                  modifyList(layout$params, list(simd = "off")), seed)
+    if (is.null(res)) return(invisible(NULL))
+    b <- res$final_boids
+    runs[["double mpi"]] <- b[order(b$id), ]
+    check("mpi", "double", "grid off", "mpi", list(simd = "off"), NULL, 0)
+  }
+
+  for (precision in c("double", "float")) {
+    # SIMD: every instruction set gives the lane-split scalar kernel bit for bit, in both step orders
+    for (simd in c("sse2", "avx2", "avx512", "neon")) {
+      check("simd", precision, "grid scalar", paste("grid", simd),
+            list(simd = "scalar"), list(simd = simd), 0)
+      check("simd", precision, "grid async scalar", paste("grid async", simd),
+            list(simd = "scalar", synchronous = FALSE), list(simd = simd, synchronous = FALSE), 0)
+    }
+    # Threads: the synchronous step does not depend on the thread count
+    for (mode in c("grid", "all")) {
+      check("threads", precision, paste(mode, "1 thread"), paste(mode, n_threads, "threads"),
+            list(neighbor_mode = mode), list(neighbor_mode = mode, n_threads = n_threads), 0)
+    }
+    # Checkpoint: saving and restoring halfway (with births, deaths, kills and reordering,
+    # whose noise follows the boid ids) continues exactly as the uninterrupted world
+    pop <- list(year_steps = 5, base_growth = 0.1, base_death = 0.05, kill_radius = 5,
+                reorder = "hilbert", reorder_every = 3)
+    ckp <- tempfile(fileext = ".ckp")
+    saved <- try(run(paste(precision, "grid population saved"), c(pop, list(precision = precision)),
+                     save_at = ckp, save_steps = n_steps %/% 2), silent = TRUE)
+    if (!inherits(saved, "try-error")) {
+      world <- restore_boid_world(ckp)
+      world$step(n_steps - n_steps %/% 2)
+      b <- world$get_positions()$boids
+      runs[[paste(precision, "grid population restored")]] <- b[order(b$id), ]
+      check("checkpoint", precision, "grid population", "grid population saved", pop, NULL, 0)
+      check("checkpoint", precision, "grid population saved", "grid population restored", NULL, NULL, 0)
+    }
+    unlink(ckp)
+  }
+
+  # Neighbour search: the same neighbours, summed in another order (double precision only,
+  # where rounding stays far below the tolerance over n_steps steps)
+  for (boundary in c("rebound", "periodic")) {
+    b <- list(boundary = boundary)
+    check("grid vs all", "double", paste("all", boundary), paste("grid", boundary),
+          c(b, neighbor_mode = "all"), b, tolerance)
+    check("verlet", "double", paste("grid", boundary), paste("grid verlet", boundary),
+          b, c(b, verlet_skin = 5), tolerance)
+    check("simd off", "double", paste("grid", boundary), paste("grid off", boundary),
+          b, c(b, simd = "off"), tolerance)
+  }
+
+  out <- do.call(rbind, rows)
+  hashes <- data.frame(run = names(runs), hash = vapply(runs, check_hash, ""), stringsAsFactors = FALSE)
+  rownames(hashes) <- NULL
+  attr(out, "hashes") <- hashes
+  failed <- out[!out$pass, ]
+  if (nrow(failed) > 0) {
+    message(nrow(failed), " check(s) failed:")
+    print(failed)
+  }
+  if (!is.null(baseline)) { # previous hashes (data.frame or csv file): list the runs whose result moved
+    if (is.character(baseline)) baseline <- read.csv(baseline, stringsAsFactors = FALSE)
+    both <- merge(hashes, baseline, by = "run", suffixes = c("", ".baseline"))
+    moved <- both[both$hash != both$hash.baseline, ]
+    if (nrow(moved) > 0) {
+      message(nrow(moved), " run(s) changed since the baseline:")
+      print(moved)
+    }
+    attr(out, "comparison") <- both
+  }
+  out
+}
+
+# Example: check the modes, and save the hashes as the baseline of the next build
+# chk <- run_boid_checks()
+# stopifnot(all(chk$pass))
+# write.csv(attr(chk, "hashes"), "boids.check.baseline.csv", row.names = FALSE)
+# chk2 <- run_boid_checks(baseline = "boids.check.baseline.csv")
+# Distributed: mpirun -n 4 Rscript -e 'Rcpp::sourceCpp("1.rebound.poor.areas.cpp"); source("boids.world.r");
+#   source("boids.check.r"); chk <- run_boid_checks(mpi = TRUE); if (!is.null(chk)) print(chk)'
@@ -0,0 +1,325 @@
+// Checkpoints of a boid world: its whole simulation state in one binary
+// file, so that a world restored from it continues exactly as the saved one
+// would have (burn in once, then fork replicates or parameter variants from
+// the equilibrated state, or resume a preempted job). Saved: the boids and
+// predators (SoA columns, in the precision of the world), the areas, the
+// parameters, the seed and the step counter (the noise streams are
+// counter-based, see boids.rng.h, so these are their whole state), and the
+// population (ids, next id, yearly log). Not saved: the outputs (survey,
+// flocks, trajectory, animation, profile) and the step workspace (grid,
+// Verlet lists, baked area field), which is rebuilt on the first step; with
+// Verlet lists a restored run therefore matches up to rounding only.
+//
+// Layout (little-endian, as written by x86-64 and AArch64; every block
+// 8-byte aligned):
+//   header, 32 bytes:  char magic[8] = "BOIDCKP", uint32 version = 1,
+//                      uint32 header_bytes = 32, uint32 real_bytes (8: double
+//                      state, 4: float), 12 bytes reserved (0)
+//   then sections:     uint32 tag, uint32 count, uint64 payload bytes, payload
+//     world (1):       uint64 seed, uint64 step_count
+//     params (2):      float64 value[count] (see for_each_checkpoint_param)
+//     boids (3), predators (4): real x[count], y[...], vx[...], vy[...]
+//     p_areas (5), r_areas (6): real x[count], y[...], radius[...]
+//     population (7):  int64 next_id, int64 kills_this_year, int64 id[count]
+//     population_log (8): int32 step[count], n_boids[...], births[...], deaths[...], kills[...]
+//     end (0):         no payload
+// Each column is padded to 8 bytes. Sections a reader does not know are
+// skipped, and parameters are appended at the end of their list, so later
+// versions can add to the format without breaking older files.
+//
+// A checkpoint is read through a memory map (see MappedFile): opening it
+// only indexes the sections, and each world restored from it copies its
+// columns straight from the mapped pages, so forking many worlds reads the
+// file once. The file is written beside its destination and renamed over
+// it once complete, so a job killed while saving keeps its last checkpoint.
+#ifndef BOIDS_CHECKPOINT_H
+#define BOIDS_CHECKPOINT_H
+
+#include <cstdint>   // For fixed-width integers
+#include <cstdio>    // For FILE, std::rename, std::remove
+#include <cstring>   // For std::memcpy
+#include <initializer_list> // For the column lists
+#include <stdexcept> // For std::runtime_error
+#include <string>    // For file names
+#include <vector>    // For std::vector
+#include "boids.mapped.h" // Memory-mapped reading
+#include "boids.world.h"  // BoidWorld
+
+const char checkpoint_magic[8] = {'B', 'O', 'I', 'D', 'C', 'K', 'P', 0};
+const std::uint32_t checkpoint_version = 1;
+const std::size_t checkpoint_header_bytes = 32;
+const std::size_t checkpoint_section_header_bytes = 16;
+
+enum CheckpointSection : std::uint32_t {
+  section_end = 0, section_world = 1, section_params = 2, section_boids = 3, section_predators = 4,
+  section_p_areas = 5, section_r_areas = 6, section_population = 7, section_population_log = 8
+};
+
+// Call f on each saved parameter of w, in file order (new ones go last).
+// Parameters are saved as float64; see checkpoint_value / checkpoint_assign.
+template <class F>
+void for_each_checkpoint_param(BoidWorld& w, F f) {
+  BoidParams& p = w.par;
+  f(p.width); f(p.height); f(p.max_speed); f(p.neighbor_radius); f(p.predator_radius);
+  f(p.separation_weight); f(p.alignment_weight); f(p.cohesion_weight);
+  f(p.predator_avoid_weight); f(p.p_area_avoid_weight); f(p.r_area_attract_weight);
+  f(p.pred_rel_speed); f(p.use_grid); f(p.synchronous); f(p.n_threads); f(p.simd);
+  f(p.area_field_cell); f(p.max_neighbors); f(p.first_neighbors); f(p.verlet_skin);
+  PopulationParams& q = w.population.par;
+  f(q.year_steps); f(q.base_growth); f(q.base_death); f(q.linear_impact_growth);
+  f(q.linear_impact_death); f(q.sd_overdisp); f(q.birth_spread); f(q.kill_radius);
+  f(w.reorder_every); f(w.reorder_hilbert);
+  f(p.periodic);
+}
+
+template <class V>
+double checkpoint_value(V v) { return (double)v; }
+inline double checkpoint_value(SimdLevel v) { return (double)(int)v; }
+
+template <class V>
+void checkpoint_assign(double value, V& v) { v = (V)value; }
+inline void checkpoint_assign(double value, bool& v) { v = value != 0; }
+// A SIMD level this CPU lacks (the checkpoint came from another machine) becomes "auto"
+inline void checkpoint_assign(double value, SimdLevel& v) {
+  SimdLevel saved = (SimdLevel)(int)value;
+  if (!simd_level_from_name(simd_level_name(saved), v)) simd_level_from_name("auto", v);
+}
+
+// Packs the sections of a checkpoint in memory, then writes them out
+class CheckpointWriter {
+public:
+  explicit CheckpointWriter(std::uint32_t real_bytes) {
+    bytes.resize(checkpoint_header_bytes, 0);
+    std::memcpy(bytes.data(), checkpoint_magic, 8);
+    std::memcpy(bytes.data() + 8, &checkpoint_version, 4);
+    std::uint32_t header_bytes = checkpoint_header_bytes;
+    std::memcpy(bytes.data() + 12, &header_bytes, 4);
+    std::memcpy(bytes.data() + 16, &real_bytes, 4);
+  }
+
+  // Start a section of `count` items; blocks are then appended to it
+  void begin(CheckpointSection tag, std::size_t count) {
+    section = bytes.size();
+    bytes.resize(section + checkpoint_section_header_bytes, 0);
+    std::uint32_t t = tag, c = (std::uint32_t)count;
+    std::memcpy(bytes.data() + section, &t, 4);
+    std::memcpy(bytes.data() + section + 4, &c, 4);
+  }
+
+  // Append n values, padded to 8 bytes
+  template <class V>
+  void block(const V* v, std::size_t n) {
+    std::size_t at = bytes.size(), size = n * sizeof(V);
+    bytes.resize(at + (size + 7) / 8 * 8, 0);
+    if (size) std::memcpy(bytes.data() + at, v, size);
+    std::uint64_t payload = bytes.size() - section - checkpoint_section_header_bytes;
+    std::memcpy(bytes.data() + section + 8, &payload, 8);
+  }
+
+  // Write to `path` through a temporary file renamed over it
+  void save(const std::string& path) const {
+    std::string partial = path + ".partial";
+    std::FILE* file = std::fopen(partial.c_str(), "wb");
+    if (!file) throw std::runtime_error("cannot open checkpoint file " + partial);
+    bool failed = std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size();
+    failed = (std::fclose(file) != 0) || failed;
+#ifdef _WIN32
+    if (!failed) std::remove(path.c_str()); // rename does not replace files there
+#endif
+    if (failed || std::rename(partial.c_str(), path.c_str()) != 0) {
+      std::remove(partial.c_str());
+      throw std::runtime_error("writing checkpoint file " + path + " failed");
+    }
+  }
+
+  std::size_t size() const { return bytes.size(); }
+
+private:
+  std::vector<char> bytes;
+  std::size_t section = 0; // Offset of the open section
+};
+
+// Save the state of w to `path` (see above); returns the size of the file
+inline std::size_t save_checkpoint(BoidWorld& w, const std::string& path) {
+  CheckpointWriter out(w.single_precision() ? 4 : 8);
+  out.begin(section_world, 1);
+  std::uint64_t world[2] = {w.seed, w.step_count};
+  out.block(world, 2);
+  std::vector<double> values;
+  for_each_checkpoint_param(w, [&](auto& v) { values.push_back(checkpoint_value(v)); });
+  out.begin(section_params, values.size());
+  out.block(values.data(), values.size());
+  w.visit([&](auto& state) {
+    for (auto* swarm : {&state.boids, &state.predators}) {
+      out.begin(swarm == &state.boids ? section_boids : section_predators, swarm->size());
+      for (auto* col : {&swarm->x, &swarm->y, &swarm->vx, &swarm->vy}) out.block(col->data(), col->size());
+    }
+    for (auto* areas : {&state.p_areas, &state.r_areas}) {
+      out.begin(areas == &state.p_areas ? section_p_areas : section_r_areas, areas->size());
+      for (auto* col : {&areas->x, &areas->y, &areas->radius}) out.block(col->data(), col->size());
+    }
+  });
+  const Population& pop = w.population;
+  out.begin(section_population, pop.id.size());
+  std::int64_t counters[2] = {pop.next_id, pop.kills_this_year};
+  out.block(counters, 2);
+  out.block(pop.id.data(), pop.id.size());
+  const PopulationLog& log = pop.log;
+  out.begin(section_population_log, log.step.size());
+  for (const std::vector<int>* col : {&log.step, &log.n_boids, &log.births, &log.deaths, &log.kills}) {
+    out.block(col->data(), col->size());
+  }
+  out.begin(section_end, 0);
+  out.save(path);
+  return out.size();
+}
+
+// Read-only view of a checkpoint file through a memory map
+class CheckpointReader {
+public:
+  explicit CheckpointReader(const std::string& path) : path(path), file(path, "checkpoint file") {
+    const char* base = file.data();
+    std::size_t size = file.size();
+    if (size < checkpoint_header_bytes || std::memcmp(base, checkpoint_magic, 8) != 0) {
+      throw std::runtime_error(path + " is not a boid checkpoint file");
+    }
+    std::uint32_t version, header_bytes;
+    std::memcpy(&version, base + 8, 4);
+    std::memcpy(&header_bytes, base + 12, 4);
+    std::memcpy(&real_bytes, base + 16, 4);
+    if (version != checkpoint_version) throw std::runtime_error(path + ": unsupported checkpoint version");
+    if (real_bytes != 4 && real_bytes != 8) throw std::runtime_error(path + ": bad checkpoint header");
+
+    // --- Index the sections, up to the end marker ---
+    std::size_t at = header_bytes;
+    bool complete = false;
+    while (at + checkpoint_section_header_bytes <= size) {
+      std::uint32_t tag, count;
+      std::uint64_t payload;
+      std::memcpy(&tag, base + at, 4);
+      std::memcpy(&count, base + at + 4, 4);
+      std::memcpy(&payload, base + at + 8, 8);
+      at += checkpoint_section_header_bytes;
+      if (payload > size - at) break;
+      if (tag == section_end) { complete = true; break; }
+      if (tag < n_sections) sections[tag] = Section{base + at, count, (std::size_t)payload, true};
+      at += payload;
+    }
+    if (!complete) throw std::runtime_error(path + " is truncated");
+    for (std::uint32_t tag = section_world; tag <= section_r_areas; tag++) {
+      if (!sections[tag].present) throw std::runtime_error(path + " lacks part of the world state");
+    }
+  }
+
+  CheckpointReader(const CheckpointReader&) = delete;
+  CheckpointReader& operator=(const CheckpointReader&) = delete;
+
+  bool single_precision() const { return real_bytes == 4; }
+  std::uint64_t step_count() const { return world_word(1); }
+  int n_boids() const { return (int)sections[section_boids].count; }
+
+  // Replace the state of w by the saved one (converted if w has the other precision)
+  void restore(BoidWorld& w) const {
+    w.seed = world_word(0);
+    w.step_count = world_word(1);
+    const Section& params = sections[section_params];
+    std::size_t k = 0, n_values = params.count;
+    need(params, 8 * n_values);
+    for_each_checkpoint_param(w, [&](auto& v) {
+      if (k < n_values) { // Parameters missing from older files keep their value in w
+        double value;
+        std::memcpy(&value, params.data + 8 * k++, 8);
+        checkpoint_assign(value, v);
+      }
+    });
+    w.visit([&](auto& state) {
+      columns(sections[section_boids], {&state.boids.x, &state.boids.y, &state.boids.vx, &state.boids.vy});
+      columns(sections[section_predators],
+              {&state.predators.x, &state.predators.y, &state.predators.vx, &state.predators.vy});
+      for (auto* areas : {&state.p_areas, &state.r_areas}) {
+        const Section& s = sections[areas == &state.p_areas ? section_p_areas : section_r_areas];
+        decltype(areas->radius) radius;
+        columns(s, {&areas->x, &areas->y, &radius});
+        std::vector<double> r(radius.begin(), radius.end());
+        areas->set_radius(r.data()); // Squared radii and cell index, as when the world was made
+      }
+    });
+
+    Population& pop = w.population;
+    PopulationParams kept = pop.par;
+    pop = Population();
+    pop.par = kept;
+    const Section& ps = sections[section_population];
+    if (ps.present) {
+      need(ps, 16 + 8 * (std::size_t)ps.count);
+      std::memcpy(&pop.next_id, ps.data, 8);
+      std::int64_t kills;
+      std::memcpy(&kills, ps.data + 8, 8);
+      pop.kills_this_year = (int)kills;
+      pop.id.resize(ps.count);
+      if (ps.count) std::memcpy(pop.id.data(), ps.data + 16, 8 * (std::size_t)ps.count);
+      pop.alive.assign(ps.count, 1);
+    }
+    const Section& ls = sections[section_population_log];
+    if (ls.present) {
+      std::size_t padded = (4 * (std::size_t)ls.count + 7) / 8 * 8;
+      need(ls, 5 * padded);
+      int c = 0;
+      for (std::vector<int>* col : {&pop.log.step, &pop.log.n_boids, &pop.log.births, &pop.log.deaths, &pop.log.kills}) {
+        col->resize(ls.count);
+        if (ls.count) std::memcpy(col->data(), ls.data + padded * c, 4 * (std::size_t)ls.count);
+        c++;
+      }
+    }
+  }
+
+private:
+  struct Section {
+    const char* data = nullptr;
+    std::uint32_t count = 0;
+    std::size_t bytes = 0;
+    bool present = false;
+  };
+  static const std::uint32_t n_sections = section_population_log + 1;
+
+  std::string path;
+  MappedFile file;
+  std::uint32_t real_bytes = 8;
+  Section sections[n_sections];
+
+  void need(const Section& s, std::size_t bytes) const {
+    if (s.bytes < bytes) throw std::runtime_error(path + " is corrupt (section too short)");
+  }
+
+  std::uint64_t world_word(int k) const {
+    need(sections[section_world], 16);
+    std::uint64_t v;
+    std::memcpy(&v, sections[section_world].data + 8 * k, 8);
+    return v;
+  }
+
+  // Fill the columns from section s (count values each): one copy per
+  // column from the mapped pages, or a conversion to the other precision
+  template <class Buffer>
+  void columns(const Section& s, std::initializer_list<Buffer*> cols) const {
+    std::size_t n = s.count, padded = (n * real_bytes + 7) / 8 * 8;
+    need(s, padded * cols.size());
+    const char* at = s.data;
+    for (Buffer* col : cols) {
+      typedef typename Buffer::value_type T;
+      col->resize(n);
+      if (real_bytes == sizeof(T)) {
+        if (n) std::memcpy(col->data(), at, n * sizeof(T));
+      } else if (real_bytes == 8) {
+        const double* v = reinterpret_cast<const double*>(at); // 8-byte aligned in the map
+        for (std::size_t i = 0; i < n; i++) (*col)[i] = (T)v[i];
+      } else {
+        const float* v = reinterpret_cast<const float*>(at);
+        for (std::size_t i = 0; i < n; i++) (*col)[i] = (T)v[i];
+      }
+      at += padded;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,131 @@
+// Ensemble runs: many independent worlds (parameter sweeps x replicates)
+// spread over a pool of worker threads. Each worker owns a deque of task
+// indices and takes from its front; a worker that runs dry steals from the
+// back of another's deque, so uneven tasks (e.g. large neighbour radii next
+// to small ones) still keep every thread busy. Worlds share nothing, so the
+// throughput grows with the number of cores.
+#ifndef BOIDS_ENSEMBLE_H
+#define BOIDS_ENSEMBLE_H
+
+#include <cmath>     // For sqrt
+#include <deque>     // For the task deques
+#include <exception> // For std::exception_ptr
+#include <mutex>     // For the task deques
+#include <thread>    // For the workers
+#include <vector>    // For std::vector
+#include "boids.flocks.h"  // Group detection
+#include "boids.kernels.h" // SwarmView
+
+// Run f(task) for task = 0 .. n_tasks - 1 on n_workers threads (the calling
+// thread being one of them). Tasks are dealt round-robin, then stolen as
+// needed. The first exception thrown by a task stops the other workers from
+// starting new tasks and is rethrown here once all the workers are done.
+template <class F>
+void run_tasks(int n_tasks, int n_workers, F f) {
+  if (n_workers < 1) n_workers = 1;
+  if (n_workers > n_tasks) n_workers = n_tasks > 0 ? n_tasks : 1;
+  struct Queue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+  };
+  std::vector<Queue> queues(n_workers);
+  for (int t = 0; t < n_tasks; t++) queues[t % n_workers].tasks.push_back(t);
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  bool failed = false;
+
+  auto next_task = [&](int w, int& task) {
+    { // Own deque, front
+      std::lock_guard<std::mutex> lock(queues[w].mutex);
+      if (!queues[w].tasks.empty()) {
+        task = queues[w].tasks.front();
+        queues[w].tasks.pop_front();
+        return true;
+      }
+    }
+    for (int k = 1; k < n_workers; k++) { // Steal from the back of the others
+      Queue& q = queues[(w + k) % n_workers];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (!q.tasks.empty()) {
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+      }
+    }
+    return false; // Tasks are never added, so all deques are empty for good
+  };
+  auto work = [&](int w) {
+    int task;
+    while (next_task(w, task)) {
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (failed) return;
+      }
+      try {
+        f(task);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) error = std::current_exception();
+        failed = true;
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int w = 1; w < n_workers; w++) workers.emplace_back(work, w);
+  work(0);
+  for (std::thread& t : workers) t.join();
+  if (error) std::rethrow_exception(error);
+}
+
+// Summary statistics of a swarm
+struct SwarmSummary {
+  double polarisation = 0; // Length of the mean unit velocity (1: all aligned, ~0: disordered)
+  double mean_speed = 0;   // Mean speed
+  double dispersion = 0;   // Root mean squared distance to the centroid
+  int n_groups = 0;        // Groups (see FlockFinder)
+  int largest_group = 0;   // Boids in the largest group
+  double mean_crowding = 0; // Group size seen by the average boid
+};
+
+// Add the group statistics (groups linked within `radius`, across the
+// edges of a periodic domain) to s
+template <class T>
+void summarise_groups(const SwarmView<T>& b, double radius, double width, double height,
+                      SwarmSummary& s, bool periodic = false) {
+  FlockFinder f;
+  f.find(b, radius, width, height, periodic);
+  double s1 = 0, s2 = 0;
+  for (int g = 0; g < f.n_groups(); g++) { s1 += f.size[g]; s2 += (double)f.size[g] * f.size[g]; }
+  s.n_groups = f.n_groups();
+  s.largest_group = f.n_groups() ? f.size[0] : 0;
+  s.mean_crowding = s1 > 0 ? s2 / s1 : 0.0;
+}
+
+template <class T>
+SwarmSummary summarise_swarm(const SwarmView<T>& b) {
+  SwarmSummary s;
+  if (b.n == 0) return s;
+  double ux = 0, uy = 0, speed = 0, cx = 0, cy = 0;
+  for (int i = 0; i < b.n; i++) {
+    double v = sqrt((double)b.vx[i] * b.vx[i] + (double)b.vy[i] * b.vy[i]);
+    if (v > 0) { ux += b.vx[i] / v; uy += b.vy[i] / v; }
+    speed += v;
+    cx += b.x[i];
+    cy += b.y[i];
+  }
+  cx /= b.n;
+  cy /= b.n;
+  double d2 = 0;
+  for (int i = 0; i < b.n; i++) {
+    d2 += (b.x[i] - cx) * (b.x[i] - cx) + (b.y[i] - cy) * (b.y[i] - cy);
+  }
+  s.polarisation = sqrt(ux * ux + uy * uy) / b.n;
+  s.mean_speed = speed / b.n;
+  s.dispersion = sqrt(d2 / b.n);
+  return s;
+}
+
+#endif
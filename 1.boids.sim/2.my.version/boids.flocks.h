@@ -0,0 +1,184 @@
+// Flock (group) detection: boids closer than a link radius belong to the
+// same group, and groups are the connected components of that proximity
+// graph. They are found by union-find over the pairs the cell list yields
+// (the same 3x3 stencil as the neighbour search), so a pass is O(N) at a
+// fixed density. The grid, the union-find forest and the group arrays are
+// kept between passes, so sampling every step allocates nothing. On a
+// periodic domain the links and the centroids are those of the torus: a
+// flock across the seam is one group, its centroid the circular mean of
+// its positions (within [0, width) x [0, height)).
+#ifndef BOIDS_FLOCKS_H
+#define BOIDS_FLOCKS_H
+
+#include <algorithm> // For std::stable_sort
+#include <cmath>     // For atan2, cos, sin (circular means)
+#include <cstdint>   // For std::uint64_t
+#include <vector>    // For std::vector
+#include "boids.grid.h"    // CellGrid
+#include "boids.kernels.h" // SwarmView
+
+// Groups of one swarm: label of each boid, and size and centroid of each
+// group, groups ordered by decreasing size (ties: lowest boid index first)
+class FlockFinder {
+public:
+  std::vector<int> label;      // Group of each boid
+  std::vector<int> size;       // Boids in each group
+  std::vector<double> cx, cy;  // Centroid of each group
+
+  int n_groups() const { return (int)size.size(); }
+
+  template <class T>
+  void find(const SwarmView<T>& b, double radius, double width, double height, bool periodic = false) {
+    int n = b.n;
+    parent.resize(n);
+    for (int i = 0; i < n; i++) parent[i] = i;
+
+    // --- 1. Union the boids of every linked pair ---
+    grid.build(b.x, b.y, n, width, height, radius, periodic);
+    double r2 = radius * radius;
+    for (int i = 0; periodic && i < n; i++) { // Minimum images, each cell of the stencil once
+      double px = b.x[i], py = b.y[i];
+      grid.for_each_near(px, py, [&](int j) {
+        if (j <= i) return; // Each pair once
+        double dx = min_image(px - b.x[j], width), dy = min_image(py - b.y[j], height);
+        if (dx * dx + dy * dy < r2) unite(i, j);
+      });
+    }
+    for (int i = 0; !periodic && i < n; i++) {
+      double px = b.x[i], py = b.y[i];
+      grid.for_each_span_near(px, py, [&](int from, int to) {
+        for (int s = from; s < to; s++) {
+          int j = grid.items[s];
+          if (j <= i) continue; // Each pair once
+          double dx = px - b.x[j], dy = py - b.y[j];
+          if (dx * dx + dy * dy < r2) unite(i, j);
+        }
+      });
+    }
+
+    // --- 2. Number the groups by decreasing size ---
+    std::vector<int>& root_size = scratch;
+    root_size.assign(n, 0);
+    for (int i = 0; i < n; i++) {
+      parent[i] = root(i); // Flatten: every boid now points at its root
+      root_size[parent[i]]++;
+    }
+    order.clear();
+    for (int i = 0; i < n; i++) if (parent[i] == i) order.push_back(i); // Roots, by lowest member..
+    std::stable_sort(order.begin(), order.end(),                      // ..then by decreasing size
+                     [&](int a, int c) { return root_size[a] > root_size[c]; });
+    std::vector<int>& group_of_root = root_size; // Reused: sizes are copied out first
+    size.resize(order.size());
+    for (size_t g = 0; g < order.size(); g++) size[g] = root_size[order[g]];
+    for (size_t g = 0; g < order.size(); g++) group_of_root[order[g]] = (int)g;
+
+    // --- 3. Labels and centroids ---
+    label.resize(n);
+    cx.assign(size.size(), 0.0);
+    cy.assign(size.size(), 0.0);
+    if (periodic) { // Circular means: sums of the unit vectors at angle 2 pi x / width
+      const double two_pi = 6.283185307179586;
+      sx.assign(size.size(), 0.0);
+      sy.assign(size.size(), 0.0);
+      for (int i = 0; i < n; i++) {
+        int g = group_of_root[parent[i]];
+        label[i] = g;
+        cx[g] += cos(two_pi * b.x[i] / width);
+        sx[g] += sin(two_pi * b.x[i] / width);
+        cy[g] += cos(two_pi * b.y[i] / height);
+        sy[g] += sin(two_pi * b.y[i] / height);
+      }
+      for (size_t g = 0; g < size.size(); g++) {
+        cx[g] = wrap_coord(atan2(sx[g], cx[g]) / two_pi * width, width);
+        cy[g] = wrap_coord(atan2(sy[g], cy[g]) / two_pi * height, height);
+      }
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      int g = group_of_root[parent[i]];
+      label[i] = g;
+      cx[g] += b.x[i];
+      cy[g] += b.y[i];
+    }
+    for (size_t g = 0; g < size.size(); g++) { cx[g] /= size[g]; cy[g] /= size[g]; }
+  }
+
+private:
+  CellGrid grid;
+  std::vector<int> parent, scratch, order;
+  std::vector<double> sx, sy; // Sines of the circular means (periodic)
+
+  int root(int i) { // With path halving
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  void unite(int a, int c) { // The lower index becomes the root, so roots are lowest members
+    a = root(a);
+    c = root(c);
+    if (a == c) return;
+    if (a < c) parent[c] = a; else parent[a] = c;
+  }
+};
+
+// Group statistics of the sampled steps
+struct FlockRecord {
+  int n_bins = 0;                 // Histogram bins: sizes 1, 2-3, 4-7, ... (powers of two)
+  std::vector<int> step;          // Sampled steps
+  std::vector<int> n_groups, largest;
+  std::vector<double> mean_crowding; // Group size seen by the average boid: sum s^2 / sum s
+  std::vector<int> histogram;     // Row-major: histogram[r * n_bins + k], groups in bin k at step[r]
+  std::vector<int> group_step, group_size; // Groups of at least min_size boids, one entry each
+  std::vector<double> group_x, group_y;    // Their centroids
+  int min_size = 2;
+
+  void clear() {
+    n_bins = 0;
+    step.clear(); n_groups.clear(); largest.clear(); mean_crowding.clear();
+    histogram.clear();
+    group_step.clear(); group_size.clear(); group_x.clear(); group_y.clear();
+  }
+
+  static int bin_of(int s) {
+    int k = 0;
+    while ((2 << k) <= s) k++;
+    return k; // floor(log2(s))
+  }
+
+  void record(const FlockFinder& f, std::uint64_t t) {
+    step.push_back((int)t);
+    n_groups.push_back(f.n_groups());
+    largest.push_back(f.n_groups() ? f.size[0] : 0);
+    double s1 = 0, s2 = 0;
+    int bins_needed = f.n_groups() ? bin_of(f.size[0]) + 1 : 0;
+    if (bins_needed > n_bins) { // Widen the earlier rows
+      std::vector<int> wider(step.size() * bins_needed, 0);
+      for (size_t r = 0; r + 1 < step.size(); r++) {
+        for (int k = 0; k < n_bins; k++) wider[r * bins_needed + k] = histogram[r * n_bins + k];
+      }
+      histogram.swap(wider);
+      n_bins = bins_needed;
+    } else {
+      histogram.resize(step.size() * n_bins, 0);
+    }
+    int* row = histogram.data() + (step.size() - 1) * n_bins;
+    for (int g = 0; g < f.n_groups(); g++) {
+      int s = f.size[g];
+      row[bin_of(s)]++;
+      s1 += s;
+      s2 += (double)s * s;
+      if (s >= min_size) {
+        group_step.push_back((int)t);
+        group_size.push_back(s);
+        group_x.push_back(f.cx[g]);
+        group_y.push_back(f.cy[g]);
+      }
+    }
+    mean_crowding.push_back(s1 > 0 ? s2 / s1 : 0.0);
+  }
+};
+
+#endif
@@ -0,0 +1,374 @@
+// GPU backend of the boid world: the boids, predators and areas live in
+// device memory and the whole step runs there as OpenMP target regions:
+// the cell list, the separation / alignment / cohesion sums, the predator
+// and area forces, the steering, the wall rebound and the predator step.
+// The host copy is only refreshed when the host reads the state (snapshots,
+// survey counts, trajectory frames, ...; see BoidWorld), so a run with no
+// output never copies the swarm back.
+//
+// It is compiled in only when BOIDS_USE_GPU is defined to a non-zero value,
+// with a compiler that offloads OpenMP target regions, e.g. with GCC
+//   Sys.setenv(PKG_CPPFLAGS = "-DBOIDS_USE_GPU=1",
+//              PKG_CXXFLAGS = "-fopenmp -foffload=nvptx-none",
+//              PKG_LIBS = "-fopenmp -foffload=nvptx-none")
+//   Rcpp::sourceCpp("1.rebound.poor.areas.cpp", rebuild = TRUE)
+// (clang: -fopenmp -fopenmp-targets=nvptx64 or amdgcn-amd-amdhsa). Without
+// a device the target regions run on the host, which is only useful to
+// check the results.
+//
+// The device step is always synchronous (every boid reads the start-of-step
+// state), as in the threaded CPU kernel. The cell list is rebuilt every
+// step: boids are counted per cell (atomics), a blocked prefix sum gives the
+// cell starts and an atomic scatter fills the cells, which are then sorted
+// by boid index, so neither the lists nor the order of the sums depend on
+// the scheduling. The start-of-step state is gathered in cell order, so the
+// 3 cells of a row of the stencil are read as one contiguous range. On the
+// host fallback the double-precision result is the same as the CPU kernel
+// in the same neighbour mode (devices may fuse multiply-adds, so a real one
+// differs by rounding).
+#ifndef BOIDS_GPU_H
+#define BOIDS_GPU_H
+
+#ifndef BOIDS_USE_GPU
+#define BOIDS_USE_GPU 0
+#endif
+
+#if BOIDS_USE_GPU
+
+#ifndef _OPENMP
+#error "BOIDS_USE_GPU needs OpenMP with offloading (e.g. -fopenmp -foffload=nvptx-none)"
+#endif
+
+#include <algorithm> // For std::max, std::min
+#include <cmath>     // For floor, ceil, INFINITY
+#include <cstddef>   // For std::size_t
+#include <cstdint>   // For std::uint64_t, std::int64_t
+#include <new>       // For std::bad_alloc
+#include <stdexcept> // For std::runtime_error
+#include <vector>    // For std::vector
+#include <omp.h>     // For omp_target_alloc, omp_target_memcpy
+#include "boids.kernels.h" // Steering, area_forces, rebound_walls, chase_boid
+#include "boids.rng.h"     // Perturbation draws
+
+// Array in the memory of the default device (contents undefined after a resize)
+template <class T>
+class DeviceBuffer {
+public:
+  DeviceBuffer() = default;
+  DeviceBuffer(const DeviceBuffer&) = delete;
+  DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+  ~DeviceBuffer() { release(); }
+
+  T* data() const { return ptr; }
+  std::size_t size() const { return n; }
+
+  void resize(std::size_t count) {
+    if (count == n) return;
+    release();
+    if (count == 0) return;
+    ptr = static_cast<T*>(omp_target_alloc(count * sizeof(T), omp_get_default_device()));
+    if (!ptr) throw std::bad_alloc();
+    n = count;
+  }
+
+  // Copy `count` values from the host (resizing to count), or back to it
+  void upload(const T* host, std::size_t count) {
+    resize(count);
+    copy(ptr, host, omp_get_default_device(), omp_get_initial_device());
+  }
+  void download(T* host) const {
+    copy(host, ptr, omp_get_initial_device(), omp_get_default_device());
+  }
+
+private:
+  T* ptr = nullptr;
+  std::size_t n = 0;
+
+  void copy(T* to, const T* from, int to_device, int from_device) const {
+    if (n > 0 && omp_target_memcpy(to, from, n * sizeof(T), 0, 0, to_device, from_device) != 0) {
+      throw std::runtime_error("copy between host and device memory failed");
+    }
+  }
+
+  void release() {
+    if (ptr) omp_target_free(ptr, omp_get_default_device());
+    ptr = nullptr;
+    n = 0;
+  }
+};
+
+// Cell coordinate along one axis, clamped to the border cells (as CellGrid::cell_coord)
+inline int device_cell_coord(double v, double cell_size, int n_cells) {
+  int c = (int)floor(v / cell_size);
+  return std::max(0, std::min(n_cells - 1, c));
+}
+
+// Agents and areas of a world in device memory, with the cell list and
+// start-of-step copy of the device step
+template <class T>
+class DeviceWorld {
+public:
+  bool current = false; // The device holds the latest state (else it is uploaded before the next step)
+  bool ahead = false;   // The device has stepped since the host copy was last refreshed
+
+  DeviceWorld() = default;
+  // A copy holds nothing on the device: it uploads its own host state first
+  DeviceWorld(const DeviceWorld&) {}
+  DeviceWorld& operator=(const DeviceWorld&) { current = ahead = false; return *this; }
+
+  // Copy the state of the host (the device copy becomes current); with the
+  // ids of the boids, boid i draws its perturbation from stream ids[i] - 1
+  // (see StepTile), else from stream i
+  void upload(const SwarmView<T>& b, const SwarmView<T>& p,
+              const AreaView<T>& pa, const AreaView<T>& ra, const std::int64_t* ids = nullptr) {
+    n = b.n;
+    n_pred = p.n;
+    x.upload(b.x, n); y.upload(b.y, n); vx.upload(b.vx, n); vy.upload(b.vy, n);
+    qx.upload(p.x, n_pred); qy.upload(p.y, n_pred); qvx.upload(p.vx, n_pred); qvy.upload(p.vy, n_pred);
+    if (ids) id.upload(ids, n);
+    else id.resize(0);
+    n_pa = pa.n;
+    pa_x.upload(pa.x, n_pa); pa_y.upload(pa.y, n_pa); pa_r2.upload(pa.radius2, n_pa);
+    n_ra = ra.n;
+    ra_x.upload(ra.x, n_ra); ra_y.upload(ra.y, n_ra); ra_r2.upload(ra.radius2, n_ra);
+    sx.resize(n); sy.resize(n); svx.resize(n); svy.resize(n);
+    cell_of.resize(n);
+    items.resize(n);
+    closest.resize(n_pred);
+    closest_host.resize(n_pred);
+    current = true;
+    ahead = false;
+  }
+
+  // Copy the boids and predators back to the host (same sizes as uploaded)
+  void download(SwarmView<T> b, SwarmView<T> p) {
+    x.download(b.x); y.download(b.y); vx.download(b.vx); vy.download(b.vy);
+    qx.download(p.x); qy.download(p.y); qvx.download(p.vx); qvy.download(p.vy);
+    ahead = false;
+  }
+
+  // The host copy was changed: upload it before the next step
+  void invalidate() { current = ahead = false; }
+
+  // One step: boid step then predator step, as WorldState::step
+  void step(const BoidParams& par, std::uint64_t seed, std::uint64_t step) {
+    build_cells(par);
+    step_boids(par, seed, step);
+    step_predators(par);
+    ahead = true;
+  }
+
+private:
+  int n = 0, n_pred = 0, n_pa = 0, n_ra = 0;
+  DeviceBuffer<T> x, y, vx, vy;     // Boids
+  DeviceBuffer<T> qx, qy, qvx, qvy; // Predators
+  DeviceBuffer<std::int64_t> id;    // Ids of the boids (empty: the noise stream is the index)
+  DeviceBuffer<T> pa_x, pa_y, pa_r2, ra_x, ra_y, ra_r2; // Areas (centres and squared radii)
+  DeviceBuffer<T> sx, sy, svx, svy; // Start-of-step boids in cell order
+  double cell_size = 1;             // Geometry of the cell list
+  int nx = 1, ny = 1;
+  DeviceBuffer<int> cell_start, cell_fill, block_sum; // Cell starts, scatter cursors, prefix sums of the blocks
+  DeviceBuffer<int> cell_of, items; // Cell of each boid; boids by cell (ascending within a cell)
+  DeviceBuffer<int> closest;        // Nearest boid of each predator
+  std::vector<int> closest_host;
+
+  // --- Cell List and Cell-Ordered Copy ---
+  // On the grid the cells are as in the synchronous CPU step; "all" mode is
+  // a single cell, which holds every boid in index order
+  void build_cells(const BoidParams& par) {
+    if (par.use_grid) {
+      cell_size = grid_cell_side(par.neighbor_radius, par.width, par.height, n);
+      nx = std::max(1, (int)ceil(par.width / cell_size));
+      ny = std::max(1, (int)ceil(par.height / cell_size));
+    } else {
+      cell_size = 1;
+      nx = ny = 1;
+    }
+    int n_boids = n, n_cells = nx * ny, cx_cells = nx, cy_cells = ny;
+    double cs = cell_size;
+    cell_start.resize(n_cells + 1);
+    cell_fill.resize(n_cells);
+    const T* bx = x.data(); const T* by = y.data();
+    const T* bvx = vx.data(); const T* bvy = vy.data();
+    int* start = cell_start.data(); int* fill = cell_fill.data();
+    int* of = cell_of.data(); int* item = items.data();
+
+    if (n_cells == 1) {
+#pragma omp target is_device_ptr(start)
+      { start[0] = 0; start[1] = n_boids; }
+#pragma omp target teams distribute parallel for is_device_ptr(item)
+      for (int s = 0; s < n_boids; s++) item[s] = s;
+    } else {
+      // --- 1. Count the boids of each cell (the count of cell c goes to start[c + 1]) ---
+#pragma omp target teams distribute parallel for is_device_ptr(start)
+      for (int c = 0; c <= n_cells; c++) start[c] = 0;
+#pragma omp target teams distribute parallel for is_device_ptr(bx, by, of, start)
+      for (int i = 0; i < n_boids; i++) {
+        int c = device_cell_coord(by[i], cs, cy_cells) * cx_cells + device_cell_coord(bx[i], cs, cx_cells);
+        of[i] = c;
+#pragma omp atomic update
+        start[c + 1]++;
+      }
+
+      // --- 2. Prefix sum: within blocks of cells in parallel, then over the block totals ---
+      const int block = 1024;
+      int n_blocks = (n_cells + block - 1) / block;
+      block_sum.resize(n_blocks + 1);
+      int* sums = block_sum.data();
+#pragma omp target teams distribute parallel for is_device_ptr(start, sums)
+      for (int k = 0; k < n_blocks; k++) {
+        int sum = 0;
+        for (int c = k * block + 1; c <= std::min(n_cells, (k + 1) * block); c++) {
+          sum += start[c];
+          start[c] = sum;
+        }
+        sums[k + 1] = sum;
+      }
+#pragma omp target is_device_ptr(sums)
+      {
+        sums[0] = 0;
+        for (int k = 0; k < n_blocks; k++) sums[k + 1] += sums[k];
+      }
+#pragma omp target teams distribute parallel for is_device_ptr(start, sums)
+      for (int c = 1; c <= n_cells; c++) start[c] += sums[(c - 1) / block]; // start[0] stays 0
+
+      // --- 3. Scatter the boids, then sort each cell by index ---
+#pragma omp target teams distribute parallel for is_device_ptr(start, fill)
+      for (int c = 0; c < n_cells; c++) fill[c] = start[c];
+#pragma omp target teams distribute parallel for is_device_ptr(of, fill, item)
+      for (int i = 0; i < n_boids; i++) {
+        int slot;
+#pragma omp atomic capture
+        slot = fill[of[i]]++;
+        item[slot] = i;
+      }
+#pragma omp target teams distribute parallel for is_device_ptr(start, item)
+      for (int c = 0; c < n_cells; c++) {
+        for (int s = start[c] + 1; s < start[c + 1]; s++) { // Insertion sort: cells hold few boids
+          int v = item[s], t = s;
+          for (; t > start[c] && item[t - 1] > v; t--) item[t] = item[t - 1];
+          item[t] = v;
+        }
+      }
+    }
+
+    // --- 4. Start-of-step state in cell order ---
+    T* cx = sx.data(); T* cy = sy.data(); T* cvx = svx.data(); T* cvy = svy.data();
+#pragma omp target teams distribute parallel for is_device_ptr(bx, by, bvx, bvy, cx, cy, cvx, cvy, item)
+    for (int s = 0; s < n_boids; s++) {
+      int j = item[s];
+      cx[s] = bx[j];   cy[s] = by[j];
+      cvx[s] = bvx[j]; cvy[s] = bvy[j];
+    }
+  }
+
+  // --- Boid Step: one device thread per boid ---
+  void step_boids(const BoidParams& par, std::uint64_t seed, std::uint64_t step) {
+    int n_boids = n, n_predators = n_pred, gnx = nx, gny = ny;
+    double cs = cell_size;
+    T width = (T)par.width, height = (T)par.height;
+    T neighbor_r2 = (T)squared_radius(par.neighbor_radius);
+    T predator_r2 = (T)squared_radius(par.predator_radius);
+    Steering<T> steering(par);
+    AreaView<T> pa{pa_x.data(), pa_y.data(), nullptr, pa_r2.data(), n_pa, nullptr}; // No index: every area
+    AreaView<T> ra{ra_x.data(), ra_y.data(), nullptr, ra_r2.data(), n_ra, nullptr};
+    T* bx = x.data(); T* by = y.data(); T* bvx = vx.data(); T* bvy = vy.data();
+    const T* cx = sx.data(); const T* cy = sy.data(); const T* cvx = svx.data(); const T* cvy = svy.data();
+    const T* px = qx.data(); const T* py = qy.data();
+    const int* start = cell_start.data(); const int* item = items.data();
+    const std::int64_t* bid = id.data();
+
+#pragma omp target teams distribute parallel for firstprivate(steering, pa, ra) \
+  is_device_ptr(bx, by, bvx, bvy, cx, cy, cvx, cvy, px, py, start, item, bid)
+    for (int i = 0; i < n_boids; i++) {
+      Vec2<T> sep, ali, coh, pred, p_area, r_area;
+      int total = 0;
+      T xi = bx[i], yi = by[i], vxi = bvx[i], vyi = bvy[i]; // Only boid i writes its slot
+
+      // --- Separation, Alignment, Cohesion: the rows of the 3x3 surrounding cells ---
+      int gx = device_cell_coord(xi, cs, gnx), gy = device_cell_coord(yi, cs, gny);
+      int gx0 = std::max(0, gx - 1), gx1 = std::min(gnx - 1, gx + 1);
+      for (int row = std::max(0, gy - 1); row <= std::min(gny - 1, gy + 1); row++) {
+        for (int s = start[row * gnx + gx0]; s < start[row * gnx + gx1 + 1]; s++) {
+          if (item[s] == i) continue; // Skip self
+          T dx = xi - cx[s];
+          T dy = yi - cy[s];
+          T d2 = dx*dx + dy*dy;
+          if (d2 < neighbor_r2) {
+            T d = std::sqrt(d2);
+            sep.x += dx / d; sep.y += dy / d;
+            ali.x += cvx[s];     ali.y += cvy[s];
+            coh.x += cx[s];      coh.y += cy[s];
+            total++;
+          }
+        }
+      }
+
+      // --- Predator Avoidance ---
+      for (int k = 0; k < n_predators; k++) {
+        T dx = xi - px[k];
+        T dy = yi - py[k];
+        T d2 = dx*dx + dy*dy;
+        if (d2 < predator_r2) {
+          T d = std::sqrt(d2);
+          pred.x += dx / d;
+          pred.y += dy / d;
+        }
+      }
+
+      // --- Areas, Steering, Perturbation, Move and Rebound (as step_boids) ---
+      area_forces(pa, ra, xi, yi, p_area, r_area);
+      steering.apply(xi, yi, vxi, vyi, sep, total, ali, total, coh, total, pred, p_area, r_area);
+      double u0, u1;
+      uniform_pair(seed, step, bid ? (std::uint64_t)(bid[i] - 1) : (std::uint64_t)i, u0, u1);
+      vxi += (T)((u0 - 0.5) * 0.1);
+      vyi += (T)((u1 - 0.5) * 0.1);
+      xi += vxi;
+      yi += vyi;
+      rebound_walls(xi, yi, vxi, vyi, width, height);
+      bx[i] = xi; by[i] = yi; bvx[i] = vxi; bvy[i] = vyi;
+    }
+  }
+
+  // --- Predator Step ---
+  // Predators are few, so the nearest boid of each is two reductions over
+  // all the boids (smallest distance, then lowest index at that distance:
+  // the same boid as step_predators), and the predators are then moved
+  void step_predators(const BoidParams& par) {
+    int n_boids = n, n_predators = n_pred;
+    const T* bx = x.data(); const T* by = y.data();
+    T* px = qx.data(); T* py = qy.data(); T* pvx = qvx.data(); T* pvy = qvy.data();
+    for (int k = 0; k < n_pred; k++) {
+      T best = INFINITY;
+#pragma omp target teams distribute parallel for reduction(min: best) map(tofrom: best) is_device_ptr(bx, by, px, py)
+      for (int j = 0; j < n_boids; j++) {
+        T dx = bx[j] - px[k];
+        T dy = by[j] - py[k];
+        best = std::min(best, dx*dx + dy*dy);
+      }
+      int index = n_boids;
+      if (best < INFINITY) {
+#pragma omp target teams distribute parallel for reduction(min: index) map(tofrom: index) is_device_ptr(bx, by, px, py)
+        for (int j = 0; j < n_boids; j++) {
+          T dx = bx[j] - px[k];
+          T dy = by[j] - py[k];
+          if (dx*dx + dy*dy == best) index = std::min(index, j);
+        }
+      }
+      closest_host[k] = index < n_boids ? index : -1;
+    }
+    closest.upload(closest_host.data(), n_pred);
+
+    int* chosen = closest.data();
+    T max_speed = (T)par.max_speed, pred_rel_speed = (T)par.pred_rel_speed;
+    T width = (T)par.width, height = (T)par.height;
+#pragma omp target teams distribute parallel for is_device_ptr(bx, by, px, py, pvx, pvy, chosen)
+    for (int k = 0; k < n_predators; k++) {
+      chase_boid(px[k], py[k], pvx[k], pvy[k], bx, by, chosen[k], max_speed, pred_rel_speed, width, height);
+    }
+  }
+};
+
+#endif // BOIDS_USE_GPU
+
+#endif
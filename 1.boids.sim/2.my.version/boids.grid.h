@@ -0,0 +1,451 @@
+// Uniform-grid spatial hash (cell list) used for the neighbour search.
+// Boids are binned into square cells of side `cell_size`, so that all boids
+// closer than `cell_size` to a given boid sit in its own cell or one of the
+// 8 cells around it (the 3x3 stencil).
+// AreaGrid is the static counterpart for the p_areas / r_areas: each area
+// is listed in every cell its disc overlaps, so the areas that can act on a
+// point are those listed in the point's cell.
+// Both grids can be periodic (a toroidal domain [0, width) x [0, height)):
+// the cells then tile the domain exactly (stretched to width / nx by
+// height / ny, at least the requested side) and the stencils, rings and
+// discs wrap around its edges. Offsets between points are then taken as
+// their minimum image (min_image).
+// However small the requested cell, a grid of n points has at most about
+// 24 n cells (see grid_cell_side): past that the cells only cost memory,
+// and a tiny radius would overflow the cell count.
+#ifndef BOIDS_GRID_H
+#define BOIDS_GRID_H
+
+#include <vector>    // For std::vector
+#include <algorithm> // For std::max, std::min
+#include <cmath>     // For floor, ceil, sqrt
+#include <cstdint>   // For std::uint64_t
+#include <utility>   // For std::pair, std::swap
+
+// Position of cell (x, y) along the Hilbert curve through a 2^order x
+// 2^order square of cells (xy2d, rotating the quadrants as it descends)
+inline std::uint64_t hilbert_key(std::uint32_t x, std::uint32_t y, int order) {
+  std::uint32_t side = 1u << order;
+  std::uint64_t d = 0;
+  for (std::uint32_t s = side >> 1; s > 0; s >>= 1) {
+    std::uint32_t rx = (x & s) ? 1 : 0, ry = (y & s) ? 1 : 0;
+    d += (std::uint64_t)s * s * ((3 * rx) ^ ry);
+    if (ry == 0) { // Rotate the quadrant
+      if (rx == 1) { x = side - 1 - x; y = side - 1 - y; }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+// Position of cell (x, y) along the Z-order (Morton) curve: interleaved bits
+inline std::uint64_t morton_key(std::uint32_t x, std::uint32_t y) {
+  auto spread = [](std::uint64_t v) {
+    v &= 0xFFFFFFFFu;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// Minimum image of the offset d along a periodic axis of the given length
+// (for points inside [0, length))
+template <class T>
+inline T min_image(T d, T length) {
+  if (d > length / 2) return d - length;
+  if (d < -length / 2) return d + length;
+  return d;
+}
+
+// Side of the cells of a grid of n points over width x height: the
+// requested `cell` (1 if not positive), widened if need be so that the grid
+// has at most ~8 n cells by area and 8 n along either side. Wider cells
+// still hold every neighbour within `cell` in the 3x3 stencil.
+inline double grid_cell_side(double cell, double width, double height, int n) {
+  double per_point = 8.0 * std::max(n, 1);
+  double coarsest = std::max(std::sqrt(width * height / per_point), std::max(width, height) / per_point);
+  return std::max(cell > 0 ? cell : 1.0, coarsest);
+}
+
+// Bring v into [0, length), as on a periodic axis
+template <class T>
+inline T wrap_coord(T v, T length) {
+  if (v >= 0 && v < length) return v;
+  v -= length * std::floor(v / length);
+  return v < length ? v : T(0); // A value just below 0 can round up to length
+}
+
+// Cells of a grid along one axis: n cells of side `side`, clamped at the
+// borders or wrapped (periodic). The stencil of cell c is c - 1 .. c + 1,
+// without the cells past a border, each cell once when wrapped. A grid over
+// part of the axis (a tile, see boids.mpi.h) holds cells first .. first +
+// n - 1 of the grid over the whole axis, so a point falls in the same cell
+// (and has the same stencil) in both.
+struct GridAxis {
+  int n = 1;
+  double side = 1.0;
+  int first = 0; // Cell of the whole axis that is cell 0 here
+  bool periodic = false;
+
+  // Cells of the requested side `cell` (at least) over [from, from + length).
+  // Counts are taken in double and capped at max_cells, so an absurd ratio
+  // cannot overflow them (points past the last cell fall in it).
+  void fit(double length, double cell, bool wrap, double from = 0) {
+    const double max_cells = 1 << 30;
+    auto count = [&](double c) { return (int)std::max(1.0, std::min(c, max_cells)); };
+    periodic = wrap;
+    first = 0;
+    if (wrap) { // Tile the axis exactly
+      n = count(floor(length / cell));
+      side = length > 0 ? length / n : 1.0;
+    } else if (from > 0) {
+      side = cell;
+      first = (int)std::min(floor(from / cell), max_cells);
+      n = count(ceil((from + length) / cell) - first);
+    } else {
+      side = cell;
+      n = count(ceil(length / cell));
+    }
+  }
+
+  // Cell of coordinate v, clamped so out-of-domain points fall in the border cells
+  int coord(double v) const {
+    int c = (int)floor(v / side) - first;
+    return std::max(0, std::min(n - 1, c));
+  }
+
+  // Lower edge of cell c (c may lie past the borders)
+  double edge(int c) const { return (c + first) * side; }
+
+  // Cell at offset o from cell c (-1 past a border)
+  int offset(int c, int o) const {
+    c += o;
+    if (periodic) return ((c % n) + n) % n;
+    return c >= 0 && c < n ? c : -1;
+  }
+
+  // Stencil of cell c: its cells, in `cells`; returns how many
+  int stencil(int c, int cells[3]) const {
+    int k = 0;
+    if (periodic && n < 3) {
+      for (int g = 0; g < n; g++) cells[k++] = g;
+    } else {
+      for (int o = -1; o <= 1; o++) if (offset(c, o) >= 0) cells[k++] = offset(c, o);
+    }
+    return k;
+  }
+
+  // Ring offsets that reach cells not seen at a smaller ring, below and
+  // above c: -below .. above (the whole axis at most once when wrapped)
+  void reach(int c, int& below, int& above) const {
+    below = periodic ? (n - 1) / 2 : c;
+    above = periodic ? n / 2 : n - 1 - c;
+  }
+};
+
+struct CellGrid {
+  double cell_size = 1.0; // Side of a (square) cell (periodic: the requested side; see ax, ay)
+  int nx = 1, ny = 1;     // Number of cells along x and y
+  GridAxis ax, ay;        // Cells along x and y
+  bool periodic = false;  // Toroidal domain (see above)
+  double width = 0, height = 0; // Domain of a periodic grid
+  std::vector<int> cell_start; // Items of cell c are items[cell_start[c] .. cell_start[c+1])
+  std::vector<int> items;      // Point indices sorted by cell (ascending index within a cell)
+  std::vector<int> cell_of;    // Cell of each point, as binned at build time
+  std::vector<int> slot_of;    // Position of each point in `items` (inverse permutation)
+
+  // Cell of (px, py)
+  int cell_of_point(double px, double py) const { return ay.coord(py) * nx + ax.coord(px); }
+
+  // Offset a - b along x or y (the minimum image on a periodic grid)
+  template <class T> T offset_x(T d) const { return periodic ? min_image(d, (T)width) : d; }
+  template <class T> T offset_y(T d) const { return periodic ? min_image(d, (T)height) : d; }
+
+  // Rebuild the grid from scratch (counting sort: O(N + cells)) over
+  // [x0, x0 + domain_width) x [y0, y0 + domain_height): the whole domain,
+  // or a tile of it (see GridAxis); periodic: over the torus
+  // [0, domain_width) x [0, domain_height)
+  template <class T>
+  void build(const T* x, const T* y, int n,
+             double domain_width, double domain_height, double cell, bool wrap = false,
+             double x0 = 0, double y0 = 0) {
+    cell_size = grid_cell_side(cell, domain_width, domain_height, n);
+    periodic = wrap;
+    width = domain_width;
+    height = domain_height;
+    ax.fit(domain_width, cell_size, wrap, x0);
+    ay.fit(domain_height, cell_size, wrap, y0);
+    nx = ax.n;
+    ny = ay.n;
+
+    // --- 1. Count points per cell ---
+    cell_start.assign((std::size_t)nx * ny + 1, 0);
+    cell_of.resize(n);
+    for (int i = 0; i < n; i++) {
+      int c = cell_of_point(x[i], y[i]);
+      cell_of[i] = c;
+      cell_start[c + 1]++;
+    }
+
+    // --- 2. Prefix sum gives the start of each cell ---
+    for (int c = 0; c < nx * ny; c++) cell_start[c + 1] += cell_start[c];
+
+    // --- 3. Scatter indices (stable, so each cell keeps ascending order) ---
+    items.resize(n);
+    slot_of.resize(n);
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int i = 0; i < n; i++) {
+      slot_of[i] = fill[cell_of[i]]++;
+      items[slot_of[i]] = i;
+    }
+  }
+
+  // Copy v into cell order (sorted[s] = v[items[s]]), so that the points of
+  // neighbouring cells are contiguous in memory
+  template <class T, class Vector>
+  void gather(const T* v, Vector& sorted) const {
+    sorted.resize(items.size());
+    for (size_t s = 0; s < items.size(); s++) sorted[s] = v[items[s]];
+  }
+
+  // Call f(from, to) for the slots of each row of the 3x3 cells around
+  // (px, py). The 3 cells of a row are consecutive, so a row is one
+  // contiguous range of slots in `items`.
+  // (Not periodic: see for_each_image_span_near.)
+  template <class F>
+  void for_each_span_near(double px, double py, F f) const {
+    int cx = ax.coord(px), cy = ay.coord(py);
+    int gx0 = std::max(0, cx - 1), gx1 = std::min(nx - 1, cx + 1);
+    for (int gy = std::max(0, cy - 1); gy <= std::min(ny - 1, cy + 1); gy++) {
+      int from = cell_start[gy * nx + gx0], to = cell_start[gy * nx + gx1 + 1];
+      if (from < to) f(from, to);
+    }
+  }
+
+  // Whether every cell of a periodic grid appears once in the 3x3 stencil
+  // of any cell with a single image (at least 3 x 3 cells)
+  bool unique_images() const { return nx >= 3 && ny >= 3; }
+
+  // Periodic counterpart of for_each_span_near (needs unique_images()):
+  // call f(from, to, sx, sy) for contiguous ranges of slots around (px,
+  // py), where the points of the range stand at their position + (sx, sy)
+  // as seen from (px, py). A row across the seam is cut in two ranges.
+  template <class F>
+  void for_each_image_span_near(double px, double py, F f) const {
+    int cx = ax.coord(px), cy = ay.coord(py);
+    for (int oy = -1; oy <= 1; oy++) {
+      int gy = ay.offset(cy, oy);
+      double sy = cy + oy < 0 ? -height : cy + oy >= ny ? height : 0.0;
+      auto run = [&](int gx0, int gx1, double sx) {
+        int from = cell_start[gy * nx + gx0], to = cell_start[gy * nx + gx1 + 1];
+        if (from < to) f(from, to, sx, sy);
+      };
+      if (cx == 0) {
+        run(nx - 1, nx - 1, -width);
+        run(0, 1, 0.0);
+      } else if (cx == nx - 1) {
+        run(nx - 2, nx - 1, 0.0);
+        run(0, 0, width);
+      } else {
+        run(cx - 1, cx + 1, 0.0);
+      }
+    }
+  }
+
+  // Call f(j) for every point j binned in the 3x3 cells around (px, py)
+  // (each cell once, also when a periodic grid has fewer than 3 cells a side)
+  template <class F>
+  void for_each_near(double px, double py, F f) const {
+    int rows[3], cols[3];
+    int n_rows = ay.stencil(ay.coord(py), rows), n_cols = ax.stencil(ax.coord(px), cols);
+    for (int r = 0; r < n_rows; r++) {
+      for (int k = 0; k < n_cols; k++) {
+        int c = rows[r] * nx + cols[k];
+        for (int s = cell_start[c]; s < cell_start[c + 1]; s++) f(items[s]);
+      }
+    }
+  }
+
+  // Visit the cells ring by ring outward from the cell of (qx, qy) (ring r:
+  // the border of the (2r+1)^2 block around it), calling scan(c) for each
+  // cell of a ring. After each ring, done(reach) says whether to stop, where
+  // `reach` is the closest a point binned outside the rings so far can be
+  // now, for points that moved by up to `slack` since the grid was built
+  // (<= 0: no bound). The walk also stops once the block covers the grid.
+  template <class Scan, class Done>
+  void for_each_ring(double qx, double qy, double slack, Scan scan, Done done) const {
+    int cx = ax.coord(qx), cy = ay.coord(qy);
+    int below_x, above_x, below_y, above_y; // Offsets of the cells to visit around (cx, cy)
+    ax.reach(cx, below_x, above_x);
+    ay.reach(cy, below_y, above_y);
+    for (int r = 0; ; r++) {
+      // --- 1. Scan the cells on ring r ---
+      for (int oy = std::max(-r, -below_y); oy <= std::min(r, above_y); oy++) {
+        int row = ay.offset(cy, oy) * nx;
+        if (oy == -r || oy == r) {
+          for (int ox = std::max(-r, -below_x); ox <= std::min(r, above_x); ox++) scan(row + ax.offset(cx, ox));
+        } else {
+          if (r <= below_x) scan(row + ax.offset(cx, -r));
+          if (r <= above_x) scan(row + ax.offset(cx, r));
+        }
+      }
+
+      // --- 2. Stop when no cell is left, or when asked to ---
+      // A point binned outside the block lies beyond one of its edges that
+      // still has cells behind it (periodic: beyond either edge of an axis
+      // with cells left, as those cells are also reached the other way)
+      double edge = INFINITY; // Distance from (qx, qy) to the nearest such edge
+      bool left_x = r < below_x || (periodic && r < above_x), right_x = r < above_x || (periodic && r < below_x);
+      bool left_y = r < below_y || (periodic && r < above_y), right_y = r < above_y || (periodic && r < below_y);
+      if (left_x) edge = std::min(edge, qx - ax.edge(cx - r));
+      if (right_x) edge = std::min(edge, ax.edge(cx + r + 1) - qx);
+      if (left_y) edge = std::min(edge, qy - ay.edge(cy - r));
+      if (right_y) edge = std::min(edge, ay.edge(cy + r + 1) - qy);
+      if (edge == INFINITY) break; // The block covers the whole grid
+      if (done(edge - slack)) break;
+    }
+  }
+
+  // Nearest point to (qx, qy) among the binned points, or -1 if there are
+  // none; its squared distance goes to best_d2. Ties go to the lowest index,
+  // as in a plain forward scan of all points. Rings of cells are searched
+  // outward from the cell of (qx, qy) and the search stops as soon as every
+  // cell left is farther than the best point found. Points may have moved by
+  // up to `slack` since the grid was built (x, y are their current
+  // positions); the bound is widened accordingly. On a periodic grid the
+  // distances are those of the minimum images.
+  template <class T>
+  int nearest(const T* x, const T* y, T qx, T qy, double slack, T& best_d2) const {
+    int best = -1;
+    best_d2 = INFINITY;
+    auto scan_cell = [&](int c) {
+      for (int s = cell_start[c]; s < cell_start[c + 1]; s++) {
+        int j = items[s];
+        T dx = offset_x(x[j] - qx);
+        T dy = offset_y(y[j] - qy);
+        T d2 = dx*dx + dy*dy;
+        if (d2 < best_d2 || (d2 == best_d2 && j < best)) {
+          best_d2 = d2;
+          best = j;
+        }
+      }
+    };
+    for_each_ring(qx, qy, slack, scan_cell, [&](double reach) {
+      // Strictly closer (with a margin for the rounding of d2), so no tie is missed
+      return best >= 0 && reach > 0 && best_d2 < reach * reach * (1 - 1e-4);
+    });
+    return best;
+  }
+
+  // Points per cell as seen by the average point: sum over the cells of
+  // (points in the cell)^2 / points
+  double crowding() const {
+    double sum_sq = 0;
+    for (int c = 0; c < nx * ny; c++) {
+      double k = cell_start[c + 1] - cell_start[c];
+      sum_sq += k * k;
+    }
+    return items.empty() ? 0.0 : sum_sq / items.size();
+  }
+
+  // Point indices along a space-filling curve through the cells (Hilbert,
+  // or Z-order if !hilbert); the points of a cell keep their binned order
+  void curve_order(bool hilbert, std::vector<int>& order) const {
+    int order_bits = 0;
+    while ((1 << order_bits) < std::max(nx, ny)) order_bits++;
+    std::vector<std::pair<std::uint64_t, int>> cells(nx * ny); // (key, cell)
+    for (int c = 0; c < nx * ny; c++) {
+      std::uint32_t gx = c % nx, gy = c / nx;
+      cells[c] = {hilbert ? hilbert_key(gx, gy, order_bits) : morton_key(gx, gy), c};
+    }
+    std::sort(cells.begin(), cells.end());
+    order.clear();
+    order.reserve(items.size());
+    for (const auto& kc : cells) {
+      order.insert(order.end(), items.begin() + cell_start[kc.second],
+                   items.begin() + cell_start[kc.second + 1]);
+    }
+  }
+};
+
+struct AreaGrid {
+  double cell_size = 1.0;      // Side of a (square) cell (periodic: the requested side; see ax, ay)
+  int nx = 1, ny = 1;          // Number of cells along x and y
+  GridAxis ax, ay;             // Cells along x and y
+  double width = 0, height = 0; // Domain the grid was built for
+  bool periodic = false;       // Toroidal domain: discs wrap around its edges
+  std::vector<int> cell_start; // Areas of cell c are items[cell_start[c] .. cell_start[c+1])
+  std::vector<int> items;      // Area indices by cell (ascending index within a cell)
+
+  // Rebuild from the area centres and radii (areas with radius <= 0 act
+  // nowhere and are left out). Cells are about the mean radius, with at
+  // most ~4 cells per area, so an area spans a few cells.
+  template <class T>
+  void build(const T* x, const T* y, const T* radius, int n,
+             double domain_width, double domain_height, bool wrap = false) {
+    width = domain_width;
+    height = domain_height;
+    periodic = wrap;
+    double sum_r = 0;
+    int n_active = 0;
+    for (int k = 0; k < n; k++) {
+      if (radius[k] > 0) { sum_r += radius[k]; n_active++; }
+    }
+    double area = std::max(width, 1.0) * std::max(height, 1.0);
+    cell_size = n_active ? std::max(sum_r / n_active, sqrt(area / (4.0 * n_active))) : area;
+    ax.fit(width, cell_size, wrap);
+    ay.fit(height, cell_size, wrap);
+    nx = ax.n;
+    ny = ay.n;
+
+    // Cells overlapped by the bounding box of each disc, widened by a hair
+    // so that rounding in the distance test cannot reach past it (periodic:
+    // wrapped around the edges, each cell once)
+    auto cells_of = [](const GridAxis& a, double lo, double hi, std::vector<int>& cells) {
+      cells.clear();
+      if (!a.periodic) {
+        for (int g = a.coord(lo); g <= a.coord(hi); g++) cells.push_back(g);
+        return;
+      }
+      int g0 = (int)floor(lo / a.side), g1 = (int)floor(hi / a.side);
+      if (g1 - g0 + 1 >= a.n) { g0 = 0; g1 = a.n - 1; }
+      for (int g = g0; g <= g1; g++) cells.push_back(a.offset(g, 0));
+    };
+    std::vector<int> cols, rows;
+    auto for_each_cell = [&](int k, auto f) {
+      double r = radius[k] * (1 + 1e-6) + 1e-9 * cell_size;
+      cells_of(ax, x[k] - r, x[k] + r, cols);
+      cells_of(ay, y[k] - r, y[k] + r, rows);
+      for (int gy : rows) {
+        for (int gx : cols) f(gy * nx + gx);
+      }
+    };
+
+    // --- 1. Count areas per cell, then prefix sum (as in CellGrid::build) ---
+    cell_start.assign((std::size_t)nx * ny + 1, 0);
+    for (int k = 0; k < n; k++) {
+      if (radius[k] > 0) for_each_cell(k, [&](int c) { cell_start[c + 1]++; });
+    }
+    for (int c = 0; c < nx * ny; c++) cell_start[c + 1] += cell_start[c];
+
+    // --- 2. Scatter area indices, in ascending order within each cell ---
+    items.resize(cell_start[nx * ny]);
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int k = 0; k < n; k++) {
+      if (radius[k] > 0) for_each_cell(k, [&](int c) { items[fill[c]++] = k; });
+    }
+  }
+
+  // Call f(k), in ascending k, for every area whose disc may contain (px, py)
+  template <class F>
+  void for_each_near(double px, double py, F f) const {
+    int c = ay.coord(py) * nx + ax.coord(px);
+    for (int s = cell_start[c]; s < cell_start[c + 1]; s++) f(items[s]);
+  }
+};
+
+#endif
@@ -0,0 +1,997 @@
+// Native boid and predator step kernels.
+// They work on raw position/velocity arrays so they can be called either on
+// the columns of an R DataFrame (one step per call from R) or on buffers
+// owned by C++ (many steps per call, see run_simulation_cpp).
+// The kernels are templated on the scalar type T of the state: double, or
+// float for runs that can trade precision for half the memory traffic and
+// twice the SIMD width (see BoidWorld). Parameters stay in double and are
+// rounded to T once per step.
+#ifndef BOIDS_KERNELS_H
+#define BOIDS_KERNELS_H
+
+#include <algorithm> // For std::push_heap, std::pop_heap, std::sort
+#include <cmath>   // For math functions like sqrt
+#include <cstdint> // For std::uint64_t
+#include <cstring> // For std::memcpy (hashing the area inputs)
+#include <utility> // For std::pair
+#include <vector>  // For std::vector
+#ifdef _OPENMP
+#include <omp.h>   // For multithreaded loops
+#endif
+#include "boids.aligned.h" // Cache-line aligned buffers
+#include "boids.grid.h" // Uniform-grid spatial hash for the neighbour search
+#include "boids.profile.h" // Phase timers and counters (compiled out by default)
+#include "boids.rng.h"  // Counter-based random numbers for the perturbation
+#include "boids.simd.h" // SIMD separation / alignment / cohesion sums
+#include "boids.verlet.h" // Verlet neighbour lists
+
+// Small 2-D vector used for the steering accumulators.
+// It lives on the stack, so accumulating a rule costs no heap allocation.
+template <class T>
+struct Vec2 {
+  T x = 0, y = 0;
+
+  friend Vec2 operator*(Vec2 v, T k) { return Vec2{v.x * k, v.y * k}; }
+};
+
+// Positions and velocities of a group of agents (boids or predators),
+// stored as one array per column (structure of arrays)
+template <class T>
+struct SwarmView {
+  T* x;  // x-coordinates
+  T* y;  // y-coordinates
+  T* vx; // x-velocities
+  T* vy; // y-velocities
+  int n; // Number of agents
+};
+
+// Squared interaction radius; a radius <= 0 gives 0, so `d2 < r2` never holds
+inline double squared_radius(double r) { return r > 0 ? r * r : 0.0; }
+
+// Centres and radii of a set of static areas (p_areas or r_areas)
+template <class T>
+struct AreaView {
+  const T* x;       // x-coordinates of the area centres
+  const T* y;       // y-coordinates of the area centres
+  const T* radius;  // Radius of influence of each area
+  const T* radius2; // Squared radius (see squared_radius), precomputed once
+  int n;            // Number of areas
+  const AreaGrid* index = nullptr; // Areas by cell (nullptr: every area is a candidate)
+
+  // Call f(k), in ascending k, for every area that may act on (px, py):
+  // those listed in the cell of (px, py), or all of them without an index.
+  // Either way the areas that do act are visited in the same order.
+  template <class F>
+  void for_each_candidate(T px, T py, F f) const {
+    if (index) {
+      index->for_each_near(px, py, f);
+    } else {
+      for (int k = 0; k < n; k++) f(k);
+    }
+  }
+};
+
+// Owner of the squared radii of an AreaView
+struct SquaredRadii {
+  std::vector<double> r2;
+
+  template <class It>
+  SquaredRadii(It from, It to) {
+    for (It it = from; it != to; ++it) r2.push_back(squared_radius(*it));
+  }
+};
+
+// Parameters shared by the boid and predator steps
+struct BoidParams {
+  double width;                 // Width of the simulation area
+  double height;                // Height of the simulation area
+  double max_speed;             // Maximum speed for boids
+  double neighbor_radius;       // Radius within which boids interact
+  double predator_radius;       // Radius within which boids avoid predators
+  double separation_weight;     // Weight for separation rule
+  double alignment_weight;      // Weight for alignment rule
+  double cohesion_weight;       // Weight for cohesion rule
+  double predator_avoid_weight; // Weight for predator avoidance
+  double p_area_avoid_weight;   // Weight for p_area avoidance
+  double r_area_attract_weight; // Weight for r_area attraction
+  double pred_rel_speed;        // Predator speed relative to boids
+  bool use_grid;                // Neighbour search on a cell list rather than all pairs
+  bool synchronous;             // Read neighbours from the start-of-step state (double buffering)
+  int n_threads;                // Threads for the per-boid / per-predator loops (1 = serial)
+  SimdLevel simd;               // SIMD neighbour sums (off: plain per-pair loop)
+  double area_field_cell;       // Node spacing of the baked area field (0: exact area loops)
+  int max_neighbors;            // Interact with at most this many neighbours within neighbor_radius (0: all)
+  bool first_neighbors;         // With max_neighbors: the first found, own cell outward (else the nearest)
+  double verlet_skin;           // Skin of the Verlet neighbour lists (0: search the grid every step)
+  bool periodic;                // Periodic (toroidal) domain instead of rebounding walls
+};
+
+// Tile of a domain-decomposed run (see boids.mpi.h): the step leaves the
+// halo boids (copies of the boids of the neighbouring tiles) where they
+// are and only reads them as neighbours; the grid spans [x0, x1) x [y0,
+// y1) (the tile and its halo) rather than the whole domain; and the noise
+// of boid i is drawn from stream id[i] - 1 rather than i (ids count from
+// 1), so it follows the boid from tile to tile. The defaults step a whole
+// world.
+struct StepTile {
+  const std::uint8_t* halo = nullptr; // halo[i] != 0: boid i is only read (null: every boid moves)
+  double x0 = 0, y0 = 0, x1 = 0, y1 = 0; // Extent of the grid (x1 <= x0: the domain)
+  const std::int64_t* id = nullptr;   // Id of each boid, its noise stream + 1 (null: stream = index)
+};
+
+// Scratch memory of the boid step, kept across steps so it is allocated once
+template <class T>
+struct StepWorkspace {
+  CellGrid grid;                      // Cell list for the neighbour search
+  AlignedBuffer<T> x, y, vx, vy;     // Start-of-step copy of the boids (synchronous mode)
+  AlignedBuffer<T> sx, sy, svx, svy; // Boids in grid cell order (SIMD kernel on the grid)
+  std::vector<std::vector<std::pair<T, int>>> picked; // Per thread: max-heap of (d2, j), the nearest so far
+  VerletList<T> verlet;               // Neighbour lists (par.verlet_skin > 0)
+  double grid_slack = 0;              // How far the boids may be, after the step, from where `grid` binned them
+  StepTile tile;                      // Distributed runs; id also in a world with ids
+};
+
+// Behaviour terms of the boid step that can be compiled out. step_boids
+// picks the combination once per call from the weights and the numbers of
+// predators and areas, and runs a copy of its per-boid loop built for it:
+// a term that cannot act (zero weight, or nothing to act on) costs neither
+// its loop nor a branch per boid. The three Boids rules share the
+// neighbour search, so they are switched off together. The boundary is
+// picked the same way, so the rebounding step pays nothing for the
+// periodic one.
+enum StepFeature : unsigned {
+  feature_flocking = 1,  // Separation, alignment, cohesion (the neighbour search)
+  feature_predators = 2, // Predator avoidance
+  feature_areas = 4,     // p_area avoidance and r_area attraction
+  feature_periodic = 8,  // Periodic domain: minimum-image offsets, positions wrapped
+  all_features = 7       // Every behaviour term (rebounding walls)
+};
+
+// Terms that can act in a step of boids facing n_predators predators and the areas pa, ra
+template <class T>
+inline unsigned step_features(const BoidParams& par, int n_predators,
+                              const AreaView<T>& pa, const AreaView<T>& ra) {
+  unsigned features = 0;
+  if (par.separation_weight != 0 || par.alignment_weight != 0 || par.cohesion_weight != 0) {
+    features |= feature_flocking;
+  }
+  if (par.predator_avoid_weight != 0 && n_predators > 0) features |= feature_predators;
+  if ((par.p_area_avoid_weight != 0 && pa.n > 0) || (par.r_area_attract_weight != 0 && ra.n > 0)) {
+    features |= feature_areas;
+  }
+  if (par.periodic) features |= feature_periodic;
+  return features;
+}
+
+// Speed limit and rule weights of the boid step, rounded to T once per
+// step, and the steering they give. Shared by step_boids and the device
+// kernel (boids.gpu.h), so both backends steer alike.
+template <class T>
+struct Steering {
+  T max_speed;
+  T separation_weight, alignment_weight, cohesion_weight, predator_avoid_weight;
+  T p_area_avoid_weight, r_area_attract_weight;
+
+  explicit Steering(const BoidParams& par)
+    : max_speed((T)par.max_speed),
+      separation_weight((T)par.separation_weight), alignment_weight((T)par.alignment_weight),
+      cohesion_weight((T)par.cohesion_weight), predator_avoid_weight((T)par.predator_avoid_weight),
+      p_area_avoid_weight((T)par.p_area_avoid_weight), r_area_attract_weight((T)par.r_area_attract_weight) {}
+
+  // --- Helper Function: Limit Vector Magnitude ---
+  // This function limits the magnitude of a 2D vector to max_speed
+  Vec2<T> limit(Vec2<T> vec) const {
+    T mag = std::sqrt(vec.x * vec.x + vec.y * vec.y); // Calculate magnitude
+    if (mag > max_speed) { // If magnitude exceeds max_speed, scale it down
+      vec.x = vec.x / mag * max_speed;
+      vec.y = vec.y / mag * max_speed;
+    }
+    return vec;
+  }
+
+  // Turn the raw sums of a boid at (x, y) into steering forces, add them to
+  // its velocity (vx, vy) with their weights and limit its speed. Only the
+  // terms in Features are evaluated (the others would add zero).
+  template <unsigned Features = all_features>
+  void apply(T x, T y, T& vx, T& vy,
+             Vec2<T> sep, int sep_total, Vec2<T> ali, int ali_total, Vec2<T> coh, int coh_total,
+             Vec2<T> pred, Vec2<T> p_area, Vec2<T> r_area) const {
+    // --- 4. Apply Weights and Update Velocity ---
+    // Normalize and apply weights to each steering vector
+
+    Vec2<T> steer; // Weighted sum of the steering forces, term by term
+
+    if (Features & feature_flocking) {
+      // --- Separation ---
+      if (sep_total > 0) {
+        sep.x /= sep_total ; // Average x-component
+        sep.y /= sep_total; // Average y-component
+        sep = limit(sep);    // Limit magnitude
+        sep.x -= vx * (1 + 1 * sep_total);    // Subtract current velocity (steering = desired - current)
+        sep.y -= vy * (1 + 1 * sep_total);
+        sep = limit(sep);    // Limit steering force
+      }
+
+      // --- Alignment ---
+      if (ali_total > 0) {
+        ali.x /= ali_total; // Average x-component
+        ali.y /= ali_total; // Average y-component
+        ali = limit(ali);    // Limit magnitude
+        ali.x -= vx;    // Subtract current velocity
+        ali.y -= vy;
+        ali = limit(ali);    // Limit steering force
+      }
+
+      // --- Cohesion ---
+      if (coh_total > 0) {
+        coh.x /= coh_total; // Average x-position
+        coh.y /= coh_total; // Average y-position
+        coh.x -= x;     // Subtract current position (steering toward average)
+        coh.y -= y;
+        coh = limit(coh);    // Limit magnitude
+        coh.x -= vx;    // Subtract current velocity
+        coh.y -= vy;
+        coh = limit(coh);    // Limit steering force
+      }
+
+      steer.x += sep.x * separation_weight;
+      steer.x += ali.x * alignment_weight;
+      steer.x += coh.x * cohesion_weight;
+      steer.y += sep.y * separation_weight;
+      steer.y += ali.y * alignment_weight;
+      steer.y += coh.y * cohesion_weight;
+    }
+
+    if (Features & feature_predators) {
+      // --- Predator Avoidance ---
+      if (pred.x * pred.x + pred.y * pred.y > 0) {
+        pred = limit(pred);  // Limit magnitude
+        pred.x -= vx;   // Subtract current velocity
+        pred.y -= vy;
+        pred = limit(pred);  // Limit steering force
+      }
+      steer.x += pred.x * predator_avoid_weight;
+      steer.y += pred.y * predator_avoid_weight;
+    }
+
+    if (Features & feature_areas) {
+      // --- p_areas Avoidance ---
+      if (p_area.x * p_area.x + p_area.y * p_area.y > 0) {
+        p_area = limit(p_area);  // Limit magnitude
+        p_area.x -= vx;   // Subtract current velocity
+        p_area.y -= vy;
+        p_area = limit(p_area);  // Limit steering force
+      }
+
+      // --- r_areas attractive ---
+      if (r_area.x * r_area.x + r_area.y * r_area.y > 0) {
+        r_area = limit(r_area);  // Limit magnitude
+        r_area.x -= vx;   // add current velocity
+        r_area.y -= vy;
+        r_area = limit(r_area * 2);  // Limit steering force
+      }
+      steer.x += p_area.x * p_area_avoid_weight;
+      steer.x += r_area.x * r_area_attract_weight * 3;
+      steer.y += p_area.y * p_area_avoid_weight;
+      steer.y += r_area.y * r_area_attract_weight * 3;
+    }
+
+    // --- Update Velocity with Weighted Steering ---
+    // Terms are added in the same order as one sum (0 + a + b ... rounds as a + b ...)
+    vx += steer.x;
+    vy += steer.y;
+
+    // --- 5. Limit Speed ---
+    // Ensure boid does not exceed max_speed
+    T speed = std::sqrt(vx*vx + vy*vy);
+    if (speed > max_speed) {
+      vx = vx / speed * max_speed;
+      vy = vy / speed * max_speed;
+    }
+  }
+};
+
+// --- Wrap Around Edges ---
+// Periodic counterpart of rebound_walls: an agent leaving [0, width) x
+// [0, height) comes back in on the other side, with its velocity unchanged
+template <class T>
+inline void wrap_edges(T& x, T& y, T width, T height) {
+  x = wrap_coord(x, width);
+  y = wrap_coord(y, height);
+}
+
+// --- Rebound Off Walls ---
+// If an agent at (x, y) is out of [0, width] x [0, height], reverse its
+// velocity across that wall and clamp its position
+template <class T>
+inline void rebound_walls(T& x, T& y, T& vx, T& vy, T width, T height) {
+  if (x < 0 || x > width) {
+    vx = -vx; // Reverse x-velocity
+    x = std::max(T(0), std::min(width, x)); // Clamp x-position
+  }
+  if (y < 0 || y > height) {
+    vy = -vy; // Reverse y-velocity
+    y = std::max(T(0), std::min(height, y)); // Clamp y-position
+  }
+}
+
+// Raw push away from the p_areas and pull toward the r_areas at (px, py):
+// the sums of the unit vectors away from (toward) the centres of the areas
+// that contain the point. They only depend on the position, as areas are
+// static. A point exactly on a centre gets nothing from that area.
+// Periodic: on the torus of the given width and height (minimum images).
+template <bool Periodic = false, class T>
+inline void area_forces(const AreaView<T>& pa, const AreaView<T>& ra, T px, T py,
+                        Vec2<T>& p_area, Vec2<T>& r_area, T width = T(0), T height = T(0)) {
+  // --- p_area Avoidance ---
+  // For each p_area, steer away if too close
+  pa.for_each_candidate(px, py, [&](int k) {
+    // Calculate distance between the point and area k
+    T dx = px - pa.x[k];
+    T dy = py - pa.y[k];
+    if (Periodic) {
+      dx = min_image(dx, width);
+      dy = min_image(dy, height);
+    }
+    T d2 = dx*dx + dy*dy;
+
+    // If within area_radius, add repulsion vector
+    if (d2 < pa.radius2[k] && d2 > 0) {
+      T d = std::sqrt(d2);
+      p_area.x += dx / d; // Add x-component of avoidance vector
+      p_area.y += dy / d; // Add y-component of avoidance vector
+    }
+  });
+
+  // --- r_area attract ---
+  // For each r_area, steer toward it if close enough
+  ra.for_each_candidate(px, py, [&](int k) {
+    T dx = ra.x[k] - px; // direction to r_area
+    T dy = ra.y[k] - py;
+    if (Periodic) {
+      dx = min_image(dx, width);
+      dy = min_image(dy, height);
+    }
+    T d2 = dx*dx + dy*dy;
+
+    // If within area , substract attraction vector
+    if (d2 < ra.radius2[k] && d2 > 0) {
+      T d = std::sqrt(d2);
+      r_area.x += dx / d; // Add x-component of attraction vector
+      r_area.y += dy / d; // Add y-component of attraction vector
+    }
+  });
+}
+
+// Key of the inputs of an area field (FNV-1a over their bits), so that a
+// cached field is rebaked as soon as an area, a radius or the domain changes
+template <class T>
+inline std::uint64_t area_field_key(const AreaView<T>& pa, const AreaView<T>& ra,
+                                    double width, double height, double cell, bool periodic = false) {
+  std::uint64_t h = 1469598103934665603ULL;
+  auto mix = [&h](const void* p, std::size_t bytes) {
+    const unsigned char* c = static_cast<const unsigned char*>(p);
+    for (std::size_t b = 0; b < bytes; b++) h = (h ^ c[b]) * 1099511628211ULL;
+  };
+  double domain[3] = {width, height, cell};
+  mix(domain, sizeof(domain));
+  if (periodic) mix(&periodic, sizeof(periodic)); // Keys of rebounding domains as before
+  for (const AreaView<T>* a : {&pa, &ra}) {
+    mix(&a->n, sizeof(a->n));
+    mix(a->x, a->n * sizeof(T));
+    mix(a->y, a->n * sizeof(T));
+    mix(a->radius, a->n * sizeof(T));
+  }
+  return h;
+}
+
+// The area forces baked on a raster of nodes spaced `cell_size` apart over
+// the domain, sampled by bilinear interpolation. This replaces the two area
+// loops by four node reads per boid; the forces are smoothed over one cell
+// at the area edges, so the result differs slightly from the exact loops.
+template <class T>
+struct AreaField {
+  double cell_size = 0;      // Spacing of the nodes
+  int nx = 0, ny = 0;        // Number of cells along x and y (nodes: (nx + 1) x (ny + 1))
+  std::uint64_t key = 0;     // Key of the inputs the field was baked from (0: none)
+  std::vector<T> p_x, p_y;   // p_area push at node (i, j), index j * (nx + 1) + i
+  std::vector<T> r_x, r_y;   // r_area pull at the nodes
+
+  // Bake the field if the inputs differ from those of the current one
+  // (periodic: the forces of a torus, see area_forces)
+  void update(const AreaView<T>& pa, const AreaView<T>& ra,
+              double width, double height, double cell, bool periodic = false) {
+    std::uint64_t k = area_field_key(pa, ra, width, height, cell, periodic);
+    if (k == key) return;
+    cell_size = cell;
+    nx = std::max(1, (int)ceil(width / cell));
+    ny = std::max(1, (int)ceil(height / cell));
+    int n_nodes = (nx + 1) * (ny + 1);
+    p_x.assign(n_nodes, T(0)); p_y.assign(n_nodes, T(0));
+    r_x.assign(n_nodes, T(0)); r_y.assign(n_nodes, T(0));
+    for (int j = 0; j <= ny; j++) {
+      for (int i = 0; i <= nx; i++) {
+        Vec2<T> p_area, r_area;
+        if (periodic) {
+          area_forces<true>(pa, ra, (T)(i * cell), (T)(j * cell), p_area, r_area, (T)width, (T)height);
+        } else {
+          area_forces(pa, ra, (T)(i * cell), (T)(j * cell), p_area, r_area);
+        }
+        int node = j * (nx + 1) + i;
+        p_x[node] = p_area.x; p_y[node] = p_area.y;
+        r_x[node] = r_area.x; r_y[node] = r_area.y;
+      }
+    }
+    key = k;
+  }
+
+  // Bilinear interpolation of the forces at (px, py), clamped to the domain
+  void sample(T px, T py, Vec2<T>& p_area, Vec2<T>& r_area) const {
+    double fx = std::max(0.0, std::min((double)nx, px / cell_size));
+    double fy = std::max(0.0, std::min((double)ny, py / cell_size));
+    int i = std::min((int)fx, nx - 1), j = std::min((int)fy, ny - 1);
+    T tx = (T)(fx - i), ty = (T)(fy - j);
+    int n00 = j * (nx + 1) + i, n10 = n00 + 1, n01 = n00 + nx + 1, n11 = n01 + 1;
+    auto lerp2 = [&](const std::vector<T>& v) {
+      T a = v[n00] + (v[n10] - v[n00]) * tx; // Along x on row j
+      T b = v[n01] + (v[n11] - v[n01]) * tx; // Along x on row j + 1
+      return a + (b - a) * ty;
+    };
+    p_area = Vec2<T>{lerp2(p_x), lerp2(p_y)};
+    r_area = Vec2<T>{lerp2(r_x), lerp2(r_y)};
+  }
+};
+
+// Advance all boids by one step, in place.
+// It applies the three Boids rules (separation, alignment, cohesion),
+// predator avoidance and area avoidance/attraction, then updates positions
+// and handles wall rebound.
+// By default boids are updated one after the other (asynchronous): boid i
+// already sees the new state of boids 0..i-1, so the result depends on the
+// iteration order. With par.synchronous every boid reads its neighbours from
+// a start-of-step copy and only writes its own slot, so boids can be updated
+// in any order (or concurrently) with the same result: the loop then runs
+// on par.n_threads threads. The perturbation of boid i is drawn from its own
+// counter-based stream (seed, step, i), so the result is identical for any
+// number of threads.
+// With par.simd the neighbour sums are computed by a SIMD kernel over
+// contiguous candidate ranges: all boids in "all" mode, or the rows of the
+// 3x3 stencil on a cell-ordered copy of the boids in "grid" mode.
+// With a `field` (baked from pa and ra) the area forces are sampled from it
+// instead of being summed over the areas.
+// With par.max_neighbors = k > 0 a boid only follows k of its neighbours
+// within neighbor_radius (topological interaction), so a dense flock costs
+// about O(N k) rather than O(N x neighbours): the k nearest (ties: lowest
+// index), kept in a bounded max-heap while rings of cells are searched
+// outward and the search stops once no cell left can hold a closer boid;
+// or with par.first_neighbors the first k found from the boid's own cell
+// outward, which stops as soon as k are found. The k nearest do not depend
+// on the neighbour search mode or the number of threads. SIMD sums are not
+// used in this mode.
+// With par.verlet_skin > 0 (on the grid) the candidates of each boid come
+// from its Verlet list, rebuilt with the grid only once the boids may have
+// moved too far (see boids.verlet.h); this stacks with the SIMD sums (on
+// the gathered candidates) and with max_neighbors.
+// With par.periodic the domain is a torus: a boid leaving it comes back in
+// on the other side, and every offset (to a neighbour, a predator, an area
+// centre) is taken as its minimum image, so a boid only sees the nearest
+// copy of each other agent (radii are meant to stay below half the domain).
+// The grid then wraps its stencils around the edges; the SIMD sums run on
+// the wrapped rows with a shifted query point.
+// With ws.tile set (see StepTile) the step advances one tile of a
+// distributed world.
+// With a `profile` (and BOIDS_PROFILE) the phases of the step are timed and
+// the candidate pairs counted.
+// This is the step built for the terms in Features (see StepFeature);
+// step_boids below picks it.
+template <unsigned Features, class T>
+inline void step_boids_with(SwarmView<T> b, const SwarmView<T>& pr,
+                            const AreaView<T>& pa, const AreaView<T>& ra,
+                            const BoidParams& par, StepWorkspace<T>& ws,
+                            std::uint64_t seed, std::uint64_t step,
+                            const AreaField<T>* field, StepProfile* profile) {
+  const bool flocking = (Features & feature_flocking) != 0;
+  const bool periodic = (Features & feature_periodic) != 0;
+  PhaseTimer setup_timer(profile ? profile->lane(0) : nullptr);
+  int n_boids = b.n;
+  T* x = b.x;  T* y = b.y;    // Boid positions
+  T* vx = b.vx; T* vy = b.vy; // Boid velocities
+  T width = (T)par.width, height = (T)par.height;
+
+  // Offset between two points (the minimum image on a torus)
+  auto offset_x = [&](T d) { return periodic ? min_image(d, width) : d; };
+  auto offset_y = [&](T d) { return periodic ? min_image(d, height) : d; };
+  if (periodic) { // Agents placed on an edge (or past it) start inside the torus
+    for (int i = 0; i < n_boids; i++) wrap_edges(x[i], y[i], width, height);
+  }
+  Steering<T> steering(par); // Speed limit and weights
+  double neighbor_radius = par.neighbor_radius;
+
+  // Radii are compared on squared distances, so sqrt is only taken for
+  // the (few) pairs that actually interact
+  T neighbor_r2 = (T)squared_radius(neighbor_radius);
+  T predator_r2 = (T)squared_radius(par.predator_radius);
+
+  // Neighbours are read through ox, oy, ovx, ovy: the live arrays in
+  // asynchronous mode, a copy of the start-of-step state in synchronous mode.
+  // Boid i itself is only written after all its reads, so x[i], vx[i], ...
+  // hold its start-of-step state until then in both modes.
+  const T* ox = x;   const T* oy = y;
+  const T* ovx = vx; const T* ovy = vy;
+  if (par.synchronous) {
+    ws.x.assign(x, x + n_boids);
+    ws.y.assign(y, y + n_boids);
+    ws.vx.assign(vx, vx + n_boids);
+    ws.vy.assign(vy, vy + n_boids);
+    ox = ws.x.data();   oy = ws.y.data();
+    ovx = ws.vx.data(); ovy = ws.vy.data();
+  }
+
+  // Only the synchronous update is free of races between boids
+  int n_threads = par.synchronous ? par.n_threads : 1;
+  (void)n_threads; // Unused when compiled without OpenMP
+
+  // Build the grid once per step from the current positions.
+  // In asynchronous mode boids are updated in place, so by the time boid i
+  // looks at boid j, j may already have moved by up to max_speed (plus the
+  // perturbation) since it was binned. Cells are then padded by that
+  // distance so no neighbour is missed.
+  CellGrid& grid = ws.grid;
+  const StepTile& tile = ws.tile;
+  bool tiled = tile.x1 > tile.x0;
+  double grid_x0 = tiled ? tile.x0 : 0.0, grid_y0 = tiled ? tile.y0 : 0.0;
+  double grid_w = tiled ? tile.x1 - tile.x0 : par.width, grid_h = tiled ? tile.y1 - tile.y0 : par.height;
+  bool limited = par.max_neighbors > 0;
+  double pad = par.synchronous ? 0.0 : par.max_speed + 0.1;
+  bool verlet = flocking && par.use_grid && par.verlet_skin > 0; // The lists only serve the neighbour search
+  bool rebuild = par.use_grid;
+  double moved = 0; // Farthest a boid is from where the grid binned it
+  if (verlet) {
+    // The lists hold every pair as long as the two boids together have
+    // moved by less than the skin since the build: up to `moved` each, plus
+    // (asynchronous mode) up to `pad` during this step for the one read later
+    double list_reach = neighbor_radius + par.verlet_skin;
+    bool same_list = ws.verlet.reach == list_reach && ws.verlet.periodic == periodic;
+    moved = same_list ? ws.verlet.max_displacement(ox, oy, n_boids, n_threads) : INFINITY;
+    rebuild = !(2 * moved + pad < par.verlet_skin);
+    if (rebuild) {
+      grid.build(ox, oy, n_boids, grid_w, grid_h, list_reach, periodic, grid_x0, grid_y0);
+      ws.verlet.build(grid, ox, oy, n_boids, list_reach, n_threads);
+      moved = 0;
+    }
+  } else if (par.use_grid) {
+    grid.build(ox, oy, n_boids, grid_w, grid_h, neighbor_radius + pad, periodic, grid_x0, grid_y0);
+    // For the k nearest, cells are split until the average boid shares its
+    // cell with about k / 2 others, so the ring search stops after the 3x3
+    // block of small cells even in a dense flock (at most ~4 cells per boid)
+    if (limited && !par.first_neighbors) {
+      int split = (int)std::sqrt(2 * grid.crowding() / par.max_neighbors);
+      split = std::min(split, (int)std::sqrt(4.0 * n_boids / (grid.nx * grid.ny)));
+      if (split > 1) {
+        grid.build(ox, oy, n_boids, grid_w, grid_h, (neighbor_radius + pad) / split, periodic, grid_x0, grid_y0);
+      }
+    }
+  }
+  ws.grid_slack = moved + par.max_speed + 0.1;
+
+  // Candidates for the SIMD kernel: the neighbour arrays themselves, or
+  // their copy in cell order on the grid. In asynchronous mode each boid
+  // writes its new state back into its slot of the copy once updated.
+  // Periodic: only on the grid, with every cell once in each stencil (the
+  // candidates of "all" mode are not shifted to their images).
+  SpanKernel<T> span_kernel = limited || !flocking ? nullptr : select_span_kernel<T>(par.simd);
+  if (periodic && !(par.use_grid && (verlet || grid.unique_images()))) span_kernel = nullptr;
+  bool sorted = span_kernel && par.use_grid && !verlet;
+  const T* cx = ox;   const T* cy = oy;
+  const T* cvx = ovx; const T* cvy = ovy;
+  if (sorted) {
+    grid.gather(ox, ws.sx);   grid.gather(oy, ws.sy);
+    grid.gather(ovx, ws.svx); grid.gather(ovy, ws.svy);
+    cx = ws.sx.data();   cy = ws.sy.data();
+    cvx = ws.svx.data(); cvy = ws.svy.data();
+  }
+  setup_timer.lap(phase_setup);
+  if (profile && rebuild) profile->record_grid(grid);
+
+  if (profile) profile->prepare(n_threads);
+  if (limited && (int)ws.picked.size() < n_threads) ws.picked.resize(n_threads);
+  if (verlet && span_kernel && (int)ws.verlet.gathered.size() < n_threads) ws.verlet.gathered.resize(n_threads);
+  const int* list_start = verlet ? ws.verlet.start.data() : nullptr;
+  const int* list_items = verlet ? ws.verlet.items.data() : nullptr;
+
+  // --- 1. Loop Over Each Boid ---
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64) if(n_threads > 1)
+#endif
+  for (int i = 0; i < n_boids; i++) {
+    if (tile.halo && tile.halo[i]) continue; // Moved by the tile that owns it
+    PhaseTimer timer(profile ? profile->lane(thread_index()) : nullptr);
+    std::uint64_t tested = 0; // Candidates whose distance is computed (profile only)
+
+    // Initialize steering vectors for each rule (zero-initialised)
+    Vec2<T> sep, ali, coh, pred, p_area, r_area; // sep=separation, ali=alignment, coh=cohesion, pred=predator avoidance, p_area = p_area_avoidance
+    int sep_total = 0, ali_total = 0, coh_total = 0; // Counters for averaging
+
+    // --- 2. Calculate Separation, Alignment, Cohesion ---
+    // Add neighbour j (at dx, dy from boid i, d2 = dx^2 + dy^2 < neighbor_r2)
+    // to the three Boids rules
+    auto accumulate = [&](int j, T dx, T dy, T d2) {
+      T d = std::sqrt(d2); // Distance between boid i and boid j
+
+      // --- Separation: Steer to avoid crowding ---
+      // The closer the boid, the stronger the repulsion
+      sep.x += dx / d; // Add x-component of separation vector
+      sep.y += dy / d; // Add y-component of separation vector
+      sep_total++;       // Increment counter for averaging
+
+      // --- Alignment: Steer toward average heading of neighbors ---
+      ali.x += ovx[j];  // Add x-velocity of neighbor
+      ali.y += ovy[j];  // Add y-velocity of neighbor
+      ali_total++;       // Increment counter for averaging
+
+      // --- Cohesion: Steer toward average position of neighbors ---
+      coh.x += periodic ? x[i] - dx : ox[j]; // Add x-position of neighbor (its image next to boid i)
+      coh.y += periodic ? y[i] - dy : oy[j]; // Add y-position of neighbor
+      coh_total++;      // Increment counter for averaging
+    };
+
+    // For each other boid, calculate the three Boids rules
+    auto interact = [&](int j) {
+      if (i == j) return; // Skip self (a boid doesn't interact with itself)
+      tested++;
+
+      // Calculate distance between boid i and boid j
+      T dx = offset_x(x[i] - ox[j]);
+      T dy = offset_y(y[i] - oy[j]);
+      T d2 = dx*dx + dy*dy;
+
+      // If within neighbor_radius, apply rules
+      if (d2 < neighbor_r2) accumulate(j, dx, dy, d2);
+    };
+
+    if (!flocking) {
+      // No neighbour search: the three rules have zero weights
+    } else if (limited) {
+      // Topological: offer each candidate within neighbor_radius; returns
+      // true once the search can stop (the first k are found)
+      int k_max = par.max_neighbors;
+      std::vector<std::pair<T, int>>& heap = ws.picked[thread_index()];
+      heap.clear();
+      auto offer = [&](int j) {
+        if (i == j) return false;
+        tested++;
+        T dx = offset_x(x[i] - ox[j]);
+        T dy = offset_y(y[i] - oy[j]);
+        T d2 = dx*dx + dy*dy;
+        if (!(d2 < neighbor_r2)) return false;
+        if (par.first_neighbors) {
+          accumulate(j, dx, dy, d2);
+          return sep_total == k_max;
+        }
+        std::pair<T, int> c{d2, j};
+        if ((int)heap.size() < k_max) {
+          heap.push_back(c);
+          std::push_heap(heap.begin(), heap.end());
+        } else if (c < heap.front()) { // Closer than the k-th nearest so far
+          std::pop_heap(heap.begin(), heap.end());
+          heap.back() = c;
+          std::push_heap(heap.begin(), heap.end());
+        }
+        return false;
+      };
+      if (verlet) {
+        for (int s = list_start[i]; s < list_start[i + 1] && !offer(list_items[s]); s++) {}
+      } else if (par.use_grid) {
+        bool full = false;
+        grid.for_each_ring(x[i], y[i], pad, [&](int c) {
+          for (int s = grid.cell_start[c]; s < grid.cell_start[c + 1] && !full; s++) full = offer(grid.items[s]);
+        }, [&](double reach) {
+          if (full || reach <= 0) return full;
+          // Stop when no boid left can be within neighbor_radius, or closer than the k-th nearest
+          double bound = (int)heap.size() == k_max ? (double)heap.front().first : (double)neighbor_r2;
+          return bound < reach * reach * (1 - 1e-4);
+        });
+      } else {
+        for (int j = 0; j < n_boids && !offer(j); j++) {} // Every other boid, until stopped
+      }
+      if (!par.first_neighbors) {
+        // Summed in index order, so the result does not depend on the search
+        std::sort(heap.begin(), heap.end(),
+                  [](const std::pair<T, int>& a, const std::pair<T, int>& b) { return a.second < b.second; });
+        for (const std::pair<T, int>& c : heap) {
+          int j = c.second;
+          accumulate(j, offset_x(x[i] - ox[j]), offset_y(y[i] - oy[j]), c.first);
+        }
+      }
+    } else if (verlet && span_kernel) {
+      // SIMD sums over the list, gathered into contiguous buffers
+      typename VerletList<T>::Gathered& g = ws.verlet.gathered[thread_index()];
+      int from = list_start[i], m = list_start[i + 1] - from;
+      g.x.resize(m); g.y.resize(m); g.vx.resize(m); g.vy.resize(m);
+      for (int s = 0; s < m; s++) {
+        int j = list_items[from + s];
+        g.x[s] = periodic ? x[i] - offset_x(x[i] - ox[j]) : ox[j]; // The image next to boid i
+        g.y[s] = periodic ? y[i] - offset_y(y[i] - oy[j]) : oy[j];
+        g.vx[s] = ovx[j]; g.vy[s] = ovy[j];
+      }
+      tested += m;
+      NeighbourSums<T> acc;
+      acc.reset();
+      span_kernel(g.x.data(), g.y.data(), g.vx.data(), g.vy.data(), m, x[i], y[i], neighbor_r2, acc);
+      sep = Vec2<T>{NeighbourSums<T>::total(acc.sep_x), NeighbourSums<T>::total(acc.sep_y)};
+      ali = Vec2<T>{NeighbourSums<T>::total(acc.ali_x), NeighbourSums<T>::total(acc.ali_y)};
+      coh = Vec2<T>{NeighbourSums<T>::total(acc.coh_x), NeighbourSums<T>::total(acc.coh_y)};
+      sep_total = ali_total = coh_total = acc.count;
+    } else if (verlet) {
+      for (int s = list_start[i]; s < list_start[i + 1]; s++) interact(list_items[s]); // The list of boid i
+    } else if (span_kernel) {
+      // Masked SIMD sums over contiguous candidates; boid i is cut out of
+      // the range that contains it
+      NeighbourSums<T> acc;
+      acc.reset();
+      int self = sorted ? grid.slot_of[i] : i;
+      // Candidates [from, to) seen from (qx, qy): boid i itself, or where it
+      // stands relative to a shifted row of a periodic grid
+      auto span_from = [&](int from, int to, T qx, T qy) {
+        tested += to - from - (self >= from && self < to);
+        if (self >= from && self < to) {
+          span_kernel(cx + from, cy + from, cvx + from, cvy + from, self - from,
+                          qx, qy, neighbor_r2, acc);
+          from = self + 1;
+        }
+        span_kernel(cx + from, cy + from, cvx + from, cvy + from, to - from,
+                        qx, qy, neighbor_r2, acc);
+      };
+      auto span = [&](int from, int to) { span_from(from, to, x[i], y[i]); };
+      Vec2<T> shift; // Periodic: sum of the image shifts of the neighbours (cohesion)
+      if (sorted && periodic) {
+        // Rows of the 3x3 surrounding cells, cut at the seams: the points of
+        // a range stand at (sx, sy) from their position, so boid i is
+        // queried at (x - sx, y - sy) and the neighbour positions are shifted back
+        grid.for_each_image_span_near(x[i], y[i], [&](int from, int to, double sx, double sy) {
+          int before = acc.count;
+          span_from(from, to, x[i] - (T)sx, y[i] - (T)sy);
+          shift.x += (T)sx * (T)(acc.count - before);
+          shift.y += (T)sy * (T)(acc.count - before);
+        });
+      } else if (sorted) {
+        grid.for_each_span_near(x[i], y[i], span); // Rows of the 3x3 surrounding cells
+      } else {
+        span(0, n_boids); // Every other boid
+      }
+      sep = Vec2<T>{NeighbourSums<T>::total(acc.sep_x), NeighbourSums<T>::total(acc.sep_y)};
+      ali = Vec2<T>{NeighbourSums<T>::total(acc.ali_x), NeighbourSums<T>::total(acc.ali_y)};
+      coh = Vec2<T>{NeighbourSums<T>::total(acc.coh_x), NeighbourSums<T>::total(acc.coh_y)};
+      if (periodic) {
+        coh.x += shift.x;
+        coh.y += shift.y;
+      }
+      sep_total = ali_total = coh_total = acc.count;
+    } else if (par.use_grid) {
+      grid.for_each_near(x[i], y[i], interact); // Only boids in the 3x3 surrounding cells
+    } else {
+      for (int j = 0; j < n_boids; j++) interact(j); // Every other boid
+    }
+    timer.lap(phase_neighbours);
+    timer.pairs(tested, sep_total);
+
+    // --- 3. Calculate Predator Avoidance ---
+    // For each predator, steer away if too close
+    for (int k = 0; (Features & feature_predators) && k < pr.n; k++) {
+      // Calculate distance between boid i and predator k
+      T dx = offset_x(x[i] - pr.x[k]);
+      T dy = offset_y(y[i] - pr.y[k]);
+      T d2 = dx*dx + dy*dy;
+
+      // If within predator_radius, add repulsion vector
+      if (d2 < predator_r2) {
+        T d = std::sqrt(d2);
+        pred.x += dx / d; // Add x-component of avoidance vector
+        pred.y += dy / d; // Add y-component of avoidance vector
+      }
+    }
+    timer.lap(phase_predator_avoid);
+
+    // --- 3. Calculate p_area Avoidance and r_area Attraction ---
+    if (!(Features & feature_areas)) {
+      // No area term can act
+    } else if (field) {
+      field->sample(x[i], y[i], p_area, r_area); // Baked once for the whole run
+    } else {
+      area_forces<periodic>(pa, ra, x[i], y[i], p_area, r_area, width, height);
+    }
+    timer.lap(phase_areas);
+
+    // --- 4. and 5. Apply Weights, Update Velocity and Limit Speed ---
+    steering.template apply<Features>(x[i], y[i], vx[i], vy[i], sep, sep_total, ali, ali_total,
+                                      coh, coh_total, pred, p_area, r_area);
+    timer.lap(phase_steering);
+
+    // add small perturbation
+    double u0, u1;
+    uniform_pair(seed, step, tile.id ? (std::uint64_t)(tile.id[i] - 1) : (std::uint64_t)i, u0, u1);
+    vx[i] += (T)((u0 - 0.5) * 0.1);
+    vy[i] += (T)((u1 - 0.5) * 0.1);
+    timer.lap(phase_rng);
+
+    // --- 6. Update Position ---
+    // Move boid according to its velocity
+    x[i] += vx[i];
+    y[i] += vy[i];
+
+    // --- 7. Rebound Off Walls (or wrap around the torus) ---
+    if (periodic) {
+      wrap_edges(x[i], y[i], width, height);
+    } else {
+      rebound_walls(x[i], y[i], vx[i], vy[i], width, height);
+    }
+
+    // Keep the cell-ordered copy in step with the in-place update (periodic:
+    // with the image next to the cell the boid was binned in, as the spans
+    // of for_each_image_span_near assume)
+    if (sorted && !par.synchronous) {
+      int s = grid.slot_of[i];
+      ws.sx[s] = periodic ? ws.sx[s] + offset_x(x[i] - ws.sx[s]) : x[i];
+      ws.sy[s] = periodic ? ws.sy[s] + offset_y(y[i] - ws.sy[s]) : y[i];
+      ws.svx[s] = vx[i]; ws.svy[s] = vy[i];
+    }
+    timer.lap(phase_move);
+  }
+}
+
+// Advance all boids by one step, in place (see step_boids_with), with the
+// loop built for the terms that can act in this step
+template <class T>
+inline void step_boids(SwarmView<T> b, const SwarmView<T>& pr,
+                       const AreaView<T>& pa, const AreaView<T>& ra,
+                       const BoidParams& par, StepWorkspace<T>& ws,
+                       std::uint64_t seed, std::uint64_t step,
+                       const AreaField<T>* field = nullptr,
+                       StepProfile* profile = nullptr) {
+  switch (step_features(par, pr.n, pa, ra)) {
+    case 0: step_boids_with<0>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 1: step_boids_with<1>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 2: step_boids_with<2>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 3: step_boids_with<3>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 4: step_boids_with<4>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 5: step_boids_with<5>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 6: step_boids_with<6>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 7: step_boids_with<7>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 8: step_boids_with<8>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 9: step_boids_with<9>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 10: step_boids_with<10>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 11: step_boids_with<11>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 12: step_boids_with<12>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 13: step_boids_with<13>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    case 14: step_boids_with<14>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+    default: step_boids_with<all_features | feature_periodic>(b, pr, pa, ra, par, ws, seed, step, field, profile); break;
+  }
+}
+
+// Nearest boid to (qx, qy) among boids [from, to), or -1 if the range is empty.
+// Ties go to the lowest index, as in a plain forward scan. Distances are
+// only compared, so they are kept squared (no sqrt). Periodic: those of
+// the minimum images on the torus of the given width and height.
+template <class T>
+struct NearestBoid {
+  T dist2 = INFINITY;
+  int index = -1;
+};
+
+template <bool Periodic = false, class T>
+inline NearestBoid<T> nearest_boid(const T* bx, const T* by,
+                                   int from, int to, T qx, T qy, T width = T(0), T height = T(0)) {
+  NearestBoid<T> best;
+  for (int j = from; j < to; j++) {
+    T dx = bx[j] - qx;
+    T dy = by[j] - qy;
+    if (Periodic) {
+      dx = min_image(dx, width);
+      dy = min_image(dy, height);
+    }
+    T d2 = dx*dx + dy*dy;
+    if (d2 < best.dist2) {
+      best.dist2 = d2;
+      best.index = j;
+    }
+  }
+  return best;
+}
+
+// One step of a predator at (px, py): steer toward boid `closest` of (bx,
+// by) (-1: none), limit the speed, move and rebound off the walls (or,
+// periodic, steer toward its nearest image and wrap around). Shared by
+// step_predators and the device kernel (boids.gpu.h).
+template <class T>
+inline void chase_boid(T& px, T& py, T& pvx, T& pvy, const T* bx, const T* by, int closest,
+                       T max_speed, T pred_rel_speed, T width, T height, bool periodic = false) {
+  // --- 3. Steer Toward Closest Boid ---
+  if (closest != -1) {
+    T dx = bx[closest] - px;
+    T dy = by[closest] - py;
+    if (periodic) {
+      dx = min_image(dx, width);
+      dy = min_image(dy, height);
+    }
+    T d = std::sqrt(dx*dx + dy*dy);
+    if (d > 0) { // Avoid division by zero
+      // Steer toward the closest boid
+      pvx += dx / d * T(0.05); // Small steering force
+      pvy += dy / d * T(0.05);
+    }
+  }
+
+  // --- 4. Limit Speed ---
+  T speed = std::sqrt(pvx*pvx + pvy*pvy);
+  if (speed > (max_speed * pred_rel_speed)) { // Predators can move slightly faster
+    pvx = pvx / speed * max_speed * pred_rel_speed;
+    pvy = pvy / speed * max_speed * pred_rel_speed;
+  }
+
+  // --- 5. Update Position ---
+  px += pvx;
+  py += pvy;
+
+  // --- 6. Rebound Off Walls ---
+  if (periodic) {
+    wrap_edges(px, py, width, height);
+  } else {
+    rebound_walls(px, py, pvx, pvy, width, height);
+  }
+}
+
+// Advance all predators by one step, in place.
+// Predators chase the nearest boid and rebound off walls.
+// With a grid of the boids the nearest boid is found by a ring search
+// outward from the predator's cell; `slack` is how far the boids may have
+// moved since the grid was built (e.g. by the boid step that built it).
+// Otherwise all boids are scanned and the search is split over
+// par.n_threads threads; the partial results are merged with the same
+// lowest-index tie rule. Either way the chosen boid is the same.
+// With par.periodic the grid must be periodic too (as built by the boid step).
+template <class T>
+inline void step_predators(SwarmView<T> p, const SwarmView<T>& b,
+                           const BoidParams& par,
+                           const CellGrid* grid = nullptr, double slack = 0.0) {
+  T* px = p.x;   T* py = p.y;   // Predator positions
+  T* pvx = p.vx; T* pvy = p.vy; // Predator velocities
+  const T* bx = b.x; const T* by = b.y; // Boid positions
+  T max_speed = (T)par.max_speed;
+  T pred_rel_speed = (T)par.pred_rel_speed;
+  T width = (T)par.width, height = (T)par.height;
+
+  // --- 1. Loop Over Each Predator ---
+  for (int i = 0; i < p.n; i++) {
+    // --- 2. Find Closest Boid ---
+    NearestBoid<T> closest;
+    int n_threads = std::max(1, std::min(par.n_threads, b.n / 1024)); // Not worth it for few boids
+    if (grid) {
+      closest.index = grid->nearest(bx, by, px[i], py[i], slack, closest.dist2);
+    } else if (n_threads <= 1) {
+      closest = par.periodic ? nearest_boid<true>(bx, by, 0, b.n, px[i], py[i], width, height)
+                             : nearest_boid(bx, by, 0, b.n, px[i], py[i]);
+    } else {
+      std::vector<NearestBoid<T>> part(n_threads);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static)
+#endif
+      for (int t = 0; t < n_threads; t++) {
+        int from = (int)((long long)b.n * t / n_threads);
+        int to = (int)((long long)b.n * (t + 1) / n_threads);
+        part[t] = par.periodic ? nearest_boid<true>(bx, by, from, to, px[i], py[i], width, height)
+                               : nearest_boid(bx, by, from, to, px[i], py[i]);
+      }
+      for (int t = 0; t < n_threads; t++) {
+        // Chunks are in index order, so strict < keeps the lowest index on ties
+        if (part[t].dist2 < closest.dist2) closest = part[t];
+      }
+    }
+    int closest_boid = closest.index; // Index of closest boid
+
+    // --- 3. to 6. Steer, Move and Rebound ---
+    chase_boid(px[i], py[i], pvx[i], pvy[i], bx, by, closest_boid, max_speed, pred_rel_speed,
+               width, height, par.periodic);
+  }
+}
+
+#endif
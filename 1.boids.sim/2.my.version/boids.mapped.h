@@ -0,0 +1,72 @@
+// Read-only memory map of a whole file (a plain read into memory where mmap
+// is not available), shared by the trajectory and checkpoint readers. The
+// pages are only read in as they are touched, and a file mapped by several
+// readers (or processes) is held once in the page cache.
+#ifndef BOIDS_MAPPED_H
+#define BOIDS_MAPPED_H
+
+#include <cstddef>   // For std::size_t
+#include <cstdio>    // For FILE
+#include <stdexcept> // For std::runtime_error
+#include <string>    // For file names
+#include <vector>    // For std::vector
+#ifndef _WIN32
+#include <fcntl.h>    // For open
+#include <sys/mman.h> // For mmap
+#include <sys/stat.h> // For fstat
+#include <unistd.h>   // For close
+#endif
+
+class MappedFile {
+public:
+  // Map `path`; `what` names the kind of file in the error messages
+  MappedFile(const std::string& path, const std::string& what) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + what + " " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); throw std::runtime_error("cannot stat " + path); }
+    bytes = (std::size_t)st.st_size;
+    if (bytes > 0) {
+      void* p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED) throw std::runtime_error("cannot map " + what + " " + path);
+      base = static_cast<const char*>(p);
+      mapped = true;
+    } else {
+      ::close(fd);
+    }
+#else
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("cannot open " + what + " " + path);
+    std::fseek(f, 0, SEEK_END);
+    copy.resize((std::size_t)std::ftell(f));
+    std::fseek(f, 0, SEEK_SET);
+    bytes = std::fread(copy.data(), 1, copy.size(), f);
+    std::fclose(f);
+    base = copy.data();
+#endif
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (mapped) munmap(const_cast<char*>(base), bytes);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return base; } // Page-aligned (mmap), so 8-byte blocks stay aligned
+  std::size_t size() const { return bytes; }
+
+private:
+  const char* base = nullptr;
+  std::size_t bytes = 0;
+  bool mapped = false;
+#ifdef _WIN32
+  std::vector<char> copy;
+#endif
+};
+
+#endif
@@ -0,0 +1,433 @@
+// Domain-decomposed boid world over MPI ranks, for landscapes that do not
+// fit one node (~10^7 boids, many habitat patches). The domain is cut into
+// an nx x ny grid of equal tiles, one per rank. Each rank owns the boids
+// inside its tile and steps them with the same kernel as a single world
+// (step_boids, synchronous mode), reading as neighbours a halo of copies of
+// the boids within neighbor_radius of its tile, sent by the neighbouring
+// ranks before each step. After the step, boids that crossed a tile border
+// migrate to their new owner. Both exchanges go along x and then along y,
+// with the boids received along x forwarded along y, so the corner tiles
+// are served without diagonal messages.
+//
+// Predators are few and replicated: each rank finds the nearest of its own
+// boids to every predator, one reduction picks the nearest overall (ties:
+// lowest id) and every rank then moves the predators alike. The areas are
+// static: a rank keeps those that can act inside its tile. Survey counts are
+// taken on each tile and summed over the ranks at the end.
+//
+// Every boid keeps its row in the initial state, counted from 1, as its id
+// (as Population numbers the boids of a world). The id keys its noise
+// stream (see StepTile) and its survey detections, so a run does not
+// depend on the number of ranks. Each tile holds its boids in id
+// order and its grid is a window of the single-world grid, so without SIMD
+// sums a distributed run gives the same result as the single world (or
+// update_boids_cpp / update_predators_cpp on the grid) started from the same
+// state; SIMD sums agree up to rounding. Not distributed: asynchronous
+// steps (a tile would need its neighbours' new state mid-step), periodic
+// domains, Verlet lists, births and deaths, and the outputs other than the
+// survey (flocks, trajectories, animation).
+//
+// It is compiled in only when BOIDS_USE_MPI is defined to a non-zero value,
+// with the flags of the MPI compiler wrapper, e.g. with Open MPI
+//   Sys.setenv(PKG_CPPFLAGS = paste("-DBOIDS_USE_MPI=1", system("mpicxx --showme:compile", intern = TRUE)),
+//              PKG_LIBS = system("mpicxx --showme:link", intern = TRUE))
+//   Rcpp::sourceCpp("1.rebound.poor.areas.cpp", rebuild = TRUE)
+// and the R script is started on every rank (mpirun -n 64 Rscript run.r),
+// each rank calling run_simulation_mpi_cpp with the same arguments.
+#ifndef BOIDS_MPI_H
+#define BOIDS_MPI_H
+
+#ifndef BOIDS_USE_MPI
+#define BOIDS_USE_MPI 0
+#endif
+
+#if BOIDS_USE_MPI
+
+#include <algorithm> // For std::sort, std::max, std::min
+#include <cmath>     // For floor, INFINITY
+#include <cstdint>   // For fixed-width integers
+#include <limits>    // For the id of no boid
+#include <stdexcept> // For std::runtime_error
+#include <string>    // For the error messages
+#include <vector>    // For std::vector
+#include <mpi.h>     // For the exchanges between ranks
+#include "boids.kernels.h" // step_boids, chase_boid, StepTile
+#include "boids.survey.h"  // Survey sampler
+#include "boids.world.h"   // SwarmState, AreaState
+
+// Tiles of the domain, one per rank: an nx x ny grid of equal rectangles,
+// tile (tx, ty) on rank ty * nx + tx
+struct TileLayout {
+  int nx = 1, ny = 1;           // Tiles along x and y
+  double width = 0, height = 0; // Domain
+
+  // Layout of n_ranks tiles over width x height, as square as MPI makes
+  // them, with more tiles along the longer side
+  static TileLayout fit(int n_ranks, double width, double height) {
+    int dims[2] = {0, 0};
+    MPI_Dims_create(n_ranks, 2, dims); // dims[0] >= dims[1]
+    TileLayout t;
+    t.width = width;
+    t.height = height;
+    t.nx = width >= height ? dims[0] : dims[1];
+    t.ny = width >= height ? dims[1] : dims[0];
+    return t;
+  }
+
+  // Rank of tile (tx, ty), MPI_PROC_NULL past the edges of the domain
+  int rank(int tx, int ty) const {
+    return tx < 0 || ty < 0 || tx >= nx || ty >= ny ? MPI_PROC_NULL : ty * nx + tx;
+  }
+
+  // Tile column of x and row of y (points on or past an edge go to the border tiles)
+  int column(double x) const { return std::max(0, std::min(nx - 1, (int)floor(x / width * nx))); }
+  int row(double y) const { return std::max(0, std::min(ny - 1, (int)floor(y / height * ny))); }
+
+  // Lower edges of column tx and row ty (tx = nx, ty = ny: the far edges of the domain)
+  double x_edge(int tx) const { return width * tx / nx; }
+  double y_edge(int ty) const { return height * ty / ny; }
+};
+
+// A boid on the wire between two ranks
+template <class T>
+struct BoidRecord {
+  T x, y, vx, vy;
+  std::int64_t id;
+};
+
+// Nearest boid of a rank to one predator, reduced over the ranks
+struct PreyCandidate {
+  double d2;       // Squared distance (INFINITY: no boid)
+  std::int64_t id; // Its id (ties: the lowest wins)
+  double x, y;     // Its position
+};
+
+// MPI reduction of PreyCandidate arrays: keep the closer candidate, element by element
+inline void closer_prey(void* in, void* inout, int* len, MPI_Datatype*) {
+  const PreyCandidate* a = static_cast<const PreyCandidate*>(in);
+  PreyCandidate* b = static_cast<PreyCandidate*>(inout);
+  for (int k = 0; k < *len; k++) {
+    if (a[k].d2 < b[k].d2 || (a[k].d2 == b[k].d2 && a[k].id < b[k].id)) b[k] = a[k];
+  }
+}
+
+// One rank's part of a distributed world, in precision T. Every rank of
+// `comm` builds one with the same parameters and seed, and gives it the
+// same initial state; each keeps what falls in its tile.
+template <class T>
+class DistributedWorld {
+public:
+  BoidParams par;               // Simulation parameters (as in BoidWorld)
+  std::uint64_t seed = 0;       // Seed of the noise streams
+  std::uint64_t step_count = 0; // Steps run so far
+  SurveySites survey;           // Survey sites (none: no sampling)
+  SurveyCounts survey_counts;   // Counts of this tile (see reduce_survey)
+  int survey_stride = 1;        // Sample the survey every survey_stride steps
+  double seconds_step = 0;      // Time in the boid and predator steps
+  double seconds_exchange = 0;  // Time exchanging halos, prey and migrants
+
+  DistributedWorld(MPI_Comm comm, const BoidParams& params, std::uint64_t noise_seed)
+    : par(params), seed(noise_seed) {
+    MPI_Comm_dup(comm, &comm_);
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &n_ranks_);
+    layout = TileLayout::fit(n_ranks_, par.width, par.height);
+    tx = rank_ % layout.nx;
+    ty = rank_ / layout.nx;
+    if (!par.synchronous) throw std::runtime_error("a distributed world needs synchronous steps");
+    if (par.periodic) throw std::runtime_error("a distributed world needs rebounding walls");
+    if (par.verlet_skin > 0) throw std::runtime_error("a distributed world does not use Verlet lists");
+    // Halos only come from the next tile, and boids move by at most one tile a step
+    halo_width = par.neighbor_radius * (1 + 1e-9) + 1e-9 * std::max(par.width, par.height);
+    double tile = std::min(par.width / layout.nx, par.height / layout.ny);
+    double max_move = par.max_speed + 0.1;
+    if (halo_width > tile || max_move > tile) {
+      throw std::runtime_error("tiles of " + std::to_string(tile) + " (" + std::to_string(layout.nx) + " x " +
+                               std::to_string(layout.ny) + " ranks) are narrower than neighbor_radius or max_speed");
+    }
+    MPI_Type_contiguous((int)sizeof(BoidRecord<T>), MPI_BYTE, &record_type);
+    MPI_Type_commit(&record_type);
+    MPI_Type_contiguous((int)sizeof(PreyCandidate), MPI_BYTE, &prey_type);
+    MPI_Type_commit(&prey_type);
+    MPI_Op_create(&closer_prey, 1, &prey_op);
+  }
+
+  ~DistributedWorld() {
+    MPI_Op_free(&prey_op);
+    MPI_Type_free(&prey_type);
+    MPI_Type_free(&record_type);
+    MPI_Comm_free(&comm_);
+  }
+
+  DistributedWorld(const DistributedWorld&) = delete;
+  DistributedWorld& operator=(const DistributedWorld&) = delete;
+
+  int rank() const { return rank_; }
+  int n_ranks() const { return n_ranks_; }
+  const TileLayout& tiles() const { return layout; }
+
+  // Keep the boids of the initial state (n rows, the same on every rank)
+  // that fall in this tile; row i gets id i + 1
+  void assign_boids(const double* x, const double* y, const double* vx, const double* vy, int n) {
+    boids = SwarmState<T>();
+    id.clear();
+    for (int i = 0; i < n; i++) {
+      if (layout.column(x[i]) != tx || layout.row(y[i]) != ty) continue;
+      push(boids, id, BoidRecord<T>{(T)x[i], (T)y[i], (T)vx[i], (T)vy[i], (std::int64_t)i + 1});
+    }
+  }
+
+  // All the predators, on every rank
+  void assign_predators(const double* x, const double* y, const double* vx, const double* vy, int n) {
+    predators.assign(x, y, vx, vy, n);
+  }
+
+  // Keep the areas whose disc reaches this tile (with a baked field: its
+  // tile widened by one field cell, as the nodes around a boid are sampled)
+  void assign_areas(AreaState<T>& areas, const double* x, const double* y, const double* radius, int n) {
+    double margin = par.area_field_cell + 1e-9 * std::max(par.width, par.height);
+    double x0 = layout.x_edge(tx) - margin, x1 = layout.x_edge(tx + 1) + margin;
+    double y0 = layout.y_edge(ty) - margin, y1 = layout.y_edge(ty + 1) + margin;
+    std::vector<double> kx, ky, kr;
+    for (int k = 0; k < n; k++) {
+      double dx = std::max(0.0, std::max(x0 - x[k], x[k] - x1));
+      double dy = std::max(0.0, std::max(y0 - y[k], y[k] - y1));
+      if (radius[k] > 0 && dx * dx + dy * dy <= radius[k] * radius[k]) {
+        kx.push_back(x[k]); ky.push_back(y[k]); kr.push_back(radius[k]);
+      }
+    }
+    areas.assign(kx.data(), ky.data(), kr.data(), (int)kx.size());
+    areas.set_domain(par.width, par.height);
+  }
+  void assign_p_areas(const double* x, const double* y, const double* radius, int n) { assign_areas(p_areas, x, y, radius, n); }
+  void assign_r_areas(const double* x, const double* y, const double* radius, int n) { assign_areas(r_areas, x, y, radius, n); }
+
+  // Advance by n_steps steps (every rank calls it with the same n_steps):
+  // halo exchange, boid step, predator step, migration, survey
+  void step(int n_steps) {
+    for (int s = 0; s < n_steps; s++) {
+      ++step_count;
+      double t0 = MPI_Wtime();
+      gather_halo();
+      double t1 = MPI_Wtime();
+
+      // --- 1. Boid step of the tile ---
+      const AreaField<T>* baked = nullptr;
+      if (par.area_field_cell > 0) {
+        field.update(p_areas.view(), r_areas.view(), par.width, par.height, par.area_field_cell);
+        baked = &field;
+      }
+      ws.tile.halo = halo.data();
+      ws.tile.id = local_id.data();
+      ws.tile.x0 = std::max(0.0, layout.x_edge(tx) - halo_width);
+      ws.tile.x1 = std::min(par.width, layout.x_edge(tx + 1) + halo_width);
+      ws.tile.y0 = std::max(0.0, layout.y_edge(ty) - halo_width);
+      ws.tile.y1 = std::min(par.height, layout.y_edge(ty + 1) + halo_width);
+      step_boids(local.view(), predators.view(), p_areas.view(), r_areas.view(), par, ws, seed, step_count, baked);
+      keep_owned();
+
+      // --- 2. Predator step, alike on every rank ---
+      chase_nearest();
+      double t3 = MPI_Wtime();
+
+      // --- 3. Boids that left the tile go to their new owner ---
+      migrate();
+      double t4 = MPI_Wtime();
+      seconds_exchange += (t1 - t0) + (t4 - t3);
+      seconds_step += t3 - t1;
+
+      if (survey.size() && step_count % survey_stride == 0) {
+        survey_counts.record(survey, boids.view(), seed, step_count, id.data());
+      }
+    }
+  }
+
+  // Number of boids over all the ranks
+  long long total_boids() const {
+    long long n = boids.size(), total = 0;
+    MPI_Allreduce(&n, &total, 1, MPI_LONG_LONG, MPI_SUM, comm_);
+    return total;
+  }
+
+  // All the boids on rank `root`, by id (empty on the other ranks)
+  std::vector<BoidRecord<T>> gather_boids(int root = 0) const {
+    std::vector<BoidRecord<T>> mine(boids.size()), all;
+    for (int i = 0; i < boids.size(); i++) mine[i] = record(boids, id, i);
+    int n = (int)mine.size();
+    std::vector<int> counts(n_ranks_), offsets(n_ranks_, 0);
+    MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm_);
+    if (rank_ == root) {
+      for (int r = 1; r < n_ranks_; r++) offsets[r] = offsets[r - 1] + counts[r - 1];
+      all.resize(n_ranks_ ? offsets.back() + counts.back() : 0);
+    }
+    MPI_Gatherv(mine.data(), n, record_type, all.data(), counts.data(), offsets.data(), record_type, root, comm_);
+    std::sort(all.begin(), all.end(), [](const BoidRecord<T>& a, const BoidRecord<T>& b) { return a.id < b.id; });
+    return all;
+  }
+
+  // The predators (the same on every rank)
+  const SwarmState<T>& predator_state() const { return predators; }
+
+  // Survey counts summed over the tiles, on rank `root`
+  SurveyCounts reduce_survey(int root = 0) const {
+    SurveyCounts total = survey_counts;
+    MPI_Reduce(survey_counts.counts.data(), rank_ == root ? total.counts.data() : nullptr,
+               (int)survey_counts.counts.size(), MPI_INT, MPI_SUM, root, comm_);
+    return total;
+  }
+
+  // Time in the step and in the exchanges, the longest over the ranks
+  void max_seconds(double& step, double& exchange) const {
+    double mine[2] = {seconds_step, seconds_exchange}, top[2];
+    MPI_Allreduce(mine, top, 2, MPI_DOUBLE, MPI_MAX, comm_);
+    step = top[0];
+    exchange = top[1];
+  }
+
+private:
+  MPI_Comm comm_;
+  int rank_ = 0, n_ranks_ = 1;
+  TileLayout layout;
+  int tx = 0, ty = 0;        // Tile of this rank
+  double halo_width = 0;     // Boids this close to a tile edge are copied across it
+  MPI_Datatype record_type, prey_type;
+  MPI_Op prey_op;
+
+  SwarmState<T> boids;           // Owned boids, by id
+  std::vector<std::int64_t> id;
+  SwarmState<T> local;           // Owned and halo boids, by id (the step's view)
+  std::vector<std::int64_t> local_id;
+  std::vector<std::uint8_t> halo; // halo[i] != 0: local boid i belongs to another tile
+  SwarmState<T> predators;       // All the predators
+  AreaState<T> p_areas, r_areas; // The areas reaching this tile
+  AreaField<T> field;            // Baked area forces (par.area_field_cell > 0)
+  StepWorkspace<T> ws;           // Grid and copies, reused across steps
+
+  static BoidRecord<T> record(const SwarmState<T>& b, const std::vector<std::int64_t>& ids, int i) {
+    return BoidRecord<T>{b.x[i], b.y[i], b.vx[i], b.vy[i], ids[i]};
+  }
+  static void push(SwarmState<T>& b, std::vector<std::int64_t>& ids, const BoidRecord<T>& r) {
+    b.x.push_back(r.x); b.y.push_back(r.y);
+    b.vx.push_back(r.vx); b.vy.push_back(r.vy);
+    ids.push_back(r.id);
+  }
+
+  // Send to_lo to rank lo and to_hi to rank hi (MPI_PROC_NULL: nobody) and
+  // append what they send back to `in`
+  void swap_records(int lo, int hi, const std::vector<BoidRecord<T>>& to_lo,
+                    const std::vector<BoidRecord<T>>& to_hi, std::vector<BoidRecord<T>>& in) {
+    int n_out[2] = {(int)to_lo.size(), (int)to_hi.size()}, n_in[2] = {0, 0};
+    MPI_Sendrecv(&n_out[0], 1, MPI_INT, lo, 0, &n_in[1], 1, MPI_INT, hi, 0, comm_, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&n_out[1], 1, MPI_INT, hi, 1, &n_in[0], 1, MPI_INT, lo, 1, comm_, MPI_STATUS_IGNORE);
+    std::size_t at = in.size();
+    in.resize(at + n_in[0] + n_in[1]);
+    MPI_Sendrecv(to_lo.data(), n_out[0], record_type, lo, 2,
+                 in.data() + at + n_in[0], n_in[1], record_type, hi, 2, comm_, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(to_hi.data(), n_out[1], record_type, hi, 3,
+                 in.data() + at, n_in[0], record_type, lo, 3, comm_, MPI_STATUS_IGNORE);
+  }
+
+  // Merge the boids of `b` (by id) with `extra` (any order) into `out`, by
+  // id; flags[i] is 0 for the boids of b and `extra_flag` for the others
+  static void merge_by_id(const SwarmState<T>& b, const std::vector<std::int64_t>& ids,
+                          std::vector<BoidRecord<T>>& extra, SwarmState<T>& out,
+                          std::vector<std::int64_t>& out_id, std::vector<std::uint8_t>* flags,
+                          std::uint8_t extra_flag) {
+    std::sort(extra.begin(), extra.end(), [](const BoidRecord<T>& a, const BoidRecord<T>& c) { return a.id < c.id; });
+    std::size_t n = (std::size_t)b.size() + extra.size();
+    for (AlignedBuffer<T>* col : {&out.x, &out.y, &out.vx, &out.vy}) col->resize(n);
+    out_id.resize(n);
+    if (flags) flags->resize(n);
+    std::size_t i = 0, k = 0;
+    for (std::size_t s = 0; s < n; s++) {
+      bool own = k == extra.size() || (i < ids.size() && ids[i] < extra[k].id);
+      BoidRecord<T> r = own ? record(b, ids, (int)i++) : extra[k++];
+      out.x[s] = r.x; out.y[s] = r.y; out.vx[s] = r.vx; out.vy[s] = r.vy;
+      out_id[s] = r.id;
+      if (flags) (*flags)[s] = own ? 0 : extra_flag;
+    }
+  }
+
+  // Local view of the step: the owned boids plus copies of the boids
+  // within halo_width of this tile, along x, then along y (the boids
+  // received along x included, which covers the corners)
+  void gather_halo() {
+    std::vector<BoidRecord<T>> received, to_lo, to_hi;
+    double x_lo = layout.x_edge(tx) + halo_width, x_hi = layout.x_edge(tx + 1) - halo_width;
+    for (int i = 0; i < boids.size(); i++) {
+      if (boids.x[i] < x_lo) to_lo.push_back(record(boids, id, i));
+      if (boids.x[i] >= x_hi) to_hi.push_back(record(boids, id, i));
+    }
+    swap_records(layout.rank(tx - 1, ty), layout.rank(tx + 1, ty), to_lo, to_hi, received);
+
+    to_lo.clear();
+    to_hi.clear();
+    double y_lo = layout.y_edge(ty) + halo_width, y_hi = layout.y_edge(ty + 1) - halo_width;
+    std::size_t along_x = received.size();
+    for (int i = 0; i < boids.size(); i++) {
+      if (boids.y[i] < y_lo) to_lo.push_back(record(boids, id, i));
+      if (boids.y[i] >= y_hi) to_hi.push_back(record(boids, id, i));
+    }
+    for (std::size_t k = 0; k < along_x; k++) {
+      if (received[k].y < y_lo) to_lo.push_back(received[k]);
+      if (received[k].y >= y_hi) to_hi.push_back(received[k]);
+    }
+    swap_records(layout.rank(tx, ty - 1), layout.rank(tx, ty + 1), to_lo, to_hi, received);
+    merge_by_id(boids, id, received, local, local_id, &halo, 1);
+  }
+
+  // Take the stepped owned boids back out of the local view (still by id)
+  void keep_owned() {
+    int n = 0;
+    for (int i = 0; i < local.size(); i++) {
+      if (halo[i]) continue;
+      boids.x[n] = local.x[i]; boids.y[n] = local.y[i];
+      boids.vx[n] = local.vx[i]; boids.vy[n] = local.vy[i];
+      n++;
+    }
+  }
+
+  // Move every predator toward the nearest boid of any tile. Distances in
+  // T, ties to the lowest id, as step_predators does on a single world.
+  void chase_nearest() {
+    int np = predators.size();
+    std::vector<PreyCandidate> best(np), mine(np);
+    for (int k = 0; k < np; k++) {
+      NearestBoid<T> near = nearest_boid(boids.x.data(), boids.y.data(), 0, boids.size(),
+                                         predators.x[k], predators.y[k]);
+      mine[k] = near.index < 0
+        ? PreyCandidate{INFINITY, std::numeric_limits<std::int64_t>::max(), 0, 0}
+        : PreyCandidate{(double)near.dist2, id[near.index], (double)boids.x[near.index], (double)boids.y[near.index]};
+    }
+    MPI_Allreduce(mine.data(), best.data(), np, prey_type, prey_op, comm_);
+    for (int k = 0; k < np; k++) {
+      T bx = (T)best[k].x, by = (T)best[k].y;
+      chase_boid(predators.x[k], predators.y[k], predators.vx[k], predators.vy[k], &bx, &by,
+                 best[k].d2 == INFINITY ? -1 : 0, (T)par.max_speed, (T)par.pred_rel_speed,
+                 (T)par.width, (T)par.height);
+    }
+  }
+
+  // Send the boids that left the tile to the neighbour they moved into,
+  // along x then along y (a corner move is two hops); arrivals are merged by id
+  void migrate() {
+    for (int axis = 0; axis < 2; axis++) {
+      std::vector<BoidRecord<T>> to_lo, to_hi, arrived;
+      SwarmState<T> stay;
+      std::vector<std::int64_t> stay_id;
+      int here = axis == 0 ? tx : ty;
+      for (int i = 0; i < boids.size(); i++) {
+        int to = axis == 0 ? layout.column(boids.x[i]) : layout.row(boids.y[i]);
+        if (to == here) push(stay, stay_id, record(boids, id, i));
+        else (to < here ? to_lo : to_hi).push_back(record(boids, id, i));
+      }
+      if (axis == 0) swap_records(layout.rank(tx - 1, ty), layout.rank(tx + 1, ty), to_lo, to_hi, arrived);
+      else swap_records(layout.rank(tx, ty - 1), layout.rank(tx, ty + 1), to_lo, to_hi, arrived);
+      merge_by_id(stay, stay_id, arrived, boids, id, nullptr, 0);
+    }
+  }
+};
+
+#endif
+
+#endif
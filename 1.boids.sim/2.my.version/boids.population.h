@@ -0,0 +1,296 @@
+// Birth and death of boids inside the native world.
+// Once a year (every `year_steps` steps) births and deaths are drawn as in
+// the sigmoid sandbox model (3.sigmoid.model.death.birth): Poisson numbers
+// with linear density dependence and lognormal overdispersion,
+//   births ~ Poisson((b + b * lb * N) * N * exp(eps_b)),
+//   deaths ~ Poisson((d + d * ld * N) * N * exp(eps_d)), eps ~ N(0, sd),
+// with carrying capacity K = (b - d) / (d * ld - b * lb). Offspring appear
+// next to a random parent and take its heading. Predators can also kill the
+// nearest boid within kill_radius, at most one each per step; with the cell
+// list of the boid step the search only visits the cells within reach.
+//
+// The boid columns stay dense, as the step kernels expect: the slot of a
+// dead boid goes on a free list, births reuse free slots first (then append
+// to the columns, whose capacity only grows), and any slots still free are
+// compacted away, keeping the order of the living, at the end of every step
+// that killed a boid or closed a year, before the state is read again.
+// Every boid keeps an id for life; ids are never reused.
+#ifndef BOIDS_POPULATION_H
+#define BOIDS_POPULATION_H
+
+#include <algorithm> // For std::sort, std::swap, std::min, std::max
+#include <cmath>     // For exp, log, sqrt, floor, lgamma
+#include <cstdint>   // For fixed-width integers
+#include <vector>    // For std::vector
+#include "boids.grid.h" // CellGrid, min_image, wrap_coord
+#include "boids.rng.h" // Counter-based random numbers
+
+// Parameters of the population dynamics (names as in the sandbox model)
+struct PopulationParams {
+  int year_steps = 0;                   // Steps per year (0: no births or deaths)
+  double base_growth = 0.1;             // Per-capita birth rate at low density
+  double base_death = 0.05;             // Per-capita death rate at low density
+  double linear_impact_growth = -0.001; // Relative change of the birth rate per boid
+  double linear_impact_death = 0.0005;  // Relative change of the death rate per boid
+  double sd_overdisp = 0.5;             // sd of the lognormal overdispersion of the rates
+  double birth_spread = 5;              // sd of the offspring position around the parent
+  double kill_radius = 0;               // Predators kill the nearest boid within this distance (0: never)
+};
+
+// Sequential draws from a counter-based stream: (seed, step) picks the
+// stream, draws are taken in order from it
+class EventStream {
+public:
+  EventStream(std::uint64_t seed, std::uint64_t step) : seed(seed), step(step) {}
+
+  double uniform() {
+    if (left == 0) {
+      uniform_pair(seed, step, next++, pair[0], pair[1]);
+      left = 2;
+    }
+    return pair[--left];
+  }
+
+  double normal() { // Box-Muller
+    const double two_pi = 6.283185307179586;
+    double u0 = 1.0 - uniform(), u1 = uniform(); // u0 in (0, 1]
+    return sqrt(-2.0 * log(u0)) * cos(two_pi * u1);
+  }
+
+  // Poisson draw: multiplication of uniforms for small means, else the
+  // transformed rejection method PTRS (Hormann 1993)
+  std::int64_t poisson(double lambda) {
+    if (!(lambda > 0)) return 0;
+    if (lambda < 10) {
+      double limit = exp(-lambda), prod = uniform();
+      std::int64_t k = 0;
+      while (prod > limit) { prod *= uniform(); k++; }
+      return k;
+    }
+    double slam = sqrt(lambda), loglam = log(lambda);
+    double b = 0.931 + 2.53 * slam, a = -0.059 + 0.02483 * b;
+    double inv_alpha = 1.1239 + 1.1328 / (b - 3.4), vr = 0.9277 - 3.6224 / (b - 2);
+    for (;;) {
+      double u = uniform() - 0.5, v = uniform();
+      double us = 0.5 - fabs(u);
+      double k = floor((2 * a / us + b) * u + lambda + 0.43);
+      if (us >= 0.07 && v <= vr) return (std::int64_t)k;
+      if (k < 0 || (us < 0.013 && v > us)) continue;
+      if (log(v) + log(inv_alpha) - log(a / (us * us) + b) <= -lambda + k * loglam - lgamma(k + 1)) {
+        return (std::int64_t)k;
+      }
+    }
+  }
+
+private:
+  std::uint64_t seed, step, next = 0;
+  double pair[2];
+  int left = 0;
+};
+
+// Births and deaths of a year that starts with n individuals, drawn from
+// rng as in the sigmoid model (deaths capped at n). Shared by the world and
+// the state-space model (boids.ssm.h), so both run the same process.
+inline void draw_births_deaths(const PopulationParams& par, double n, EventStream& rng,
+                               std::int64_t& births, std::int64_t& deaths) {
+  double birth_rate = par.base_growth + par.base_growth * par.linear_impact_growth * n;
+  double death_rate = par.base_death + par.base_death * par.linear_impact_death * n;
+  births = rng.poisson(birth_rate * n * exp(rng.normal() * par.sd_overdisp));
+  deaths = rng.poisson(death_rate * n * exp(rng.normal() * par.sd_overdisp));
+  if (deaths > (std::int64_t)n) deaths = (std::int64_t)n;
+}
+
+// Yearly record of the population
+struct PopulationLog {
+  std::vector<int> step, n_boids, births, deaths, kills;
+
+  void clear() { step.clear(); n_boids.clear(); births.clear(); deaths.clear(); kills.clear(); }
+};
+
+// Births, deaths and kills of the boids of a world, and the bookkeeping of
+// their slots (ids, free list)
+struct Population {
+  PopulationParams par;
+  std::vector<std::int64_t> id;  // Id of the boid in each slot
+  std::vector<int> free_slots;   // Slots of dead boids, not yet reused or compacted away
+  std::vector<std::uint8_t> alive; // Per slot: 1 if the slot holds a living boid
+  std::int64_t next_id = 1;      // Id of the next boid born
+  int kills_this_year = 0;       // Kills since the last yearly record
+  PopulationLog log;             // One entry per year
+
+  // Start over with n living boids, ids 1 .. n
+  void reset(int n) {
+    id.resize(n);
+    for (int i = 0; i < n; i++) id[i] = i + 1;
+    alive.assign(n, 1);
+    free_slots.clear();
+    next_id = n + 1;
+    kills_this_year = 0;
+    log.clear();
+  }
+
+  bool active() const { return par.year_steps > 0 || par.kill_radius > 0; }
+
+  // Whether step(.., t, ..) can change the boids (kills, or the end of a year)
+  bool acts_at(std::uint64_t t) const {
+    return par.kill_radius > 0 || (par.year_steps > 0 && t % (std::uint64_t)par.year_steps == 0);
+  }
+
+  // Ids of the n boids, or null if they were never assigned (ids 1 .. n)
+  const std::int64_t* ids(int n) const { return (int)id.size() == n && n > 0 ? id.data() : nullptr; }
+
+  // Give the n boids ids 1 .. n unless they have theirs
+  void ensure_ids(int n) {
+    if ((int)id.size() != n) reset(n);
+  }
+
+  // Events after step `t` (kills, then births and deaths at the end of a
+  // year) in the domain [0, width] x [0, height] (periodic: a torus, where
+  // distances are those of the minimum images), leaving the columns of
+  // `boids` dense again. `grid`, if given, is a cell list of the boids built
+  // when they were up to `slack` from where they are now (the one of the
+  // boid step, see WorldState::step); the kills then search it.
+  template <class Swarm>
+  void step(Swarm& boids, const Swarm& predators, std::uint64_t seed, std::uint64_t t,
+            double width, double height, bool periodic = false,
+            const CellGrid* grid = nullptr, double slack = 0) {
+    if (!active()) return;
+    ensure_ids(boids.size());
+    EventStream rng(seed ^ 0xD1B54A32D192ED03ULL, t); // Not the perturbation or survey streams
+    if (par.kill_radius > 0) kill_near_predators(boids, predators, width, height, periodic, grid, slack);
+    if (par.year_steps > 0 && t % (std::uint64_t)par.year_steps == 0) year(boids, rng, t, width, height, periodic);
+    compact(boids);
+  }
+
+  void kill(int slot) {
+    alive[slot] = 0;
+    free_slots.push_back(slot);
+  }
+
+  // Add a boid (reusing a free slot if there is one); returns its slot
+  template <class Swarm>
+  int spawn(Swarm& boids, double x, double y, double vx, double vy) {
+    int slot;
+    if (!free_slots.empty()) {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      slot = boids.size();
+      boids.x.push_back(0); boids.y.push_back(0);
+      boids.vx.push_back(0); boids.vy.push_back(0);
+      id.push_back(0);
+      alive.push_back(0);
+    }
+    boids.x[slot] = x; boids.y[slot] = y;
+    boids.vx[slot] = vx; boids.vy[slot] = vy;
+    id[slot] = next_id++;
+    alive[slot] = 1;
+    return slot;
+  }
+
+  // Close the free slots, keeping the order of the living boids
+  template <class Swarm>
+  void compact(Swarm& boids) {
+    if (free_slots.empty()) return;
+    int n = boids.size(), out = 0;
+    for (int i = 0; i < n; i++) {
+      if (!alive[i]) continue;
+      if (out != i) {
+        boids.x[out] = boids.x[i]; boids.y[out] = boids.y[i];
+        boids.vx[out] = boids.vx[i]; boids.vy[out] = boids.vy[i];
+        id[out] = id[i];
+      }
+      out++;
+    }
+    boids.x.resize(out); boids.y.resize(out);
+    boids.vx.resize(out); boids.vy.resize(out);
+    id.resize(out);
+    alive.assign(out, 1);
+    free_slots.clear();
+  }
+
+private:
+  // Each predator kills the nearest living boid within kill_radius (ties:
+  // the lowest slot, as in a forward scan). On the grid the rings of cells
+  // around the predator are searched until the cells left are all beyond
+  // kill_radius or the boid found; otherwise every boid is scanned.
+  template <class Swarm>
+  void kill_near_predators(Swarm& boids, const Swarm& predators, double width, double height, bool periodic,
+                           const CellGrid* grid, double slack) {
+    double r2 = par.kill_radius * par.kill_radius;
+    for (int k = 0; k < predators.size(); k++) {
+      double qx = predators.x[k], qy = predators.y[k];
+      int victim = -1;
+      double best = r2;
+      auto consider = [&](int i) {
+        if (!alive[i]) return;
+        double dx = (double)boids.x[i] - qx, dy = (double)boids.y[i] - qy;
+        if (periodic) {
+          dx = min_image(dx, width);
+          dy = min_image(dy, height);
+        }
+        double d2 = dx * dx + dy * dy;
+        if (d2 < best || (d2 == best && victim >= 0 && i < victim)) { best = d2; victim = i; }
+      };
+      if (grid) {
+        grid->for_each_ring(qx, qy, slack, [&](int c) {
+          for (int s = grid->cell_start[c]; s < grid->cell_start[c + 1]; s++) consider(grid->items[s]);
+        }, [&](double reach) {
+          // Strictly farther (with a margin for the rounding of d2), so no tie is missed
+          return reach > 0 && best < reach * reach * (1 - 1e-4);
+        });
+      } else {
+        for (int i = 0; i < boids.size(); i++) consider(i);
+      }
+      if (victim >= 0) {
+        kill(victim);
+        kills_this_year++;
+      }
+    }
+  }
+
+  // Yearly births and deaths, both drawn from the population at the end of the year
+  template <class Swarm>
+  void year(Swarm& boids, EventStream& rng, std::uint64_t t, double width, double height, bool periodic) {
+    std::vector<int> living;
+    for (int i = 0; i < boids.size(); i++) if (alive[i]) living.push_back(i);
+    std::int64_t births, deaths;
+    draw_births_deaths(par, (double)living.size(), rng, births, deaths);
+    if (living.empty()) births = 0; // No parents
+
+    // Parents first (a parent may die this year too), then the deaths, then the births
+    std::vector<double> parent((std::size_t)births * 4);
+    for (std::int64_t b = 0; b < births; b++) {
+      int p = living[(std::size_t)(rng.uniform() * living.size())];
+      parent[4 * b] = boids.x[p]; parent[4 * b + 1] = boids.y[p];
+      parent[4 * b + 2] = boids.vx[p]; parent[4 * b + 3] = boids.vy[p];
+    }
+    for (std::int64_t d = 0; d < deaths; d++) { // Partial Fisher-Yates: distinct victims
+      std::size_t j = (std::size_t)d + (std::size_t)(rng.uniform() * (living.size() - d));
+      std::swap(living[d], living[j]);
+      kill(living[d]);
+    }
+    std::sort(free_slots.begin(), free_slots.end(), [](int a, int b) { return a > b; }); // Lowest slot reused first
+    for (std::int64_t b = 0; b < births; b++) { // Offspring kept inside the domain (wrapped on a torus)
+      double ox = parent[4 * b] + rng.normal() * par.birth_spread;
+      double oy = parent[4 * b + 1] + rng.normal() * par.birth_spread;
+      if (periodic) {
+        spawn(boids, wrap_coord(ox, width), wrap_coord(oy, height), parent[4 * b + 2], parent[4 * b + 3]);
+        continue;
+      }
+      spawn(boids, std::min(std::max(ox, 0.0), width), std::min(std::max(oy, 0.0), height),
+            parent[4 * b + 2], parent[4 * b + 3]);
+    }
+
+    int n_alive = 0;
+    for (std::uint8_t a : alive) n_alive += a;
+    log.step.push_back((int)t);
+    log.n_boids.push_back(n_alive);
+    log.births.push_back((int)births);
+    log.deaths.push_back((int)deaths);
+    log.kills.push_back(kills_this_year);
+    kills_this_year = 0;
+  }
+};
+
+#endif
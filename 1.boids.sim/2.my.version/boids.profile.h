@@ -0,0 +1,208 @@
+// Hot-path instrumentation of the boid world: per-phase timers and
+// neighbour-search counters. It is compiled in only when BOIDS_PROFILE is
+// defined to a non-zero value, e.g.
+//   Sys.setenv(PKG_CPPFLAGS = "-DBOIDS_PROFILE=1")
+//   Rcpp::sourceCpp("1.rebound.poor.areas.cpp", rebuild = TRUE)
+// Otherwise the hooks below are empty inline functions and the kernels
+// compile to the same code as before they had them.
+//
+// Per-boid phases last a few hundred nanoseconds, less than the cost of
+// reading steady_clock, so the timers read the time-stamp counter (rdtsc)
+// on x86 and steady_clock elsewhere. Ticks are turned into seconds with the
+// ratio of ticks to steady_clock time over the profiled spans (the
+// BoidWorld::step calls). Phases inside the threaded boid loop are summed
+// over the threads, so with n_threads > 1 they add up to more than the wall
+// time of the steps.
+#ifndef BOIDS_PROFILE_H
+#define BOIDS_PROFILE_H
+
+#ifndef BOIDS_PROFILE
+#define BOIDS_PROFILE 0
+#endif
+
+#include <algorithm> // For std::max
+#include <chrono>    // For std::chrono::steady_clock
+#include <cstdint>   // For std::uint64_t
+#include <vector>    // For std::vector
+#ifdef _OPENMP
+#include <omp.h>     // For omp_get_thread_num
+#endif
+#if BOIDS_PROFILE && defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h> // For __rdtsc
+#endif
+#include "boids.grid.h" // CellGrid (occupancy of the cells)
+
+// Phases of a world step, in the order they run
+enum ProfilePhase : int {
+  phase_setup,          // Start-of-step copies, cell list build and gather
+  phase_neighbours,     // Separation / alignment / cohesion sums
+  phase_predator_avoid, // Predator loop of each boid
+  phase_areas,          // p_area / r_area forces (loops or baked field)
+  phase_steering,       // Averages, limits, weights and speed limit
+  phase_rng,            // Perturbation draw
+  phase_move,           // Position update and wall rebound
+  phase_predator_step,  // Predator kernel
+  phase_population,     // Births, deaths and kills
+  phase_reorder,        // Space-filling curve reorder
+  phase_survey,         // Survey sampling
+  phase_flocks,         // Group detection
+  phase_output,         // Trajectory frames and animation frames
+  phase_marshal,        // Copying the state out to R DataFrames
+  n_profile_phases
+};
+
+inline const char* profile_phase_name(int p) {
+  static const char* names[n_profile_phases] = {
+    "setup", "neighbours", "predator_avoid", "areas", "steering", "rng", "move",
+    "predator_step", "population", "reorder", "survey", "flocks", "output", "marshal"
+  };
+  return names[p];
+}
+
+// Timer ticks: see above
+inline std::uint64_t profile_ticks() {
+#if BOIDS_PROFILE && defined(__x86_64__) && defined(__GNUC__)
+  return __rdtsc();
+#else
+  return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Index of the calling thread in its OpenMP team (0 outside one)
+inline int thread_index() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Counts of one thread, padded to a cache line so threads never share one
+struct alignas(64) ProfileLane {
+  std::uint64_t ticks[n_profile_phases] = {};
+  std::uint64_t calls[n_profile_phases] = {};
+  std::uint64_t pairs_tested = 0; // Candidate neighbours whose distance was computed
+  std::uint64_t pairs_within = 0; // Of those, closer than neighbor_radius
+};
+
+// Timers and counters of a world, summed over the profiled steps
+class StepProfile {
+public:
+  std::vector<ProfileLane> lanes = std::vector<ProfileLane>(1); // One per thread of the boid loop
+  std::uint64_t steps = 0;          // Steps profiled
+  std::uint64_t span_ticks = 0;     // Ticks and seconds of the profiled spans (tick calibration)
+  double span_seconds = 0;
+  std::uint64_t grid_builds = 0;    // Cell lists built for the neighbour search, and their..
+  std::uint64_t cells = 0;          // ..cells,
+  std::uint64_t occupied_cells = 0; // ..non-empty cells,
+  std::uint64_t binned = 0;         // ..boids binned,
+  double binned_sq = 0;             // ..sum over the cells of (boids in the cell)^2,
+  int max_cell = 0;                 // ..and the most boids in a cell
+
+  // Make room for the lanes of n_threads threads (before the loop runs)
+  void prepare(int n_threads) {
+#if BOIDS_PROFILE
+    if ((int)lanes.size() < n_threads) lanes.resize(n_threads);
+#else
+    (void)n_threads;
+#endif
+  }
+
+  ProfileLane* lane(int thread) {
+#if BOIDS_PROFILE
+    return &lanes[thread];
+#else
+    (void)thread;
+    return nullptr;
+#endif
+  }
+
+  // Occupancy of a freshly built cell list
+  void record_grid(const CellGrid& grid) {
+#if BOIDS_PROFILE
+    int n_cells = grid.nx * grid.ny;
+    grid_builds++;
+    cells += n_cells;
+    binned += grid.items.size();
+    for (int c = 0; c < n_cells; c++) {
+      int k = grid.cell_start[c + 1] - grid.cell_start[c];
+      if (k == 0) continue;
+      occupied_cells++;
+      binned_sq += (double)k * k;
+      max_cell = std::max(max_cell, k);
+    }
+#else
+    (void)grid;
+#endif
+  }
+
+  // All the lanes added up
+  ProfileLane total() const {
+    ProfileLane t;
+    for (const ProfileLane& l : lanes) {
+      for (int p = 0; p < n_profile_phases; p++) { t.ticks[p] += l.ticks[p]; t.calls[p] += l.calls[p]; }
+      t.pairs_tested += l.pairs_tested;
+      t.pairs_within += l.pairs_within;
+    }
+    return t;
+  }
+
+  double seconds_per_tick() const { return span_ticks > 0 ? span_seconds / span_ticks : 0.0; }
+
+  void clear() { *this = StepProfile(); }
+};
+
+// Charges the time between laps to phases of one lane (no lane: does nothing)
+class PhaseTimer {
+public:
+#if BOIDS_PROFILE
+  explicit PhaseTimer(ProfileLane* lane) : lane(lane), last(lane ? profile_ticks() : 0) {}
+
+  // The time since the last lap (or since construction) goes to phase p
+  void lap(ProfilePhase p) {
+    if (!lane) return;
+    std::uint64_t now = profile_ticks();
+    lane->ticks[p] += now - last;
+    lane->calls[p]++;
+    last = now;
+  }
+
+  void pairs(std::uint64_t tested, std::uint64_t within) {
+    if (!lane) return;
+    lane->pairs_tested += tested;
+    lane->pairs_within += within;
+  }
+
+private:
+  ProfileLane* lane;
+  std::uint64_t last;
+#else
+  explicit PhaseTimer(ProfileLane*) {}
+  void lap(ProfilePhase) {}
+  void pairs(std::uint64_t, std::uint64_t) {}
+#endif
+};
+
+// Times a whole span (e.g. a BoidWorld::step call) on both clocks, to
+// calibrate the ticks
+class ProfileSpan {
+public:
+#if BOIDS_PROFILE
+  explicit ProfileSpan(StepProfile& profile)
+    : profile(profile), ticks(profile_ticks()), start(std::chrono::steady_clock::now()) {}
+  ~ProfileSpan() {
+    profile.span_ticks += profile_ticks() - ticks;
+    profile.span_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+private:
+  StepProfile& profile;
+  std::uint64_t ticks;
+  std::chrono::steady_clock::time_point start;
+#else
+  explicit ProfileSpan(StepProfile&) {}
+#endif
+};
+
+#endif
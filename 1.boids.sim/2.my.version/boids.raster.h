@@ -0,0 +1,402 @@
+// Native frame rasteriser and animation writer.
+// Frames are splatted straight into an indexed-colour pixel buffer (one
+// byte per pixel into a fixed 256-colour palette): area zones as tinted
+// discs, boids as dots or as a density shading, predators and area centres
+// as larger dots, in the colours of the ggplot animation of the R driver.
+// Frames are encoded by a background thread, either into one animated GIF
+// or into a numbered sequence of PNG files (which e.g. ffmpeg turns into a
+// video); neither needs any library.
+#ifndef BOIDS_RASTER_H
+#define BOIDS_RASTER_H
+
+#include <algorithm> // For std::min, std::max, std::fill
+#include <cmath>     // For log1p, floor
+#include <condition_variable> // For the writer queue
+#include <cstdint>   // For fixed-width integers
+#include <cstdio>    // For FILE
+#include <deque>     // For the writer queue
+#include <mutex>     // For the writer queue
+#include <stdexcept> // For std::runtime_error
+#include <string>    // For file names
+#include <thread>    // For the writer thread
+#include <vector>    // For std::vector
+#include "boids.kernels.h" // SwarmView, AreaView
+
+// Palette indices. 16 .. 255 are the density ramp, light to dark blue.
+enum RasterColour : std::uint8_t {
+  colour_background = 0,
+  colour_boid = 1,
+  colour_predator = 2,
+  colour_p_area = 3,
+  colour_r_area = 4,
+  colour_p_area_zone = 5,
+  colour_r_area_zone = 6,
+  colour_density_first = 16
+};
+const int raster_density_levels = 256 - colour_density_first;
+
+// The 256-colour palette, as r, g, b bytes
+inline std::vector<std::uint8_t> raster_palette() {
+  std::vector<std::uint8_t> rgb(3 * 256, 255);
+  auto set = [&](int k, int r, int g, int b) {
+    rgb[3 * k] = (std::uint8_t)r; rgb[3 * k + 1] = (std::uint8_t)g; rgb[3 * k + 2] = (std::uint8_t)b;
+  };
+  set(colour_background, 255, 255, 255);
+  set(colour_boid, 0, 0, 255);          // "blue"
+  set(colour_predator, 255, 0, 0);      // "red"
+  set(colour_p_area, 0, 0, 0);          // "black"
+  set(colour_r_area, 0, 255, 0);        // "green"
+  set(colour_p_area_zone, 225, 225, 225);
+  set(colour_r_area_zone, 215, 245, 215);
+  for (int k = 0; k < raster_density_levels; k++) { // Linear from (198, 219, 239) to (8, 48, 107)
+    double t = (double)k / (raster_density_levels - 1);
+    set(colour_density_first + k, (int)(198 + t * (8 - 198)), (int)(219 + t * (48 - 219)),
+        (int)(239 + t * (107 - 239)));
+  }
+  return rgb;
+}
+
+// How frames are drawn
+struct RasterStyle {
+  int px_width = 600, px_height = 600; // Frame size in pixels
+  int boid_px = 1;          // Radius of a boid dot in pixels (0: a single pixel)
+  int predator_px = 4;      // Radius of predator and area-centre dots
+  bool area_zones = true;   // Tint the disc of each area
+  int density_cell_px = 0;  // > 0: shade boid density on cells of this many pixels instead of dots
+};
+
+// Pixel buffer of one frame, mapping the simulation domain [0, width] x
+// [0, height] onto the frame with y upwards (as coord_fixed does)
+class FrameRaster {
+public:
+  std::vector<std::uint8_t> pixels; // Row-major, top row first
+
+  FrameRaster(const RasterStyle& style, double width, double height)
+    : pixels((std::size_t)style.px_width * style.px_height, colour_background),
+      style(style), sx(style.px_width / width), sy(style.px_height / height) {}
+
+  template <class T>
+  void draw(const SwarmView<T>& b, const SwarmView<T>& p,
+            const AreaView<T>& pa, const AreaView<T>& ra) {
+    std::fill(pixels.begin(), pixels.end(), (std::uint8_t)colour_background);
+    if (style.area_zones) {
+      for (int k = 0; k < pa.n; k++) disc(pa.x[k], pa.y[k], pa.radius[k] * sx, colour_p_area_zone);
+      for (int k = 0; k < ra.n; k++) disc(ra.x[k], ra.y[k], ra.radius[k] * sx, colour_r_area_zone);
+    }
+    if (style.density_cell_px > 0) {
+      density(b);
+    } else {
+      for (int i = 0; i < b.n; i++) disc(b.x[i], b.y[i], style.boid_px, colour_boid);
+    }
+    for (int i = 0; i < p.n; i++) disc(p.x[i], p.y[i], style.predator_px, colour_predator);
+    for (int k = 0; k < pa.n; k++) disc(pa.x[k], pa.y[k], style.predator_px, colour_p_area);
+    for (int k = 0; k < ra.n; k++) disc(ra.x[k], ra.y[k], style.predator_px, colour_r_area);
+  }
+
+private:
+  RasterStyle style;
+  double sx, sy; // Pixels per unit of the domain
+
+  // Fill the disc of radius r pixels centred on domain point (x, y), clipped to the frame
+  void disc(double x, double y, double r, std::uint8_t colour) {
+    double cx = x * sx, cy = style.px_height - y * sy;
+    int x0 = std::max(0, (int)floor(cx - r)), x1 = std::min(style.px_width - 1, (int)floor(cx + r));
+    int y0 = std::max(0, (int)floor(cy - r)), y1 = std::min(style.px_height - 1, (int)floor(cy + r));
+    double r2 = (r + 0.5) * (r + 0.5); // Pixel centres within r + 1/2: a single pixel for r = 0
+    for (int py = y0; py <= y1; py++) {
+      double dy = py + 0.5 - cy;
+      std::uint8_t* row = pixels.data() + (std::size_t)py * style.px_width;
+      for (int px = x0; px <= x1; px++) {
+        double dx = px + 0.5 - cx;
+        if (dx * dx + dy * dy <= r2) row[px] = colour;
+      }
+    }
+  }
+
+  // Count the boids per cell and shade each non-empty cell on a log scale
+  template <class T>
+  void density(const SwarmView<T>& b) {
+    int c = style.density_cell_px;
+    int nx = (style.px_width + c - 1) / c, ny = (style.px_height + c - 1) / c;
+    std::vector<int> count((std::size_t)nx * ny, 0);
+    for (int i = 0; i < b.n; i++) {
+      int gx = (int)floor(b.x[i] * sx / c), gy = (int)floor((style.px_height - b.y[i] * sy) / c);
+      if (gx >= 0 && gx < nx && gy >= 0 && gy < ny) count[(std::size_t)gy * nx + gx]++;
+    }
+    int max_count = *std::max_element(count.begin(), count.end());
+    if (max_count == 0) return;
+    double scale = (raster_density_levels - 1) / log1p((double)max_count);
+    for (int py = 0; py < style.px_height; py++) {
+      std::uint8_t* row = pixels.data() + (std::size_t)py * style.px_width;
+      const int* cell = count.data() + (std::size_t)(py / c) * nx;
+      for (int px = 0; px < style.px_width; px++) {
+        int n = cell[px / c];
+        if (n > 0) row[px] = (std::uint8_t)(colour_density_first + (int)(log1p((double)n) * scale));
+      }
+    }
+  }
+};
+
+// --- GIF Encoding ---
+
+// LZW-compress indexed pixels (8-bit codes) into GIF data sub-blocks.
+// The code table is a 4096 x 256 child array (a code's child for each
+// next pixel value; 0: none, as no child can be code 0); it is reset with
+// a clear code when full, clearing only the entries that were set.
+inline void gif_lzw(const std::uint8_t* px, std::size_t n, std::vector<std::uint8_t>& out) {
+  const int min_bits = 8, clear_code = 256, end_code = 257;
+  std::vector<std::uint16_t> child(4096 * 256, 0);
+  std::vector<std::size_t> set; // Entries of `child` in use
+  set.reserve(4096);
+  std::vector<std::uint8_t> block; // Current sub-block (at most 255 bytes)
+  std::uint32_t acc = 0;
+  int n_acc = 0, bits = min_bits + 1, max_code = end_code;
+  auto put_byte = [&](std::uint8_t v) {
+    block.push_back(v);
+    if (block.size() == 255) {
+      out.push_back(255);
+      out.insert(out.end(), block.begin(), block.end());
+      block.clear();
+    }
+  };
+  auto put_code = [&](int code) {
+    acc |= (std::uint32_t)code << n_acc;
+    n_acc += bits;
+    while (n_acc >= 8) { put_byte((std::uint8_t)(acc & 0xFF)); acc >>= 8; n_acc -= 8; }
+  };
+  out.push_back((std::uint8_t)min_bits);
+  put_code(clear_code);
+  if (n > 0) {
+    int cur = px[0];
+    for (std::size_t i = 1; i < n; i++) {
+      std::size_t entry = (std::size_t)cur * 256 + px[i];
+      if (child[entry]) { cur = child[entry]; continue; }
+      put_code(cur);
+      child[entry] = (std::uint16_t)++max_code;
+      set.push_back(entry);
+      if (max_code >= (1 << bits)) bits++;
+      if (max_code == 4095) { // Table full: start over
+        put_code(clear_code);
+        for (std::size_t e : set) child[e] = 0;
+        set.clear();
+        bits = min_bits + 1;
+        max_code = end_code;
+      }
+      cur = px[i];
+    }
+    put_code(cur);
+  }
+  put_code(end_code);
+  if (n_acc > 0) put_byte((std::uint8_t)(acc & 0xFF));
+  if (!block.empty()) {
+    out.push_back((std::uint8_t)block.size());
+    out.insert(out.end(), block.begin(), block.end());
+  }
+  out.push_back(0); // Block terminator
+}
+
+inline void put_u16(std::vector<std::uint8_t>& out, int v) {
+  out.push_back((std::uint8_t)(v & 0xFF));
+  out.push_back((std::uint8_t)((v >> 8) & 0xFF));
+}
+
+// Header, global palette and looping extension of an animated GIF
+inline std::vector<std::uint8_t> gif_header(int w, int h) {
+  std::vector<std::uint8_t> out = {'G', 'I', 'F', '8', '9', 'a'};
+  put_u16(out, w);
+  put_u16(out, h);
+  out.push_back(0xF7); // Global colour table of 256 entries, 8 bits per primary
+  out.push_back(0);    // Background colour index
+  out.push_back(0);    // No aspect ratio
+  std::vector<std::uint8_t> rgb = raster_palette();
+  out.insert(out.end(), rgb.begin(), rgb.end());
+  const std::uint8_t loop[] = {0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                               3, 1, 0, 0, 0}; // Loop forever
+  out.insert(out.end(), loop, loop + sizeof(loop));
+  return out;
+}
+
+// One GIF frame (graphic control extension, image descriptor, LZW data)
+inline std::vector<std::uint8_t> gif_frame(const std::vector<std::uint8_t>& pixels, int w, int h,
+                                           int delay_cs) {
+  std::vector<std::uint8_t> out = {0x21, 0xF9, 4, 0};
+  put_u16(out, delay_cs);
+  out.push_back(0); // No transparent colour
+  out.push_back(0);
+  out.push_back(0x2C); // Image descriptor: full frame, global palette
+  put_u16(out, 0);
+  put_u16(out, 0);
+  put_u16(out, w);
+  put_u16(out, h);
+  out.push_back(0);
+  gif_lzw(pixels.data(), pixels.size(), out);
+  return out;
+}
+
+// --- PNG Encoding ---
+
+inline std::uint32_t png_crc(const std::uint8_t* p, std::size_t n, std::uint32_t crc = 0) {
+  static const std::vector<std::uint32_t> table = [] {
+    std::vector<std::uint32_t> t(256);
+    for (std::uint32_t k = 0; k < 256; k++) {
+      std::uint32_t c = k;
+      for (int b = 0; b < 8; b++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[k] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (std::size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Append a PNG chunk (length, type, data, CRC of type and data)
+inline void png_chunk(std::vector<std::uint8_t>& out, const char type[4],
+                      const std::vector<std::uint8_t>& data) {
+  std::uint32_t n = (std::uint32_t)data.size();
+  for (int s = 24; s >= 0; s -= 8) out.push_back((std::uint8_t)(n >> s));
+  std::size_t at = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  std::uint32_t crc = png_crc(out.data() + at, out.size() - at);
+  for (int s = 24; s >= 0; s -= 8) out.push_back((std::uint8_t)(crc >> s));
+}
+
+// Palette PNG of the frame. The image data is a zlib stream of stored
+// (uncompressed) deflate blocks: simple and fast, at the price of size.
+inline std::vector<std::uint8_t> png_image(const std::vector<std::uint8_t>& pixels, int w, int h) {
+  std::vector<std::uint8_t> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  std::vector<std::uint8_t> ihdr;
+  for (int v : {w, h}) for (int s = 24; s >= 0; s -= 8) ihdr.push_back((std::uint8_t)(v >> s));
+  ihdr.insert(ihdr.end(), {8, 3, 0, 0, 0}); // 8-bit palette indices, no interlace
+  png_chunk(out, "IHDR", ihdr);
+  png_chunk(out, "PLTE", raster_palette());
+
+  std::vector<std::uint8_t> raw; // Scanlines, each with filter type 0
+  raw.reserve((std::size_t)(w + 1) * h);
+  for (int y = 0; y < h; y++) {
+    raw.push_back(0);
+    raw.insert(raw.end(), pixels.begin() + (std::size_t)y * w, pixels.begin() + (std::size_t)(y + 1) * w);
+  }
+  std::vector<std::uint8_t> z = {0x78, 0x01};
+  std::size_t at = 0;
+  do {
+    std::size_t len = std::min<std::size_t>(65535, raw.size() - at);
+    z.push_back(at + len == raw.size() ? 1 : 0); // Final block flag, stored
+    z.push_back((std::uint8_t)(len & 0xFF));
+    z.push_back((std::uint8_t)(len >> 8));
+    z.push_back((std::uint8_t)(~len & 0xFF));
+    z.push_back((std::uint8_t)((~len >> 8) & 0xFF));
+    z.insert(z.end(), raw.begin() + at, raw.begin() + at + len);
+    at += len;
+  } while (at < raw.size());
+  std::uint32_t a = 1, b = 0; // Adler-32 of the raw data
+  for (std::uint8_t v : raw) { a = (a + v) % 65521; b = (b + a) % 65521; }
+  std::uint32_t adler = (b << 16) | a;
+  for (int s = 24; s >= 0; s -= 8) z.push_back((std::uint8_t)(adler >> s));
+  png_chunk(out, "IDAT", z);
+  png_chunk(out, "IEND", {});
+  return out;
+}
+
+// --- Animation Writer ---
+
+// Draws frames and hands them to a background thread that encodes and
+// writes them, with at most `max_pending` frames waiting (add() blocks
+// beyond that). A path ending in ".png" gives one file per frame, the
+// frame number inserted before the extension (boids_0001.png, ...); any
+// other path gives one animated GIF.
+class AnimationWriter {
+public:
+  AnimationWriter(const std::string& path, const RasterStyle& style, double width, double height,
+                  double delay_seconds, int max_pending = 8)
+    : path(path), raster(style, width, height), w(style.px_width), h(style.px_height),
+      delay_cs((int)(delay_seconds * 100 + 0.5)), max_pending(max_pending) {
+    png = path.size() > 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (!png) {
+      file = std::fopen(path.c_str(), "wb");
+      if (!file) throw std::runtime_error("cannot open animation file " + path);
+      std::vector<std::uint8_t> header = gif_header(w, h);
+      failed = std::fwrite(header.data(), 1, header.size(), file) != header.size();
+    }
+    worker = std::thread([this] { drain(); });
+  }
+
+  ~AnimationWriter() { close(); }
+
+  AnimationWriter(const AnimationWriter&) = delete;
+  AnimationWriter& operator=(const AnimationWriter&) = delete;
+
+  // Draw a frame and queue it for encoding
+  template <class T>
+  void add(const SwarmView<T>& b, const SwarmView<T>& p, const AreaView<T>& pa, const AreaView<T>& ra) {
+    raster.draw(b, p, pa, ra);
+    std::unique_lock<std::mutex> lock(mutex);
+    room.wait(lock, [this] { return (int)queue.size() < max_pending; });
+    queue.push_back(raster.pixels);
+    ready.notify_one();
+  }
+
+  // Encode the pending frames and finish the file; false if any write failed
+  bool close() {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+      }
+      ready.notify_one();
+      worker.join();
+    }
+    if (file) {
+      failed = std::fputc(0x3B, file) == EOF || failed; // GIF trailer
+      failed = (std::fclose(file) != 0) || failed;
+      file = nullptr;
+    }
+    return !failed;
+  }
+
+private:
+  std::string path;
+  FrameRaster raster;
+  int w, h, delay_cs;
+  int max_pending;
+  bool png = false;
+  int n_written = 0;
+  std::FILE* file = nullptr; // The GIF (PNG frames are files of their own)
+  bool failed = false;
+  bool closing = false;
+  std::deque<std::vector<std::uint8_t>> queue; // Frames waiting to be encoded
+  std::mutex mutex;
+  std::condition_variable ready, room;
+  std::thread worker;
+
+  // Writer thread: encode and write the frames in order until closed and drained
+  void drain() {
+    for (;;) {
+      std::vector<std::uint8_t> frame;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return closing || !queue.empty(); });
+        if (queue.empty()) return;
+        frame = std::move(queue.front());
+        queue.pop_front();
+      }
+      room.notify_one();
+      n_written++;
+      if (png) {
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%04d", n_written);
+        std::string name = path.substr(0, path.size() - 4) + number + ".png";
+        std::vector<std::uint8_t> bytes = png_image(frame, w, h);
+        std::FILE* f = std::fopen(name.c_str(), "wb");
+        if (!f || std::fwrite(bytes.data(), 1, bytes.size(), f) != bytes.size()) failed = true;
+        if (f && std::fclose(f) != 0) failed = true;
+      } else {
+        std::vector<std::uint8_t> bytes = gif_frame(frame, w, h, delay_cs);
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) failed = true;
+      }
+    }
+  }
+};
+
+#endif
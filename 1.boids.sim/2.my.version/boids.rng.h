@@ -0,0 +1,43 @@
+// Counter-based random numbers for the boid perturbation (Philox4x32-10,
+// Salmon et al. 2011, as in Random123).
+// A draw is a pure function of (seed, step, stream): each boid has its own
+// stream, so the noise a boid gets does not depend on which thread updates
+// it or in which order the boids are visited, and there is no shared state
+// to lock. One call gives 128 random bits, i.e. the two perturbation draws.
+#ifndef BOIDS_RNG_H
+#define BOIDS_RNG_H
+
+#include <cstdint> // For fixed-width integers
+
+// Philox4x32 with 10 rounds: encrypts the 128-bit counter `ctr` under the
+// 64-bit key `key` (both given as 32-bit words), in place
+inline void philox4x32_10(std::uint32_t ctr[4], std::uint32_t key0, std::uint32_t key1) {
+  const std::uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u; // Round multipliers
+  const std::uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u; // Key schedule (Weyl) increments
+  for (int r = 0; r < 10; r++) {
+    std::uint64_t p0 = (std::uint64_t)M0 * ctr[0];
+    std::uint64_t p1 = (std::uint64_t)M1 * ctr[2];
+    std::uint32_t c0 = (std::uint32_t)(p1 >> 32) ^ ctr[1] ^ key0;
+    std::uint32_t c2 = (std::uint32_t)(p0 >> 32) ^ ctr[3] ^ key1;
+    ctr[0] = c0;
+    ctr[1] = (std::uint32_t)p1;
+    ctr[2] = c2;
+    ctr[3] = (std::uint32_t)p0;
+    key0 += W0;
+    key1 += W1;
+  }
+}
+
+// Two uniform draws in [0, 1) for stream `stream` (e.g. the boid index) at
+// step `step` of the run with seed `seed`
+inline void uniform_pair(std::uint64_t seed, std::uint64_t step,
+                         std::uint64_t stream, double& u0, double& u1) {
+  std::uint32_t ctr[4] = {(std::uint32_t)stream, (std::uint32_t)(stream >> 32),
+                          (std::uint32_t)step, (std::uint32_t)(step >> 32)};
+  philox4x32_10(ctr, (std::uint32_t)seed, (std::uint32_t)(seed >> 32));
+  // Top 53 bits of each 64-bit half, scaled by 2^-53
+  u0 = ((((std::uint64_t)ctr[0] << 32) | ctr[1]) >> 11) * (1.0 / 9007199254740992.0);
+  u1 = ((((std::uint64_t)ctr[2] << 32) | ctr[3]) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif
@@ -0,0 +1,451 @@
+// SIMD kernels for the separation / alignment / cohesion sums.
+// A kernel scans a contiguous span of candidate neighbours stored as
+// structure of arrays (x, y, vx, vy) and accumulates, with a mask instead of
+// a branch, the terms of the candidates closer than the neighbour radius.
+//
+// Every kernel of a given precision uses the same lanes, one cache line of
+// them (8 doubles or 16 floats): candidate k of a span goes to lane
+// k % lanes, and the lanes are added up in a fixed order at the end. sqrt and
+// division are correctly rounded in every instruction set, so AVX-512, AVX2,
+// SSE2, NEON and the scalar fallback all give exactly the same sums.
+#ifndef BOIDS_SIMD_H
+#define BOIDS_SIMD_H
+
+#include <cmath>  // For sqrt
+#include <string> // For kernel names
+
+// GCC fuses a*b + c into an FMA wherever the target has one (AVX-512 does),
+// which changes the rounding; the kernels opt out so they stay identical
+#if defined(__GNUC__) && !defined(__clang__)
+#define BOIDS_NO_FMA __attribute__((optimize("fp-contract=off")))
+#else
+#define BOIDS_NO_FMA
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BOIDS_SIMD_X86 1
+#include <immintrin.h> // AVX-512, AVX2 and SSE2 intrinsics
+#elif defined(__aarch64__)
+#define BOIDS_SIMD_NEON 1
+#include <arm_neon.h>  // NEON intrinsics
+#endif
+
+// Lane-split neighbour sums of one boid, in precision T (double or float)
+template <class T>
+struct NeighbourSums {
+  static constexpr int lanes = 64 / sizeof(T); // One cache line (an AVX-512 register) per sum
+
+  alignas(64) T sep_x[lanes], sep_y[lanes]; // Sum of (dx, dy) / d
+  alignas(64) T ali_x[lanes], ali_y[lanes]; // Sum of neighbour velocities
+  alignas(64) T coh_x[lanes], coh_y[lanes]; // Sum of neighbour positions
+  int count;                                // Number of neighbours
+
+  void reset() {
+    for (int l = 0; l < lanes; l++) {
+      sep_x[l] = sep_y[l] = ali_x[l] = ali_y[l] = coh_x[l] = coh_y[l] = T(0);
+    }
+    count = 0;
+  }
+
+  // Fixed-order reduction of the lanes, as a pairwise tree:
+  // ((v[0] + v[1]) + (v[2] + v[3])) + ...
+  static T total(const T* v) {
+    T t[lanes];
+    for (int l = 0; l < lanes; l++) t[l] = v[l];
+    for (int w = lanes; w > 1; w /= 2) {
+      for (int l = 0; l < w / 2; l++) t[l] = t[2 * l] + t[2 * l + 1];
+    }
+    return t[0];
+  }
+};
+
+// Signature of a span kernel: candidates sx[0..n), sy, svx, svy around (xi, yi)
+template <class T>
+using SpanKernel = void (*)(const T* sx, const T* sy, const T* svx, const T* svy,
+                            int n, T xi, T yi, T r2, NeighbourSums<T>& acc);
+
+// Instruction set of the span kernels (off: plain per-pair loop, no kernel)
+enum class SimdLevel { off, scalar, sse2, avx2, avx512, neon };
+
+// Scalar kernel, also used for the tail of the vector kernels (from `k0` on)
+template <class T>
+BOIDS_NO_FMA
+inline void span_sums_tail(const T* sx, const T* sy, const T* svx, const T* svy,
+                           int k0, int n, T xi, T yi, T r2, NeighbourSums<T>& acc) {
+  for (int k = k0; k < n; k++) {
+    T dx = xi - sx[k];
+    T dy = yi - sy[k];
+    T d2 = dx*dx + dy*dy;
+    if (d2 < r2) {
+      int l = k & (NeighbourSums<T>::lanes - 1);
+      T d = std::sqrt(d2);
+      acc.sep_x[l] += dx / d;
+      acc.sep_y[l] += dy / d;
+      acc.ali_x[l] += svx[k];
+      acc.ali_y[l] += svy[k];
+      acc.coh_x[l] += sx[k];
+      acc.coh_y[l] += sy[k];
+      acc.count++;
+    }
+  }
+}
+
+template <class T>
+BOIDS_NO_FMA
+inline void span_sums_scalar(const T* sx, const T* sy, const T* svx, const T* svy,
+                             int n, T xi, T yi, T r2, NeighbourSums<T>& acc) {
+  span_sums_tail(sx, sy, svx, svy, 0, n, xi, yi, r2, acc);
+}
+
+#ifdef BOIDS_SIMD_X86
+
+// --- AVX-512: one 8-lane register per sum ---
+__attribute__((target("avx512f"))) BOIDS_NO_FMA
+inline void span_sums_avx512(const double* sx, const double* sy,
+                             const double* svx, const double* svy, int n,
+                             double xi, double yi, double r2, NeighbourSums<double>& acc) {
+  const __m512d vxi = _mm512_set1_pd(xi), vyi = _mm512_set1_pd(yi);
+  const __m512d vr2 = _mm512_set1_pd(r2);
+  __m512d sep_x = _mm512_load_pd(acc.sep_x), sep_y = _mm512_load_pd(acc.sep_y);
+  __m512d ali_x = _mm512_load_pd(acc.ali_x), ali_y = _mm512_load_pd(acc.ali_y);
+  __m512d coh_x = _mm512_load_pd(acc.coh_x), coh_y = _mm512_load_pd(acc.coh_y);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m512d cx = _mm512_loadu_pd(sx + k), cy = _mm512_loadu_pd(sy + k);
+    __m512d dx = _mm512_sub_pd(vxi, cx), dy = _mm512_sub_pd(vyi, cy);
+    __m512d d2 = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+    __mmask8 in = _mm512_cmp_pd_mask(d2, vr2, _CMP_LT_OQ);
+    if (!in) continue; // No neighbour among these 8 candidates
+    __m512d d = _mm512_sqrt_pd(d2);
+    sep_x = _mm512_mask_add_pd(sep_x, in, sep_x, _mm512_div_pd(dx, d));
+    sep_y = _mm512_mask_add_pd(sep_y, in, sep_y, _mm512_div_pd(dy, d));
+    ali_x = _mm512_mask_add_pd(ali_x, in, ali_x, _mm512_loadu_pd(svx + k));
+    ali_y = _mm512_mask_add_pd(ali_y, in, ali_y, _mm512_loadu_pd(svy + k));
+    coh_x = _mm512_mask_add_pd(coh_x, in, coh_x, cx);
+    coh_y = _mm512_mask_add_pd(coh_y, in, coh_y, cy);
+    acc.count += __builtin_popcount((unsigned)in);
+  }
+  _mm512_store_pd(acc.sep_x, sep_x); _mm512_store_pd(acc.sep_y, sep_y);
+  _mm512_store_pd(acc.ali_x, ali_x); _mm512_store_pd(acc.ali_y, ali_y);
+  _mm512_store_pd(acc.coh_x, coh_x); _mm512_store_pd(acc.coh_y, coh_y);
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- AVX-512, float: one 16-lane register per sum ---
+__attribute__((target("avx512f"))) BOIDS_NO_FMA
+inline void span_sums_avx512(const float* sx, const float* sy,
+                             const float* svx, const float* svy, int n,
+                             float xi, float yi, float r2, NeighbourSums<float>& acc) {
+  const __m512 vxi = _mm512_set1_ps(xi), vyi = _mm512_set1_ps(yi);
+  const __m512 vr2 = _mm512_set1_ps(r2);
+  __m512 sep_x = _mm512_load_ps(acc.sep_x), sep_y = _mm512_load_ps(acc.sep_y);
+  __m512 ali_x = _mm512_load_ps(acc.ali_x), ali_y = _mm512_load_ps(acc.ali_y);
+  __m512 coh_x = _mm512_load_ps(acc.coh_x), coh_y = _mm512_load_ps(acc.coh_y);
+  int k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512 cx = _mm512_loadu_ps(sx + k), cy = _mm512_loadu_ps(sy + k);
+    __m512 dx = _mm512_sub_ps(vxi, cx), dy = _mm512_sub_ps(vyi, cy);
+    __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+    __mmask16 in = _mm512_cmp_ps_mask(d2, vr2, _CMP_LT_OQ);
+    if (!in) continue; // No neighbour among these 16 candidates
+    __m512 d = _mm512_sqrt_ps(d2);
+    sep_x = _mm512_mask_add_ps(sep_x, in, sep_x, _mm512_div_ps(dx, d));
+    sep_y = _mm512_mask_add_ps(sep_y, in, sep_y, _mm512_div_ps(dy, d));
+    ali_x = _mm512_mask_add_ps(ali_x, in, ali_x, _mm512_loadu_ps(svx + k));
+    ali_y = _mm512_mask_add_ps(ali_y, in, ali_y, _mm512_loadu_ps(svy + k));
+    coh_x = _mm512_mask_add_ps(coh_x, in, coh_x, cx);
+    coh_y = _mm512_mask_add_ps(coh_y, in, coh_y, cy);
+    acc.count += __builtin_popcount((unsigned)in);
+  }
+  _mm512_store_ps(acc.sep_x, sep_x); _mm512_store_ps(acc.sep_y, sep_y);
+  _mm512_store_ps(acc.ali_x, ali_x); _mm512_store_ps(acc.ali_y, ali_y);
+  _mm512_store_ps(acc.coh_x, coh_x); _mm512_store_ps(acc.coh_y, coh_y);
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- AVX2: two 4-lane registers per sum (lanes 0-3 and 4-7) ---
+// Adds candidates k..k+3 to one half of the lanes; masked-out lanes add 0
+__attribute__((target("avx2"))) BOIDS_NO_FMA
+inline int avx2_quad(const double* sx, const double* sy,
+                     const double* svx, const double* svy, int k,
+                     __m256d vxi, __m256d vyi, __m256d vr2,
+                     __m256d& sep_x, __m256d& sep_y, __m256d& ali_x,
+                     __m256d& ali_y, __m256d& coh_x, __m256d& coh_y) {
+  __m256d cx = _mm256_loadu_pd(sx + k), cy = _mm256_loadu_pd(sy + k);
+  __m256d dx = _mm256_sub_pd(vxi, cx), dy = _mm256_sub_pd(vyi, cy);
+  __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+  __m256d in = _mm256_cmp_pd(d2, vr2, _CMP_LT_OQ);
+  int bits = _mm256_movemask_pd(in);
+  if (!bits) return 0;
+  __m256d d = _mm256_sqrt_pd(d2);
+  sep_x = _mm256_add_pd(sep_x, _mm256_and_pd(in, _mm256_div_pd(dx, d)));
+  sep_y = _mm256_add_pd(sep_y, _mm256_and_pd(in, _mm256_div_pd(dy, d)));
+  ali_x = _mm256_add_pd(ali_x, _mm256_and_pd(in, _mm256_loadu_pd(svx + k)));
+  ali_y = _mm256_add_pd(ali_y, _mm256_and_pd(in, _mm256_loadu_pd(svy + k)));
+  coh_x = _mm256_add_pd(coh_x, _mm256_and_pd(in, cx));
+  coh_y = _mm256_add_pd(coh_y, _mm256_and_pd(in, cy));
+  return __builtin_popcount((unsigned)bits);
+}
+
+__attribute__((target("avx2"))) BOIDS_NO_FMA
+inline void span_sums_avx2(const double* sx, const double* sy,
+                           const double* svx, const double* svy, int n,
+                           double xi, double yi, double r2, NeighbourSums<double>& acc) {
+  const __m256d vxi = _mm256_set1_pd(xi), vyi = _mm256_set1_pd(yi);
+  const __m256d vr2 = _mm256_set1_pd(r2);
+  __m256d sep_x0 = _mm256_load_pd(acc.sep_x), sep_x1 = _mm256_load_pd(acc.sep_x + 4);
+  __m256d sep_y0 = _mm256_load_pd(acc.sep_y), sep_y1 = _mm256_load_pd(acc.sep_y + 4);
+  __m256d ali_x0 = _mm256_load_pd(acc.ali_x), ali_x1 = _mm256_load_pd(acc.ali_x + 4);
+  __m256d ali_y0 = _mm256_load_pd(acc.ali_y), ali_y1 = _mm256_load_pd(acc.ali_y + 4);
+  __m256d coh_x0 = _mm256_load_pd(acc.coh_x), coh_x1 = _mm256_load_pd(acc.coh_x + 4);
+  __m256d coh_y0 = _mm256_load_pd(acc.coh_y), coh_y1 = _mm256_load_pd(acc.coh_y + 4);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    acc.count += avx2_quad(sx, sy, svx, svy, k, vxi, vyi, vr2,
+                           sep_x0, sep_y0, ali_x0, ali_y0, coh_x0, coh_y0);
+    acc.count += avx2_quad(sx, sy, svx, svy, k + 4, vxi, vyi, vr2,
+                           sep_x1, sep_y1, ali_x1, ali_y1, coh_x1, coh_y1);
+  }
+  _mm256_store_pd(acc.sep_x, sep_x0); _mm256_store_pd(acc.sep_x + 4, sep_x1);
+  _mm256_store_pd(acc.sep_y, sep_y0); _mm256_store_pd(acc.sep_y + 4, sep_y1);
+  _mm256_store_pd(acc.ali_x, ali_x0); _mm256_store_pd(acc.ali_x + 4, ali_x1);
+  _mm256_store_pd(acc.ali_y, ali_y0); _mm256_store_pd(acc.ali_y + 4, ali_y1);
+  _mm256_store_pd(acc.coh_x, coh_x0); _mm256_store_pd(acc.coh_x + 4, coh_x1);
+  _mm256_store_pd(acc.coh_y, coh_y0); _mm256_store_pd(acc.coh_y + 4, coh_y1);
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- AVX2, float: two 8-lane registers per sum (lanes 0-7 and 8-15) ---
+// Adds candidates k..k+7 to one half of the lanes; masked-out lanes add 0
+__attribute__((target("avx2"))) BOIDS_NO_FMA
+inline int avx2_oct(const float* sx, const float* sy,
+                    const float* svx, const float* svy, int k,
+                    __m256 vxi, __m256 vyi, __m256 vr2,
+                    __m256& sep_x, __m256& sep_y, __m256& ali_x,
+                    __m256& ali_y, __m256& coh_x, __m256& coh_y) {
+  __m256 cx = _mm256_loadu_ps(sx + k), cy = _mm256_loadu_ps(sy + k);
+  __m256 dx = _mm256_sub_ps(vxi, cx), dy = _mm256_sub_ps(vyi, cy);
+  __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+  __m256 in = _mm256_cmp_ps(d2, vr2, _CMP_LT_OQ);
+  int bits = _mm256_movemask_ps(in);
+  if (!bits) return 0;
+  __m256 d = _mm256_sqrt_ps(d2);
+  sep_x = _mm256_add_ps(sep_x, _mm256_and_ps(in, _mm256_div_ps(dx, d)));
+  sep_y = _mm256_add_ps(sep_y, _mm256_and_ps(in, _mm256_div_ps(dy, d)));
+  ali_x = _mm256_add_ps(ali_x, _mm256_and_ps(in, _mm256_loadu_ps(svx + k)));
+  ali_y = _mm256_add_ps(ali_y, _mm256_and_ps(in, _mm256_loadu_ps(svy + k)));
+  coh_x = _mm256_add_ps(coh_x, _mm256_and_ps(in, cx));
+  coh_y = _mm256_add_ps(coh_y, _mm256_and_ps(in, cy));
+  return __builtin_popcount((unsigned)bits);
+}
+
+__attribute__((target("avx2"))) BOIDS_NO_FMA
+inline void span_sums_avx2(const float* sx, const float* sy,
+                           const float* svx, const float* svy, int n,
+                           float xi, float yi, float r2, NeighbourSums<float>& acc) {
+  const __m256 vxi = _mm256_set1_ps(xi), vyi = _mm256_set1_ps(yi);
+  const __m256 vr2 = _mm256_set1_ps(r2);
+  __m256 sep_x0 = _mm256_load_ps(acc.sep_x), sep_x1 = _mm256_load_ps(acc.sep_x + 8);
+  __m256 sep_y0 = _mm256_load_ps(acc.sep_y), sep_y1 = _mm256_load_ps(acc.sep_y + 8);
+  __m256 ali_x0 = _mm256_load_ps(acc.ali_x), ali_x1 = _mm256_load_ps(acc.ali_x + 8);
+  __m256 ali_y0 = _mm256_load_ps(acc.ali_y), ali_y1 = _mm256_load_ps(acc.ali_y + 8);
+  __m256 coh_x0 = _mm256_load_ps(acc.coh_x), coh_x1 = _mm256_load_ps(acc.coh_x + 8);
+  __m256 coh_y0 = _mm256_load_ps(acc.coh_y), coh_y1 = _mm256_load_ps(acc.coh_y + 8);
+  int k = 0;
+  for (; k + 16 <= n; k += 16) {
+    acc.count += avx2_oct(sx, sy, svx, svy, k, vxi, vyi, vr2,
+                          sep_x0, sep_y0, ali_x0, ali_y0, coh_x0, coh_y0);
+    acc.count += avx2_oct(sx, sy, svx, svy, k + 8, vxi, vyi, vr2,
+                          sep_x1, sep_y1, ali_x1, ali_y1, coh_x1, coh_y1);
+  }
+  _mm256_store_ps(acc.sep_x, sep_x0); _mm256_store_ps(acc.sep_x + 8, sep_x1);
+  _mm256_store_ps(acc.sep_y, sep_y0); _mm256_store_ps(acc.sep_y + 8, sep_y1);
+  _mm256_store_ps(acc.ali_x, ali_x0); _mm256_store_ps(acc.ali_x + 8, ali_x1);
+  _mm256_store_ps(acc.ali_y, ali_y0); _mm256_store_ps(acc.ali_y + 8, ali_y1);
+  _mm256_store_ps(acc.coh_x, coh_x0); _mm256_store_ps(acc.coh_x + 8, coh_x1);
+  _mm256_store_ps(acc.coh_y, coh_y0); _mm256_store_ps(acc.coh_y + 8, coh_y1);
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- SSE2 (always available on x86-64): 2-lane registers, lanes kept in acc ---
+BOIDS_NO_FMA
+inline void span_sums_sse2(const double* sx, const double* sy,
+                           const double* svx, const double* svy, int n,
+                           double xi, double yi, double r2, NeighbourSums<double>& acc) {
+  const __m128d vxi = _mm_set1_pd(xi), vyi = _mm_set1_pd(yi);
+  const __m128d vr2 = _mm_set1_pd(r2);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    for (int h = 0; h < 8; h += 2) { // Lanes h, h + 1
+      __m128d cx = _mm_loadu_pd(sx + k + h), cy = _mm_loadu_pd(sy + k + h);
+      __m128d dx = _mm_sub_pd(vxi, cx), dy = _mm_sub_pd(vyi, cy);
+      __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+      __m128d in = _mm_cmplt_pd(d2, vr2);
+      int bits = _mm_movemask_pd(in);
+      if (!bits) continue;
+      __m128d d = _mm_sqrt_pd(d2);
+      _mm_store_pd(acc.sep_x + h, _mm_add_pd(_mm_load_pd(acc.sep_x + h), _mm_and_pd(in, _mm_div_pd(dx, d))));
+      _mm_store_pd(acc.sep_y + h, _mm_add_pd(_mm_load_pd(acc.sep_y + h), _mm_and_pd(in, _mm_div_pd(dy, d))));
+      _mm_store_pd(acc.ali_x + h, _mm_add_pd(_mm_load_pd(acc.ali_x + h), _mm_and_pd(in, _mm_loadu_pd(svx + k + h))));
+      _mm_store_pd(acc.ali_y + h, _mm_add_pd(_mm_load_pd(acc.ali_y + h), _mm_and_pd(in, _mm_loadu_pd(svy + k + h))));
+      _mm_store_pd(acc.coh_x + h, _mm_add_pd(_mm_load_pd(acc.coh_x + h), _mm_and_pd(in, cx)));
+      _mm_store_pd(acc.coh_y + h, _mm_add_pd(_mm_load_pd(acc.coh_y + h), _mm_and_pd(in, cy)));
+      acc.count += (bits & 1) + (bits >> 1);
+    }
+  }
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- SSE2, float: 4-lane registers, lanes kept in acc ---
+BOIDS_NO_FMA
+inline void span_sums_sse2(const float* sx, const float* sy,
+                           const float* svx, const float* svy, int n,
+                           float xi, float yi, float r2, NeighbourSums<float>& acc) {
+  const __m128 vxi = _mm_set1_ps(xi), vyi = _mm_set1_ps(yi);
+  const __m128 vr2 = _mm_set1_ps(r2);
+  int k = 0;
+  for (; k + 16 <= n; k += 16) {
+    for (int h = 0; h < 16; h += 4) { // Lanes h .. h + 3
+      __m128 cx = _mm_loadu_ps(sx + k + h), cy = _mm_loadu_ps(sy + k + h);
+      __m128 dx = _mm_sub_ps(vxi, cx), dy = _mm_sub_ps(vyi, cy);
+      __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+      __m128 in = _mm_cmplt_ps(d2, vr2);
+      int bits = _mm_movemask_ps(in);
+      if (!bits) continue;
+      __m128 d = _mm_sqrt_ps(d2);
+      _mm_store_ps(acc.sep_x + h, _mm_add_ps(_mm_load_ps(acc.sep_x + h), _mm_and_ps(in, _mm_div_ps(dx, d))));
+      _mm_store_ps(acc.sep_y + h, _mm_add_ps(_mm_load_ps(acc.sep_y + h), _mm_and_ps(in, _mm_div_ps(dy, d))));
+      _mm_store_ps(acc.ali_x + h, _mm_add_ps(_mm_load_ps(acc.ali_x + h), _mm_and_ps(in, _mm_loadu_ps(svx + k + h))));
+      _mm_store_ps(acc.ali_y + h, _mm_add_ps(_mm_load_ps(acc.ali_y + h), _mm_and_ps(in, _mm_loadu_ps(svy + k + h))));
+      _mm_store_ps(acc.coh_x + h, _mm_add_ps(_mm_load_ps(acc.coh_x + h), _mm_and_ps(in, cx)));
+      _mm_store_ps(acc.coh_y + h, _mm_add_ps(_mm_load_ps(acc.coh_y + h), _mm_and_ps(in, cy)));
+      acc.count += __builtin_popcount((unsigned)bits);
+    }
+  }
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+#endif // BOIDS_SIMD_X86
+
+#ifdef BOIDS_SIMD_NEON
+
+// --- NEON (always available on AArch64): 2-lane registers, lanes kept in acc ---
+BOIDS_NO_FMA
+inline void span_sums_neon(const double* sx, const double* sy,
+                           const double* svx, const double* svy, int n,
+                           double xi, double yi, double r2, NeighbourSums<double>& acc) {
+  const float64x2_t vxi = vdupq_n_f64(xi), vyi = vdupq_n_f64(yi);
+  const float64x2_t vr2 = vdupq_n_f64(r2);
+  const float64x2_t zero = vdupq_n_f64(0.0);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    for (int h = 0; h < 8; h += 2) { // Lanes h, h + 1
+      float64x2_t cx = vld1q_f64(sx + k + h), cy = vld1q_f64(sy + k + h);
+      float64x2_t dx = vsubq_f64(vxi, cx), dy = vsubq_f64(vyi, cy);
+      float64x2_t d2 = vaddq_f64(vmulq_f64(dx, dx), vmulq_f64(dy, dy));
+      uint64x2_t in = vcltq_f64(d2, vr2);
+      int hits = (int)(vgetq_lane_u64(in, 0) & 1) + (int)(vgetq_lane_u64(in, 1) & 1);
+      if (!hits) continue;
+      float64x2_t d = vsqrtq_f64(d2);
+      vst1q_f64(acc.sep_x + h, vaddq_f64(vld1q_f64(acc.sep_x + h), vbslq_f64(in, vdivq_f64(dx, d), zero)));
+      vst1q_f64(acc.sep_y + h, vaddq_f64(vld1q_f64(acc.sep_y + h), vbslq_f64(in, vdivq_f64(dy, d), zero)));
+      vst1q_f64(acc.ali_x + h, vaddq_f64(vld1q_f64(acc.ali_x + h), vbslq_f64(in, vld1q_f64(svx + k + h), zero)));
+      vst1q_f64(acc.ali_y + h, vaddq_f64(vld1q_f64(acc.ali_y + h), vbslq_f64(in, vld1q_f64(svy + k + h), zero)));
+      vst1q_f64(acc.coh_x + h, vaddq_f64(vld1q_f64(acc.coh_x + h), vbslq_f64(in, cx, zero)));
+      vst1q_f64(acc.coh_y + h, vaddq_f64(vld1q_f64(acc.coh_y + h), vbslq_f64(in, cy, zero)));
+      acc.count += hits;
+    }
+  }
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+// --- NEON, float: 4-lane registers, lanes kept in acc ---
+BOIDS_NO_FMA
+inline void span_sums_neon(const float* sx, const float* sy,
+                           const float* svx, const float* svy, int n,
+                           float xi, float yi, float r2, NeighbourSums<float>& acc) {
+  const float32x4_t vxi = vdupq_n_f32(xi), vyi = vdupq_n_f32(yi);
+  const float32x4_t vr2 = vdupq_n_f32(r2);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  int k = 0;
+  for (; k + 16 <= n; k += 16) {
+    for (int h = 0; h < 16; h += 4) { // Lanes h .. h + 3
+      float32x4_t cx = vld1q_f32(sx + k + h), cy = vld1q_f32(sy + k + h);
+      float32x4_t dx = vsubq_f32(vxi, cx), dy = vsubq_f32(vyi, cy);
+      float32x4_t d2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+      uint32x4_t in = vcltq_f32(d2, vr2);
+      int hits = (int)vaddvq_u32(vshrq_n_u32(in, 31));
+      if (!hits) continue;
+      float32x4_t d = vsqrtq_f32(d2);
+      vst1q_f32(acc.sep_x + h, vaddq_f32(vld1q_f32(acc.sep_x + h), vbslq_f32(in, vdivq_f32(dx, d), zero)));
+      vst1q_f32(acc.sep_y + h, vaddq_f32(vld1q_f32(acc.sep_y + h), vbslq_f32(in, vdivq_f32(dy, d), zero)));
+      vst1q_f32(acc.ali_x + h, vaddq_f32(vld1q_f32(acc.ali_x + h), vbslq_f32(in, vld1q_f32(svx + k + h), zero)));
+      vst1q_f32(acc.ali_y + h, vaddq_f32(vld1q_f32(acc.ali_y + h), vbslq_f32(in, vld1q_f32(svy + k + h), zero)));
+      vst1q_f32(acc.coh_x + h, vaddq_f32(vld1q_f32(acc.coh_x + h), vbslq_f32(in, cx, zero)));
+      vst1q_f32(acc.coh_y + h, vaddq_f32(vld1q_f32(acc.coh_y + h), vbslq_f32(in, cy, zero)));
+      acc.count += hits;
+    }
+  }
+  span_sums_tail(sx, sy, svx, svy, k, n, xi, yi, r2, acc);
+}
+
+#endif // BOIDS_SIMD_NEON
+
+// Instruction set by name: "off" disables the kernels, "auto" picks the
+// widest instruction set this CPU supports (checked at run time);
+// "avx512", "avx2", "sse2", "neon" and "scalar" force one. Returns false if
+// the name is unknown or the instruction set is not available.
+inline bool simd_level_from_name(const std::string& name, SimdLevel& level) {
+  if (name == "off") { level = SimdLevel::off; return true; }
+  if (name == "scalar") { level = SimdLevel::scalar; return true; }
+#ifdef BOIDS_SIMD_X86
+  __builtin_cpu_init();
+  bool has_avx512 = __builtin_cpu_supports("avx512f");
+  bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (name == "avx512" && has_avx512) { level = SimdLevel::avx512; return true; }
+  if (name == "avx2" && has_avx2) { level = SimdLevel::avx2; return true; }
+  if (name == "sse2") { level = SimdLevel::sse2; return true; }
+  if (name == "auto") {
+    level = has_avx512 ? SimdLevel::avx512 : has_avx2 ? SimdLevel::avx2 : SimdLevel::sse2;
+    return true;
+  }
+#elif defined(BOIDS_SIMD_NEON)
+  if (name == "neon" || name == "auto") { level = SimdLevel::neon; return true; }
+#else
+  if (name == "auto") { level = SimdLevel::scalar; return true; }
+#endif
+  return false;
+}
+
+// Name of an instruction set, as accepted by simd_level_from_name
+inline const char* simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::scalar: return "scalar";
+    case SimdLevel::sse2: return "sse2";
+    case SimdLevel::avx2: return "avx2";
+    case SimdLevel::avx512: return "avx512";
+    case SimdLevel::neon: return "neon";
+    default: return "off";
+  }
+}
+
+// Span kernel of an instruction set in precision T (nullptr for off).
+// The vector kernels are overloaded on the precision; the target type
+// picks the double or the float one.
+template <class T>
+inline SpanKernel<T> select_span_kernel(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::scalar: return span_sums_scalar<T>;
+#ifdef BOIDS_SIMD_X86
+    case SimdLevel::sse2: return span_sums_sse2;
+    case SimdLevel::avx2: return span_sums_avx2;
+    case SimdLevel::avx512: return span_sums_avx512;
+#endif
+#ifdef BOIDS_SIMD_NEON
+    case SimdLevel::neon: return span_sums_neon;
+#endif
+    default: return nullptr;
+  }
+}
+
+#endif
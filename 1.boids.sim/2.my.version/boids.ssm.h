@@ -0,0 +1,163 @@
+// State-space model of a yearly abundance index, and a bootstrap particle
+// filter estimating its likelihood.
+// Process: the sigmoid birth-death model of the world (boids.population.h),
+//   N[t+1] = N[t] + births - deaths, drawn by draw_births_deaths,
+// with N[0] uniform on [n0_min, n0_max] (by default K / 10 .. K, as in the
+// sandbox). Observation: the index of year t (e.g. the summed survey counts
+// of a world surveyed once a year, see boids.survey.h) is Poisson with mean
+// catchability * N[t], or negative binomial of size obs_size around it.
+// A missing index (NaN) adds nothing to the likelihood.
+//
+// The particles are held as columns (abundance, log weight), so the weight
+// update is one pass of plain arithmetic over contiguous arrays (the
+// lgamma terms depend only on the index and are taken once per year).
+// Particle i of year t draws from its own counter-based stream
+// (seed, t, i), so the estimate does not depend on the number of threads,
+// and filters given the same seed see the same random numbers whatever the
+// parameters (common random numbers: likelihood surfaces are smooth in the
+// parameters for a fixed seed). The particles are resampled (systematic
+// resampling) when their effective number falls below
+// resample_ess * n_particles.
+#ifndef BOIDS_SSM_H
+#define BOIDS_SSM_H
+
+#include <algorithm> // For std::max
+#include <cmath>     // For exp, log, floor, lgamma, std::isnan, INFINITY
+#include <cstdint>   // For fixed-width integers
+#include <vector>    // For std::vector
+#ifdef _OPENMP
+#include <omp.h>     // For the threaded particle loop
+#endif
+#include "boids.aligned.h"    // Cache-line aligned buffers
+#include "boids.population.h" // Process model, EventStream
+
+// Parameters of the state-space model
+struct SsmParams {
+  PopulationParams process;   // Births and deaths (year_steps, birth_spread and kill_radius unused)
+  double catchability = 1;    // Expected index per individual
+  double obs_size = 0;        // Negative binomial size of the index (0: Poisson)
+  double n0_min = 0, n0_max = 0; // Range of the first year's abundance (both 0: K / 10 .. K)
+
+  // Carrying capacity of the process, K = (b - d) / (d * ld - b * lb)
+  double carrying_capacity() const {
+    const PopulationParams& p = process;
+    return (p.base_growth - p.base_death) /
+      (p.base_death * p.linear_impact_death - p.base_growth * p.linear_impact_growth);
+  }
+};
+
+// Bootstrap particle filter; its buffers are kept across calls, so one
+// filter per thread runs any number of fits without allocating
+class ParticleFilter {
+public:
+  // Log-likelihood of the index y[0 .. n_years) under `par`, estimated with
+  // n_particles particles drawn from the streams of `seed`; -INFINITY if no
+  // particle can explain an index. With `filtered`, the filtered mean
+  // abundance of each year is written to filtered[0 .. n_years).
+  double log_likelihood(const SsmParams& par, const double* y, int n_years, int n_particles,
+                        std::uint64_t seed, double resample_ess = 0.5, int n_threads = 1,
+                        double* filtered = nullptr) {
+    int np = n_particles;
+    n.resize(np);
+    log_w.resize(np);
+    (void)n_threads; // Unused when compiled without OpenMP
+    double n0_min = par.n0_min, n0_max = par.n0_max;
+    if (n0_min == 0 && n0_max == 0) {
+      n0_max = par.carrying_capacity();
+      n0_min = n0_max / 10;
+    }
+    double loglik = 0;
+
+    for (int t = 0; t < n_years; t++) {
+      // --- 1. Draw the abundance of year t (the prior in the first year) ---
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static) if(n_threads > 1)
+#endif
+      for (int i = 0; i < np; i++) {
+        EventStream rng(seed, ((std::uint64_t)t << 32) | (std::uint32_t)i);
+        if (t == 0) {
+          n[i] = std::floor(n0_min + rng.uniform() * (n0_max - n0_min) + 0.5);
+          log_w[i] = -std::log((double)np);
+        } else {
+          std::int64_t births, deaths;
+          draw_births_deaths(par.process, n[i], rng, births, deaths);
+          n[i] += (double)(births - deaths);
+        }
+      }
+
+      // --- 2. Weight by the index of year t ---
+      if (!std::isnan(y[t])) {
+        double gain = observe(par, y[t]);
+        if (gain == -INFINITY) return -INFINITY; // No particle explains y[t]
+        loglik += gain;
+      }
+      if (filtered) {
+        double mean = 0;
+        for (int i = 0; i < np; i++) mean += std::exp(log_w[i]) * n[i];
+        filtered[t] = mean;
+      }
+
+      // --- 3. Resample when the weights have degenerated ---
+      double sum_w2 = 0;
+      for (int i = 0; i < np; i++) sum_w2 += std::exp(2 * log_w[i]);
+      if (t + 1 < n_years && 1 / sum_w2 < resample_ess * np) resample(seed, t);
+    }
+    return loglik;
+  }
+
+private:
+  AlignedBuffer<double> n, log_w; // Abundance and normalised log weight of each particle
+  AlignedBuffer<double> n_new;    // Resampled abundances
+  AlignedBuffer<double> log_g;    // Log density of the index given each particle
+
+  // Multiply the weights by the density of index y and renormalise them;
+  // returns the log of the normalising constant (the likelihood gain)
+  double observe(const SsmParams& par, double yt) {
+    int np = (int)n.size();
+    log_g.resize(np);
+    double q = par.catchability, k = par.obs_size;
+    double* g = log_g.data();
+    const double* ni = n.data();
+    if (k > 0) { // Negative binomial: lgamma(y + k) - lgamma(k) - lgamma(y + 1) + k log(k / (k + mu)) + y log(mu / (k + mu))
+      double c = std::lgamma(yt + k) - std::lgamma(k) - std::lgamma(yt + 1) + k * std::log(k);
+      for (int i = 0; i < np; i++) {
+        double mu = q * ni[i];
+        g[i] = mu > 0 ? c + yt * std::log(mu) - (k + yt) * std::log(k + mu) : (yt == 0 ? 0.0 : -INFINITY);
+      }
+    } else { // Poisson: y log(mu) - mu - lgamma(y + 1)
+      double c = -std::lgamma(yt + 1);
+      for (int i = 0; i < np; i++) {
+        double mu = q * ni[i];
+        g[i] = mu > 0 ? c + yt * std::log(mu) - mu : (yt == 0 ? 0.0 : -INFINITY);
+      }
+    }
+    double top = -INFINITY;
+    for (int i = 0; i < np; i++) top = std::max(top, log_w[i] + g[i]);
+    if (top == -INFINITY) return -INFINITY;
+    double sum = 0;
+    for (int i = 0; i < np; i++) sum += std::exp(log_w[i] + g[i] - top);
+    double gain = top + std::log(sum);
+    for (int i = 0; i < np; i++) log_w[i] += g[i] - gain;
+    return gain;
+  }
+
+  // Systematic resampling after year t: one uniform offset, then particle i
+  // is copied once per point (u + m) / np that falls in its slice of the weights
+  void resample(std::uint64_t seed, int t) {
+    int np = (int)n.size();
+    EventStream rng(seed, ((std::uint64_t)t << 32) | 0xFFFFFFFFu); // Not a particle stream
+    double u = rng.uniform();
+    n_new.resize(np);
+    double cumulative = 0;
+    int m = 0;
+    for (int i = 0; i < np && m < np; i++) {
+      cumulative += std::exp(log_w[i]) * np;
+      while (m < np && m + u < cumulative) n_new[m++] = n[i];
+    }
+    for (; m < np; m++) n_new[m] = n[np - 1]; // Rounding at the end of the sum
+    n.swap(n_new);
+    for (int i = 0; i < np; i++) log_w[i] = -std::log((double)np);
+  }
+};
+
+#endif
@@ -0,0 +1,132 @@
+// Survey sampler: abundance indices accumulated during the run.
+// Sites (quadrats, point counts, line transects) are defined once; every
+// sampled step, the boids each site detects are counted in C++, so a run
+// returns a steps x sites count matrix rather than full trajectories.
+// On a periodic domain the sites wrap around its edges like the boids: a
+// site near an edge also counts the boids across the seam.
+#ifndef BOIDS_SURVEY_H
+#define BOIDS_SURVEY_H
+
+#include <cmath>   // For sqrt, exp
+#include <cstdint> // For std::uint64_t
+#include <vector>  // For std::vector
+#include "boids.grid.h"    // AreaGrid, reused as the index of the sites
+#include "boids.kernels.h" // SwarmView
+#include "boids.rng.h"     // Counter-based random numbers for the detections
+
+// Survey sites, one entry per site in each column
+struct SurveySites {
+  enum Kind { quadrat, point, transect };
+
+  std::vector<int> kind;       // Kind of each site
+  std::vector<double> x, y;    // Quadrat: lower-left corner; point: centre; transect: start
+  std::vector<double> x2, y2;  // Quadrat: upper-right corner; transect: end (unused for points)
+  std::vector<double> radius;  // Point: count radius; transect: half-width of the strip
+  std::vector<double> sigma;   // Half-normal detection scale (0: every boid in the site is seen)
+  AreaGrid index;              // Sites by cell, from their bounding discs
+
+  int size() const { return (int)kind.size(); }
+
+  void add(int k, double px, double py, double px2, double py2, double r, double s) {
+    kind.push_back(k);
+    x.push_back(px); y.push_back(py);
+    x2.push_back(px2); y2.push_back(py2);
+    radius.push_back(r); sigma.push_back(s);
+  }
+
+  // Index the sites over the simulation domain (after the last add);
+  // periodic: the torus [0, width) x [0, height)
+  void build_index(double width, double height, bool periodic = false) {
+    std::vector<double> cx(size()), cy(size()), cr(size());
+    for (int s = 0; s < size(); s++) {
+      if (kind[s] == point) {
+        cx[s] = x[s]; cy[s] = y[s]; cr[s] = radius[s];
+      } else { // Disc around the rectangle or the strip
+        double hx = (x2[s] - x[s]) / 2, hy = (y2[s] - y[s]) / 2;
+        cx[s] = x[s] + hx; cy[s] = y[s] + hy;
+        cr[s] = sqrt(hx * hx + hy * hy) + (kind[s] == transect ? radius[s] : 0.0);
+      }
+    }
+    index.build(cx.data(), cy.data(), cr.data(), size(), width, height, periodic);
+  }
+
+  // Fit the index to the simulation domain if it was built for another one
+  void set_domain(double width, double height, bool periodic = false) {
+    if (width == index.width && height == index.height && periodic == index.periodic) return;
+    build_index(width, height, periodic);
+  }
+
+  // Distance from (px, py) to the reference of site s (0 inside a quadrat,
+  // to the centre of a point, to the line of a transect), or -1 if the
+  // point is outside the site. On a periodic index the point is taken at
+  // its image nearest to the site (for a quadrat: its first image past the
+  // lower-left corner, so quadrats may run past the far edges).
+  double distance(int s, double px, double py) const {
+    if (kind[s] == quadrat) {
+      if (index.periodic) {
+        px = x[s] + wrap_coord(px - x[s], index.width);
+        py = y[s] + wrap_coord(py - y[s], index.height);
+      }
+      return (px >= x[s] && px <= x2[s] && py >= y[s] && py <= y2[s]) ? 0.0 : -1.0;
+    }
+    double dx = px - x[s], dy = py - y[s];
+    if (index.periodic) {
+      dx = min_image(dx, index.width);
+      dy = min_image(dy, index.height);
+    }
+    if (kind[s] == transect) { // Closest point of the segment (strip with rounded ends)
+      double lx = x2[s] - x[s], ly = y2[s] - y[s];
+      double l2 = lx * lx + ly * ly;
+      double t = l2 > 0 ? std::max(0.0, std::min(1.0, (dx * lx + dy * ly) / l2)) : 0.0;
+      dx -= t * lx; dy -= t * ly;
+    }
+    double d2 = dx * dx + dy * dy;
+    return d2 <= radius[s] * radius[s] ? sqrt(d2) : -1.0;
+  }
+};
+
+// Counts of a survey: one row of site counts per sampled step
+struct SurveyCounts {
+  int n_sites = 0;
+  std::vector<int> step;   // Sampled steps
+  std::vector<int> counts; // Row-major: counts[r * n_sites + s] for step[r], site s
+
+  void clear(int sites) {
+    n_sites = sites;
+    step.clear();
+    counts.clear();
+  }
+
+  // Count the boids detected by each site at step `t`. With sigma > 0 a
+  // boid at distance d is detected with probability exp(-d^2 / (2 sigma^2)),
+  // drawn from its own counter-based stream (seed, t, site, boid), so the
+  // counts do not depend on the order of the boids or the number of threads.
+  // The boid of stream k is the one with id k + 1 (ids count from 1, as in
+  // Population and DistributedWorld), or without `id` the boid in slot k;
+  // the two agree until the boids are reordered or compacted.
+  template <class T>
+  void record(const SurveySites& sites, const SwarmView<T>& b,
+              std::uint64_t seed, std::uint64_t t, const std::int64_t* id = nullptr) {
+    step.push_back((int)t);
+    counts.resize(counts.size() + n_sites, 0);
+    int* row = counts.data() + counts.size() - n_sites;
+    std::uint64_t detect_seed = seed ^ 0x9E3779B97F4A7C15ULL; // Not the perturbation streams
+    for (int i = 0; i < b.n; i++) {
+      double px = b.x[i], py = b.y[i];
+      sites.index.for_each_near(px, py, [&](int s) {
+        double d = sites.distance(s, px, py);
+        if (d < 0) return; // Not in site s
+        double sg = sites.sigma[s];
+        if (sg > 0) {
+          double u0, u1;
+          std::uint32_t boid = id ? (std::uint32_t)(id[i] - 1) : (std::uint32_t)i;
+          uniform_pair(detect_seed, t, ((std::uint64_t)s << 32) | boid, u0, u1);
+          if (u0 >= exp(-d * d / (2 * sg * sg))) return; // Missed
+        }
+        row[s]++;
+      });
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,199 @@
+// Streaming trajectory file: binary, columnar, memory-mappable.
+// Snapshots are appended frame by frame while the simulation runs, by a
+// background thread, so a long run never holds its trajectory in memory;
+// any frame can later be read back at random from a memory map.
+//
+// Layout (little-endian, as written by x86-64 and AArch64):
+//   header, 32 bytes:  char magic[8] = "BOIDTRJ", uint32 version = 2,
+//                      uint32 header_bytes = 32, 16 bytes reserved (0)
+//   then per frame:    int64 step, uint32 n_boids, uint32 n_predators,
+//                      float32 x[n_boids], y[n_boids], vx[n_boids], vy[n_boids],
+//                      float32 x[n_predators], y[...], vx[...], vy[...],
+//                      int64 id[n_boids]
+// Frames are self-describing, so the number of agents may change between
+// frames; a reader finds the frames by hopping from one frame header to
+// the next. A frame cut short (e.g. by a crash) is ignored. The boid ids
+// follow each boid for life (the row of a boid changes when boids are
+// born, die or are reordered); every block is 8-byte aligned.
+#ifndef BOIDS_TRAJECTORY_H
+#define BOIDS_TRAJECTORY_H
+
+#include <condition_variable> // For the writer queue
+#include <cstdint>   // For fixed-width integers
+#include <cstdio>    // For FILE
+#include <cstring>   // For std::memcpy
+#include <deque>     // For the writer queue
+#include <mutex>     // For the writer queue
+#include <stdexcept> // For std::runtime_error
+#include <string>    // For file names
+#include <thread>    // For the writer thread
+#include <vector>    // For std::vector
+#include "boids.kernels.h" // SwarmView
+#include "boids.mapped.h"  // Memory-mapped reading
+
+const char trajectory_magic[8] = {'B', 'O', 'I', 'D', 'T', 'R', 'J', 0};
+const std::uint32_t trajectory_version = 2;
+const std::size_t trajectory_header_bytes = 32;
+const std::size_t trajectory_frame_header_bytes = 16;
+
+// Appends frames to a trajectory file. write() only packs the frame; a
+// background thread does the file I/O, with at most `max_pending` frames
+// waiting (write() blocks beyond that, so memory stays bounded).
+class TrajectoryWriter {
+public:
+  explicit TrajectoryWriter(const std::string& path, int max_pending = 16)
+    : max_pending(max_pending) {
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) throw std::runtime_error("cannot open trajectory file " + path);
+    char header[trajectory_header_bytes] = {0};
+    std::memcpy(header, trajectory_magic, 8);
+    std::memcpy(header + 8, &trajectory_version, 4);
+    std::uint32_t header_bytes = trajectory_header_bytes;
+    std::memcpy(header + 12, &header_bytes, 4);
+    failed = std::fwrite(header, 1, sizeof(header), file) != sizeof(header);
+    worker = std::thread([this] { drain(); });
+  }
+
+  ~TrajectoryWriter() { close(); }
+
+  TrajectoryWriter(const TrajectoryWriter&) = delete;
+  TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+  // Queue the frame of step `step` (boids b with ids `id`, or 1 .. n if
+  // null; predators p), as float32
+  template <class T>
+  void write(std::int64_t step, const SwarmView<T>& b, const SwarmView<T>& p,
+             const std::int64_t* id = nullptr) {
+    std::vector<char> frame(trajectory_frame_header_bytes + 16 * ((std::size_t)b.n + p.n) + 8 * (std::size_t)b.n);
+    std::uint32_t nb = b.n, np = p.n;
+    std::memcpy(frame.data(), &step, 8);
+    std::memcpy(frame.data() + 8, &nb, 4);
+    std::memcpy(frame.data() + 12, &np, 4);
+    float* out = reinterpret_cast<float*>(frame.data() + trajectory_frame_header_bytes);
+    for (const SwarmView<T>* v : {&b, &p}) {
+      for (const T* col : {v->x, v->y, v->vx, v->vy}) {
+        for (int i = 0; i < v->n; i++) *out++ = (float)col[i];
+      }
+    }
+    char* ids = reinterpret_cast<char*>(out);
+    for (int i = 0; i < b.n; i++) {
+      std::int64_t v = id ? id[i] : i + 1;
+      std::memcpy(ids + 8 * (std::size_t)i, &v, 8);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    room.wait(lock, [this] { return (int)queue.size() < max_pending; });
+    queue.push_back(std::move(frame));
+    ready.notify_one();
+  }
+
+  // Write out the pending frames and close the file; false if any write failed
+  bool close() {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+      }
+      ready.notify_one();
+      worker.join();
+    }
+    if (file) {
+      failed = (std::fclose(file) != 0) || failed;
+      file = nullptr;
+    }
+    return !failed;
+  }
+
+private:
+  std::FILE* file = nullptr;
+  int max_pending;
+  bool failed = false;   // A write failed (reported by close)
+  bool closing = false;  // No more frames will be queued
+  std::deque<std::vector<char>> queue; // Packed frames waiting to be written
+  std::mutex mutex;
+  std::condition_variable ready, room; // Frames queued / room in the queue
+  std::thread worker;
+
+  // Writer thread: write frames in order until closed and drained
+  void drain() {
+    for (;;) {
+      std::vector<char> frame;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return closing || !queue.empty(); });
+        if (queue.empty()) return; // Closing and nothing left
+        frame = std::move(queue.front());
+        queue.pop_front();
+      }
+      room.notify_one();
+      if (std::fwrite(frame.data(), 1, frame.size(), file) != frame.size()) failed = true;
+    }
+  }
+};
+
+// Read-only view of a trajectory file through a memory map (see
+// MappedFile). Opening it hops once over the frame headers; each frame is
+// then reached directly.
+class TrajectoryReader {
+public:
+  struct Frame {
+    std::int64_t step;
+    int n_boids, n_predators;
+    const float* data; // Columns: boid x, y, vx, vy, then predator x, y, vx, vy
+    const std::int64_t* id; // Boid ids
+
+    const float* boid_column(int c) const { return data + (std::size_t)c * n_boids; }
+    const float* predator_column(int c) const {
+      return data + 4 * (std::size_t)n_boids + (std::size_t)c * n_predators;
+    }
+  };
+
+  explicit TrajectoryReader(const std::string& path) : file(path, "trajectory file") {
+    const char* base = file.data();
+    std::size_t size = file.size();
+    if (size < trajectory_header_bytes || std::memcmp(base, trajectory_magic, 8) != 0) {
+      throw std::runtime_error(path + " is not a boid trajectory file");
+    }
+    std::uint32_t version, header_bytes;
+    std::memcpy(&version, base + 8, 4);
+    std::memcpy(&header_bytes, base + 12, 4);
+    if (version != trajectory_version) {
+      throw std::runtime_error(path + ": unsupported trajectory version");
+    }
+    // --- Find the complete frames ---
+    std::size_t at = header_bytes;
+    while (at + trajectory_frame_header_bytes <= size) {
+      std::uint32_t nb, np;
+      std::memcpy(&nb, base + at + 8, 4);
+      std::memcpy(&np, base + at + 12, 4);
+      std::size_t bytes = trajectory_frame_header_bytes + 16 * ((std::size_t)nb + np) + 8 * (std::size_t)nb;
+      if (at + bytes > size) break; // Truncated last frame
+      offsets.push_back(at);
+      at += bytes;
+    }
+  }
+
+  TrajectoryReader(const TrajectoryReader&) = delete;
+  TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+  int n_frames() const { return (int)offsets.size(); }
+
+  Frame frame(int f) const {
+    const char* at = file.data() + offsets[f];
+    Frame fr;
+    std::uint32_t nb, np;
+    std::memcpy(&fr.step, at, 8);
+    std::memcpy(&nb, at + 8, 4);
+    std::memcpy(&np, at + 12, 4);
+    fr.n_boids = (int)nb;
+    fr.n_predators = (int)np;
+    fr.data = reinterpret_cast<const float*>(at + trajectory_frame_header_bytes); // 8-byte aligned
+    fr.id = reinterpret_cast<const std::int64_t*>(fr.data + 4 * ((std::size_t)nb + np));
+    return fr;
+  }
+
+private:
+  MappedFile file;
+  std::vector<std::size_t> offsets; // Byte offset of each complete frame
+};
+
+#endif
@@ -0,0 +1,109 @@
+// Verlet neighbour lists: for each boid, the boids that were within
+// neighbor_radius + skin when the list was built. As long as no boid has
+// moved by more than half the skin since then, every pair now closer than
+// neighbor_radius is in the list, so the steps in between scan a short
+// contiguous list per boid instead of rebuilding and querying the grid.
+// The test is on the slots, not on who is in them: a boid born into a free
+// slot, or boids shuffled by a reorder, just count as displaced. Only a
+// change in the number of boids forces a rebuild by itself.
+// On a periodic grid the distances, and the displacements, are those of the
+// minimum images, so a boid wrapping around an edge has only moved by its step.
+#ifndef BOIDS_VERLET_H
+#define BOIDS_VERLET_H
+
+#include <algorithm> // For std::max, std::copy
+#include <cmath>     // For INFINITY, std::sqrt
+#include <vector>    // For std::vector
+#ifdef _OPENMP
+#include <omp.h>     // For the threaded displacement check and build
+#endif
+#include "boids.aligned.h" // Cache-line aligned buffers
+#include "boids.grid.h"    // CellGrid
+
+template <class T>
+struct VerletList {
+  double reach = 0;         // neighbor_radius + skin of the current list (0: none)
+  int n = 0;                // Number of boids it was built for
+  std::vector<int> start;   // Candidates of boid i: items[start[i] .. start[i+1])
+  std::vector<int> items;   // In the order the grid yields them (cell by cell)
+  AlignedBuffer<T> x0, y0;  // Positions at the build
+  bool periodic = false;    // Built on a periodic grid, over width x height
+  double width = 0, height = 0;
+
+  // Candidates of one boid gathered for the SIMD kernel, one set per thread
+  struct Gathered { AlignedBuffer<T> x, y, vx, vy; };
+  std::vector<Gathered> gathered;
+
+  // Largest distance of a boid from its position at the build (infinite if
+  // there is no list for n boids)
+  double max_displacement(const T* x, const T* y, int n_boids, int n_threads) const {
+    if (reach <= 0 || n_boids != n) return INFINITY;
+    double d2 = 0;
+    (void)n_threads; // Unused when compiled without OpenMP
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) reduction(max:d2) schedule(static) if(n_threads > 1)
+#endif
+    for (int i = 0; i < n_boids; i++) {
+      double dx = (double)x[i] - x0[i], dy = (double)y[i] - y0[i];
+      if (periodic) {
+        dx = min_image(dx, width);
+        dy = min_image(dy, height);
+      }
+      d2 = std::max(d2, dx * dx + dy * dy);
+    }
+    return std::sqrt(d2);
+  }
+
+  // Rebuild from the boids binned in `grid` (cells at least `list_reach`
+  // wide). The boids are cut into one contiguous chunk per thread; each
+  // thread lists the candidates of its chunk into its own buffer, and the
+  // buffers are joined in chunk order, so the lists come out the same for
+  // any number of threads.
+  void build(const CellGrid& grid, const T* x, const T* y, int n_boids,
+             double list_reach, int n_threads) {
+    reach = list_reach;
+    n = n_boids;
+    x0.assign(x, x + n_boids);
+    y0.assign(y, y + n_boids);
+    periodic = grid.periodic;
+    width = grid.width;
+    height = grid.height;
+    double r2 = list_reach * list_reach;
+    start.assign(n_boids + 1, 0);
+    if ((int)chunks.size() < n_threads) chunks.resize(n_threads);
+
+    // --- 1. Candidates of each chunk (ends of the lists relative to the chunk) ---
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1) if(n_threads > 1)
+#endif
+    for (int t = 0; t < n_threads; t++) {
+      std::vector<int>& out = chunks[t];
+      out.clear();
+      int from = (int)((long long)n_boids * t / n_threads), to = (int)((long long)n_boids * (t + 1) / n_threads);
+      for (int i = from; i < to; i++) {
+        grid.for_each_near(x[i], y[i], [&](int j) {
+          double dx = grid.offset_x((double)x[i] - x[j]), dy = grid.offset_y((double)y[i] - y[j]);
+          if (j != i && dx * dx + dy * dy < r2) out.push_back(j);
+        });
+        start[i + 1] = (int)out.size();
+      }
+    }
+
+    // --- 2. Join the chunks ---
+    std::size_t total = 0;
+    for (int t = 0; t < n_threads; t++) total += chunks[t].size();
+    items.resize(total);
+    int offset = 0;
+    for (int t = 0; t < n_threads; t++) {
+      int from = (int)((long long)n_boids * t / n_threads), to = (int)((long long)n_boids * (t + 1) / n_threads);
+      for (int i = from; i < to; i++) start[i + 1] += offset;
+      std::copy(chunks[t].begin(), chunks[t].end(), items.begin() + offset);
+      offset += (int)chunks[t].size();
+    }
+  }
+
+private:
+  std::vector<std::vector<int>> chunks; // Per-thread candidates during a build
+};
+
+#endif
@@ -0,0 +1,292 @@
+// Persistent native simulation state.
+// A BoidWorld owns the boids, predators and areas in cache-aligned SoA
+// buffers, together with the parameters, the step workspace (grid, copies)
+// and the noise stream state, so that it can be stepped many times from R
+// (through an external pointer) without copying anything in or out.
+// The state is held in double or in float precision, chosen when the world
+// is created; code that reads or writes it goes through BoidWorld::visit.
+// With the GPU backend (BoidWorld::on_device, see boids.gpu.h) the state is
+// stepped in device memory, and the host copy is refreshed from it only
+// when the host reads it.
+#ifndef BOIDS_WORLD_H
+#define BOIDS_WORLD_H
+
+#include <cmath>   // For std::sqrt
+#include <cstdint> // For std::uint64_t
+#include <memory>  // For std::unique_ptr
+#include "boids.aligned.h" // Cache-line aligned buffers
+#include "boids.flocks.h"  // Group detection
+#include "boids.gpu.h"     // Device copy of the state (compiled out by default)
+#include "boids.kernels.h" // Boid and predator step kernels
+#include "boids.population.h" // Births, deaths and kills
+#include "boids.profile.h" // Phase timers and counters (compiled out by default)
+#include "boids.raster.h"  // Animation frames
+#include "boids.survey.h"  // Survey sampler
+#include "boids.trajectory.h" // Streaming trajectory file
+
+// Positions and velocities of a group of agents, in precision T
+template <class T>
+struct SwarmState {
+  AlignedBuffer<T> x, y, vx, vy;
+
+  int size() const { return (int)x.size(); }
+
+  void assign(const double* px, const double* py,
+              const double* pvx, const double* pvy, int n) {
+    x.assign(px, px + n);
+    y.assign(py, py + n);
+    vx.assign(pvx, pvx + n);
+    vy.assign(pvy, pvy + n);
+  }
+
+  SwarmView<T> view() {
+    return SwarmView<T>{x.data(), y.data(), vx.data(), vy.data(), size()};
+  }
+};
+
+// Centres and radii of a set of static areas, in precision T, with the
+// cell index of the areas (rebuilt whenever the areas or the domain change)
+template <class T>
+struct AreaState {
+  AlignedBuffer<T> x, y, radius, radius2;
+  AreaGrid index;
+
+  int size() const { return (int)x.size(); }
+
+  void assign(const double* px, const double* py, const double* pr, int n) {
+    x.assign(px, px + n);
+    y.assign(py, py + n);
+    set_radius(pr);
+  }
+
+  // Replace the radii (one per area), keeping their squares in step
+  void set_radius(const double* pr) {
+    radius.assign(pr, pr + size());
+    radius2.resize(size());
+    for (int k = 0; k < size(); k++) radius2[k] = (T)squared_radius(pr[k]);
+    index.build(x.data(), y.data(), radius.data(), size(), index.width, index.height, index.periodic);
+  }
+
+  // Fit the index to the simulation domain (periodic: discs wrap around its edges)
+  void set_domain(double width, double height, bool periodic = false) {
+    if (width == index.width && height == index.height && periodic == index.periodic) return;
+    index.build(x.data(), y.data(), radius.data(), size(), width, height, periodic);
+  }
+
+  AreaView<T> view() const {
+    return AreaView<T>{x.data(), y.data(), radius.data(), radius2.data(), size(), &index};
+  }
+};
+
+// Agents, areas and step workspace of a world, in precision T
+template <class T>
+struct WorldState {
+  SwarmState<T> boids, predators; // Moving agents
+  AreaState<T> p_areas, r_areas;  // Static poor (repulsive) and rich (attractive) areas
+  StepWorkspace<T> ws;            // Grid and copies, reused across steps
+  AreaField<T> field;             // Baked area forces (used if par.area_field_cell > 0)
+
+  // One step: boid step then predator step, as in the R driver.
+  // On the grid, the predators reuse the cell list of the boid step; boids
+  // have moved by at most ws.grid_slack since it was built (max_speed plus
+  // the perturbation, plus their drift since the build with Verlet lists).
+  // With the ids of the boids (see Population::ids) each boid draws its
+  // perturbation from its own stream, so reordering or compacting the
+  // columns does not change the trajectories.
+  void step(const BoidParams& par, std::uint64_t seed, std::uint64_t step,
+            StepProfile* profile = nullptr, const std::int64_t* ids = nullptr) {
+    SwarmView<T> bv = boids.view(), pv = predators.view();
+    ws.tile.id = ids;
+    p_areas.set_domain(par.width, par.height, par.periodic);
+    r_areas.set_domain(par.width, par.height, par.periodic);
+    const AreaField<T>* baked = nullptr;
+    if (par.area_field_cell > 0) { // Rebaked only when the areas or the domain changed
+      field.update(p_areas.view(), r_areas.view(), par.width, par.height, par.area_field_cell, par.periodic);
+      baked = &field;
+    }
+    step_boids(bv, pv, p_areas.view(), r_areas.view(), par, ws, seed, step, baked, profile);
+    PhaseTimer timer(profile ? profile->lane(0) : nullptr);
+    step_predators(pv, bv, par, par.use_grid ? &ws.grid : nullptr, ws.grid_slack);
+    timer.lap(phase_predator_step);
+  }
+
+#if BOIDS_USE_GPU
+  DeviceWorld<T> device;          // Copy in device memory (used if BoidWorld::on_device)
+#endif
+
+  // One step on the device, uploading the host state first if it changed
+  // since the last upload (without BOIDS_USE_GPU: the CPU step)
+  void step_on_device(const BoidParams& par, std::uint64_t seed, std::uint64_t step,
+                      const std::int64_t* ids = nullptr) {
+#if BOIDS_USE_GPU
+    if (!device.current) device.upload(boids.view(), predators.view(), p_areas.view(), r_areas.view(), ids);
+    device.step(par, seed, step);
+#else
+    this->step(par, seed, step, nullptr, ids);
+#endif
+  }
+
+  // Refresh the host copy if the device has stepped since (else: nothing to do)
+  void sync_host() {
+#if BOIDS_USE_GPU
+    if (device.ahead) device.download(boids.view(), predators.view());
+#endif
+  }
+
+  // The host copy was changed (after sync_host): upload it before the next device step
+  void host_changed() {
+#if BOIDS_USE_GPU
+    device.invalidate();
+#endif
+  }
+
+  // Reorder the boids along a space-filling curve (Hilbert, or Z-order if
+  // !hilbert), so that boids close in space are close in memory; `id`
+  // (one per boid) is permuted with them. The curve runs through the cells
+  // of a grid with about one boid per cell, built as for the neighbour
+  // search; within a cell the previous order is kept, so each reorder only
+  // refines the last one.
+  void reorder(const BoidParams& par, bool hilbert, std::vector<std::int64_t>& id) {
+    int n = boids.size();
+    if (n < 2) return;
+    CellGrid curve;
+    curve.build(boids.x.data(), boids.y.data(), n, par.width, par.height,
+                std::sqrt(par.width * par.height / n));
+    std::vector<int> order;
+    curve.curve_order(hilbert, order);
+    AlignedBuffer<T> moved(n);
+    for (AlignedBuffer<T>* column : {&boids.x, &boids.y, &boids.vx, &boids.vy}) {
+      for (int i = 0; i < n; i++) moved[i] = (*column)[order[i]];
+      column->swap(moved);
+    }
+    std::vector<std::int64_t> moved_id(n);
+    for (int i = 0; i < n; i++) moved_id[i] = id[order[i]];
+    id.swap(moved_id);
+  }
+};
+
+class BoidWorld {
+public:
+  BoidParams par;               // Simulation parameters
+  std::uint64_t seed = 0;       // Seed of the noise streams
+  std::uint64_t step_count = 0; // Steps run so far (the counter of the noise streams)
+  SurveySites survey;           // Survey sites (none: no sampling)
+  SurveyCounts survey_counts;   // Counts of the sampled steps so far
+  int survey_stride = 1;        // Sample the survey every survey_stride steps
+  std::unique_ptr<TrajectoryWriter> trajectory; // Trajectory file being written (none: not recording)
+  int trajectory_stride = 1;    // Write a frame every trajectory_stride steps
+  std::unique_ptr<AnimationWriter> animation; // Animation being rendered (none: not rendering)
+  int animation_stride = 1;     // Draw a frame every animation_stride steps
+  Population population;        // Births, deaths and kills (inactive by default) and boid ids
+  FlockFinder flock_finder;     // Groups of the last sampled step
+  FlockRecord flocks;           // Group statistics of the sampled steps so far
+  int flock_stride = 0;         // Find the groups every flock_stride steps (0: never)
+  double flock_radius = 0;      // Link radius of the groups (0: neighbor_radius)
+  int reorder_every = 0;        // Reorder the boids along a space-filling curve every reorder_every steps (0: never)
+  bool reorder_hilbert = true;  // Curve: Hilbert (else Z-order)
+  StepProfile profile;          // Phase timers and counters (empty unless built with BOIDS_PROFILE)
+  bool on_device = false;       // Step on the GPU (only with BOIDS_USE_GPU; see boids.gpu.h)
+
+  explicit BoidWorld(bool single_precision = false) : single(single_precision) {}
+
+  bool single_precision() const { return single; }
+
+  // Take the agents, areas, parameters, seed, step count, population and
+  // backend of `other` (not its survey, trajectory or animation). The agents
+  // are those of its host copy: `other` must not have stepped on the device
+  // since it was last visited.
+  void copy_state(const BoidWorld& other) {
+    par = other.par;
+    seed = other.seed;
+    step_count = other.step_count;
+    single = other.single;
+    state_d = other.state_d;
+    state_f = other.state_f;
+    population = other.population;
+    reorder_every = other.reorder_every;
+    reorder_hilbert = other.reorder_hilbert;
+    on_device = other.on_device;
+  }
+
+  // Call f on the state (a WorldState<double> or WorldState<float>). On
+  // the device the host copy is refreshed first and, as f may change it,
+  // uploaded again before the next step.
+  template <class F>
+  void visit(F f) {
+    visit_state([&](auto& state) {
+      state.sync_host();
+      f(state);
+      state.host_changed();
+    });
+  }
+
+  // Advance by n_steps steps, sampling the survey and the groups, writing
+  // the trajectory and drawing the animation on the way. On the device the
+  // host copy is only refreshed for the steps that read it; births, deaths
+  // and kills are drawn on the host, and the boids are not reordered (the
+  // device step already reads them in cell order).
+  void step(int n_steps) {
+    ProfileSpan span(profile);
+    visit_state([&](auto& state) {
+      for (int s = 0; s < n_steps; s++) {
+        const std::int64_t* ids = population.ids(state.boids.size()); // Noise follows the boids, not their slots
+        if (on_device) state.step_on_device(par, seed, ++step_count, ids);
+        else state.step(par, seed, ++step_count, &profile, ids);
+        PhaseTimer timer(profile.lane(0));
+        profile.steps++;
+        if (!on_device || population.acts_at(step_count)) {
+          state.sync_host();
+          bool binned = !on_device && par.use_grid; // The cell list of this step's boid step
+          population.step(state.boids, state.predators, seed, step_count, par.width, par.height, par.periodic,
+                          binned ? &state.ws.grid : nullptr, state.ws.grid_slack);
+          if (on_device) state.host_changed();
+          timer.lap(phase_population);
+        }
+        if (!on_device && reorder_every > 0 && step_count % reorder_every == 0) {
+          population.ensure_ids(state.boids.size());
+          state.reorder(par, reorder_hilbert, population.id);
+          timer.lap(phase_reorder);
+        }
+        if (survey.size() && step_count % survey_stride == 0) {
+          state.sync_host();
+          survey.set_domain(par.width, par.height, par.periodic); // Sites wrap with the boids
+          survey_counts.record(survey, state.boids.view(), seed, step_count,
+                               population.ids(state.boids.size())); // Detections follow the boids, not their slots
+          timer.lap(phase_survey);
+        }
+        if (flock_stride > 0 && step_count % flock_stride == 0) {
+          state.sync_host();
+          flock_finder.find(state.boids.view(), flock_radius > 0 ? flock_radius : par.neighbor_radius,
+                            par.width, par.height, par.periodic);
+          flocks.record(flock_finder, step_count);
+          timer.lap(phase_flocks);
+        }
+        if (trajectory && step_count % trajectory_stride == 0) {
+          state.sync_host();
+          trajectory->write((std::int64_t)step_count, state.boids.view(), state.predators.view(),
+                            population.ids(state.boids.size()));
+          timer.lap(phase_output);
+        }
+        if (animation && step_count % animation_stride == 0) {
+          state.sync_host();
+          animation->add(state.boids.view(), state.predators.view(),
+                         state.p_areas.view(), state.r_areas.view());
+          timer.lap(phase_output);
+        }
+      }
+    });
+  }
+
+private:
+  // Call f on the state as it is (the host copy may be behind the device)
+  template <class F>
+  void visit_state(F f) {
+    if (single) f(state_f); else f(state_d);
+  }
+
+  bool single;                 // State held in float rather than double
+  WorldState<double> state_d;  // Double-precision state (unused in float worlds)
+  WorldState<float> state_f;   // Single-precision state (unused in double worlds)
+};
+
+#endif
@@ -0,0 +1,39 @@
+# R-side handle on a native boid world (boid_world_* in 1.rebound.poor.areas.cpp).
+# The state stays in C++ between calls; only what is asked for comes back to R.
+# Requires Rcpp::sourceCpp("1.rebound.poor.areas.cpp") first.
+
+new_boid_world <- function(boids, predators, p_areas, r_areas,
+                           p_area_radius, r_area_radius, params, seed = NULL) {
+  ptr <- boid_world_create(boids, predators, p_areas, r_areas,
+                           p_area_radius, r_area_radius, params, seed)
+  boid_world_handle(ptr)
+}
+
+# World restored from a checkpoint (a file, or checkpoint_open(file) to fork
+# many worlds from one file); params and seed override the saved ones
+restore_boid_world <- function(checkpoint, params = list(), seed = NULL) {
+  boid_world_handle(boid_world_restore(checkpoint, params, seed))
+}
+
+boid_world_handle <- function(ptr) {
+  list(
+    step = function(n = 1) invisible(boid_world_step(ptr, n)), # advance n steps
+    get_positions = function() boid_world_get_positions(ptr),  # list(boids, predators, step)
+    set_params = function(...) invisible(boid_world_set_params(ptr, list(...))),
+    get_params = function() boid_world_get_params(ptr),
+    set_survey = function(sites, stride = 1) invisible(boid_world_set_survey(ptr, sites, stride)), # NULL removes it
+    get_survey = function(clear = FALSE) boid_world_get_survey(ptr, clear), # list(step, counts)
+    get_population = function(clear = FALSE) boid_world_get_population(ptr, clear), # yearly step, n_boids, births, deaths, kills
+    set_flocks = function(radius = 0, stride = 1, min_size = 2) # radius 0: neighbor_radius; stride 0 stops
+      invisible(boid_world_set_flocks(ptr, radius, stride, min_size)),
+    get_flocks = function(clear = FALSE) boid_world_get_flocks(ptr, clear), # list(summary, histogram, groups)
+    get_profile = function(clear = FALSE) boid_world_get_profile(ptr, clear), # list(phases, counters); needs BOIDS_PROFILE
+    open_trajectory = function(path, stride = 1) invisible(boid_world_open_trajectory(ptr, path, stride)),
+    close_trajectory = function() invisible(boid_world_close_trajectory(ptr)), # read back with trajectory_read()
+    open_animation = function(path, stride = 1, delay = 0.1, style = list())
+      invisible(boid_world_open_animation(ptr, path, stride, delay, style)), # .gif, or numbered .png files
+    close_animation = function() invisible(boid_world_close_animation(ptr)),
+    save = function(path) invisible(boid_world_save(ptr, path)), # checkpoint; see restore_boid_world()
+    ptr = ptr
+  )
+}